@@ -0,0 +1,175 @@
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <Rcpp.h>
+#include "Parallel.hpp"
+
+/*
+ * Column concatenation for append. Each output column is allocated once,
+ * at its final length, and the pieces are copied into place, in parallel
+ * for numeric columns. A piece whose storage is narrower than the output
+ * (logical or integer going into double) is widened as it's copied, and a
+ * missing piece (a variable one dataset doesn't have) is filled with NA,
+ * so nothing is converted or allocated piece by piece beforehand.
+ */
+
+namespace {
+
+// Pieces are copied in blocks of this many values, so that one long
+// piece still spreads over all the threads
+const R_xlen_t BLOCK_SIZE = 1 << 16;
+
+struct Block
+{
+    SEXPTYPE type;      // of the source; NILSXP if there is none
+    const void *src;
+    R_xlen_t from;      // offset into the source
+    R_xlen_t to;        // offset into the output
+    R_xlen_t n;
+};
+
+template<typename T>
+void
+fill(T *out, R_xlen_t n, T value)
+{
+    std::fill(out, out + n, value);
+}
+
+void
+copy_real(double *out, const Block &b)
+{
+    if(b.type == NILSXP)
+    {
+        fill(out, b.n, NA_REAL);
+    } else if(b.type == REALSXP)
+    {
+        memcpy(out, (const double *) b.src + b.from, b.n * sizeof(double));
+    } else
+    {
+        // Logical and integer storage are the same, NA included
+        const int *src = (const int *) b.src + b.from;
+        for(R_xlen_t i = 0; i < b.n; i++)
+            out[i] = src[i] == NA_INTEGER ? NA_REAL : (double) src[i];
+    }
+}
+
+void
+copy_integer(int *out, const Block &b)
+{
+    if(b.type == NILSXP)
+        fill(out, b.n, NA_INTEGER);
+    else
+        memcpy(out, (const int *) b.src + b.from, b.n * sizeof(int));
+}
+
+} // namespace
+
+// Concatenate the vectors in parts, of the given lengths, into one vector
+// of type type ("logical", "integer", "double" or "character"). A NULL
+// part stands for lengths[k] missing values. Numeric parts may be of any
+// narrower type than the output; attributes aren't copied.
+// [[Rcpp::export]]
+SEXP
+concat_columns(Rcpp::List parts, Rcpp::NumericVector lengths, std::string type)
+{
+    if(parts.size() != lengths.size())
+        Rcpp::stop("Every part needs a length");
+
+    SEXPTYPE out_type;
+    if(type == "logical")
+        out_type = LGLSXP;
+    else if(type == "integer")
+        out_type = INTSXP;
+    else if(type == "double")
+        out_type = REALSXP;
+    else if(type == "character")
+        out_type = STRSXP;
+    else
+        Rcpp::stop("Cannot concatenate columns of type " + type);
+
+    // Check the parts and lay them out in the output
+    std::vector<R_xlen_t> start(parts.size() + 1, 0);
+    for(R_xlen_t k = 0; k < parts.size(); k++)
+    {
+        SEXP x = parts[k];
+        R_xlen_t n = (R_xlen_t) lengths[k];
+
+        if(!Rf_isNull(x))
+        {
+            SEXPTYPE t = TYPEOF(x);
+            bool ok = (out_type == STRSXP && t == STRSXP) ||
+                      (out_type == REALSXP && (t == REALSXP || t == INTSXP || t == LGLSXP)) ||
+                      (out_type == INTSXP && (t == INTSXP || t == LGLSXP)) ||
+                      (out_type == LGLSXP && t == LGLSXP);
+
+            if(!ok)
+                Rcpp::stop("Column part has a wider type than the output");
+            if(Rf_xlength(x) != n)
+                Rcpp::stop("Column part has the wrong length");
+        }
+
+        start[k + 1] = start[k] + n;
+    }
+    R_xlen_t total = start[parts.size()];
+
+    if(out_type == STRSXP)
+    {
+        Rcpp::CharacterVector out(Rcpp::no_init(total));
+
+        for(R_xlen_t k = 0; k < parts.size(); k++)
+        {
+            SEXP x = parts[k];
+            for(R_xlen_t i = 0; i < start[k + 1] - start[k]; i++)
+                SET_STRING_ELT(out, start[k] + i, Rf_isNull(x) ? NA_STRING : STRING_ELT(x, i));
+        }
+
+        return out;
+    }
+
+    // Gather the data pointers here, on the main thread
+    std::vector<Block> blocks;
+    for(R_xlen_t k = 0; k < parts.size(); k++)
+    {
+        SEXP x = parts[k];
+        Block b = { NILSXP, NULL, 0, 0, 0 };
+
+        if(!Rf_isNull(x))
+        {
+            b.type = TYPEOF(x);
+            b.src = b.type == REALSXP ? (const void *) REAL(x) : (const void *) INTEGER(x);
+        }
+
+        for(R_xlen_t off = 0; off < start[k + 1] - start[k]; off += BLOCK_SIZE)
+        {
+            b.from = off;
+            b.to = start[k] + off;
+            b.n = std::min(BLOCK_SIZE, start[k + 1] - start[k] - off);
+            blocks.push_back(b);
+        }
+    }
+
+    int nthreads = ado_threads_for(blocks.size(), 4);
+
+    if(out_type == REALSXP)
+    {
+        Rcpp::NumericVector out(Rcpp::no_init(total));
+        double *dst = REAL(out);
+
+        #pragma omp parallel for schedule(dynamic) num_threads(nthreads)
+        for(R_xlen_t j = 0; j < (R_xlen_t) blocks.size(); j++)
+            copy_real(dst + blocks[j].to, blocks[j]);
+
+        return out;
+    }
+
+    Rcpp::RObject out = Rf_allocVector(out_type, total);
+    int *dst = out_type == LGLSXP ? LOGICAL(out) : INTEGER(out);
+
+    #pragma omp parallel for schedule(dynamic) num_threads(nthreads)
+    for(R_xlen_t j = 0; j < (R_xlen_t) blocks.size(); j++)
+        copy_integer(dst + blocks[j].to, blocks[j]);
+
+    return out;
+}
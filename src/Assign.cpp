@@ -0,0 +1,177 @@
+#include <cmath>
+#include <climits>
+
+#include <Rcpp.h>
+#include "NumericColumns.hpp"
+#include "Parallel.hpp"
+
+/*
+ * Masked assignment for generate and replace. The new values are written
+ * straight into the column's existing vector, only at the rows the mask
+ * selects, so an "if" on a replace costs one pass over the column rather
+ * than a subset of the values and a copy of the column. This modifies an
+ * R vector in place, as data.table's := does, so the caller must make sure
+ * the vector isn't shared with anything else.
+ */
+
+namespace {
+
+// Each thread should get at least this many rows
+const R_xlen_t MIN_ROWS_PER_THREAD = 1 << 16;
+
+// The values may be of length 1, to be recycled
+inline R_xlen_t
+at(R_xlen_t i, R_xlen_t nval)
+{
+    return nval == 1 ? 0 : i;
+}
+
+// Both NA, or equal
+inline bool
+same_real(double a, double b)
+{
+    if(std::isnan(a) || std::isnan(b))
+        return std::isnan(a) && std::isnan(b);
+    return a == b;
+}
+
+} // namespace
+
+// Set x[i] to values[i] (or values[1] if values has length 1) at every row
+// i where mask is TRUE, or at every row if mask is NULL. x must be at
+// least as wide as values: a double column takes double, integer or
+// logical values, an integer column integer or logical ones, and a string
+// column strings. Returns the number of values that changed.
+// [[Rcpp::export]]
+double
+assign_where(SEXP x, SEXP values, SEXP mask)
+{
+    R_xlen_t n = Rf_xlength(x), nval = Rf_xlength(values);
+
+    if(nval != n && nval != 1)
+        Rcpp::stop("Values must have one element per row, or just one");
+
+    const int *mp = NULL;
+    if(!Rf_isNull(mask))
+    {
+        if(TYPEOF(mask) != LGLSXP || Rf_xlength(mask) != n)
+            Rcpp::stop("Mask must be a logical vector with one element per row");
+        mp = LOGICAL(mask);
+    }
+
+    SEXPTYPE xt = TYPEOF(x), vt = TYPEOF(values);
+    int nthreads = ado_threads_for(n, MIN_ROWS_PER_THREAD);
+    double changed = 0;
+
+    if(xt == STRSXP)
+    {
+        if(vt != STRSXP)
+            Rcpp::stop("Type mismatch");
+
+        for(R_xlen_t i = 0; i < n; i++)
+        {
+            if(!selected(mp, i))
+                continue;
+
+            SEXP v = STRING_ELT(values, at(i, nval));
+            if(STRING_ELT(x, i) != v)
+            {
+                SET_STRING_ELT(x, i, v);
+                changed++;
+            }
+        }
+    } else if(xt == REALSXP)
+    {
+        double *dst = REAL(x);
+
+        if(vt == REALSXP)
+        {
+            const double *src = REAL(values);
+
+            #pragma omp parallel for reduction(+:changed) num_threads(nthreads)
+            for(R_xlen_t i = 0; i < n; i++)
+            {
+                if(selected(mp, i) && !same_real(dst[i], src[at(i, nval)]))
+                {
+                    dst[i] = src[at(i, nval)];
+                    changed++;
+                }
+            }
+        } else if(vt == INTSXP || vt == LGLSXP)
+        {
+            const int *src = vt == INTSXP ? INTEGER(values) : LOGICAL(values);
+
+            #pragma omp parallel for reduction(+:changed) num_threads(nthreads)
+            for(R_xlen_t i = 0; i < n; i++)
+            {
+                if(!selected(mp, i))
+                    continue;
+
+                int v = src[at(i, nval)];
+                double d = v == NA_INTEGER ? NA_REAL : (double) v;
+                if(!same_real(dst[i], d))
+                {
+                    dst[i] = d;
+                    changed++;
+                }
+            }
+        } else
+        {
+            Rcpp::stop("Type mismatch");
+        }
+    } else if(xt == INTSXP || xt == LGLSXP)
+    {
+        if(vt != INTSXP && vt != LGLSXP)
+            Rcpp::stop("Type mismatch");
+        if(xt == LGLSXP && vt == INTSXP)
+            Rcpp::stop("Cannot store integers in a logical column");
+
+        int *dst = xt == INTSXP ? INTEGER(x) : LOGICAL(x);
+        const int *src = vt == INTSXP ? INTEGER(values) : LOGICAL(values);
+
+        #pragma omp parallel for reduction(+:changed) num_threads(nthreads)
+        for(R_xlen_t i = 0; i < n; i++)
+        {
+            if(selected(mp, i) && dst[i] != src[at(i, nval)])
+            {
+                dst[i] = src[at(i, nval)];
+                changed++;
+            }
+        }
+    } else
+    {
+        Rcpp::stop("Cannot assign to a column of this type");
+    }
+
+    return changed;
+}
+
+// Are the values at the rows mask selects (all rows if mask is NULL) all
+// missing or whole numbers that fit in an integer column?
+// [[Rcpp::export]]
+bool
+fits_integer(Rcpp::NumericVector values, SEXP mask)
+{
+    R_xlen_t n = values.size();
+    const double *vp = REAL(values);
+    const int *mp = Rf_isNull(mask) ? NULL : LOGICAL(mask);
+
+    if(mp != NULL && Rf_xlength(mask) != n)
+        Rcpp::stop("Mask must have one element per value");
+
+    int nthreads = ado_threads_for(n, MIN_ROWS_PER_THREAD);
+    int bad = 0;
+
+    #pragma omp parallel for reduction(|:bad) num_threads(nthreads)
+    for(R_xlen_t i = 0; i < n; i++)
+    {
+        double v = vp[i];
+        if(selected(mp, i) && !std::isnan(v) &&
+           (v != std::floor(v) || v <= INT_MIN || v > INT_MAX))
+        {
+            bad = 1;
+        }
+    }
+
+    return !bad;
+}
@@ -0,0 +1,64 @@
+#include <vector>
+
+#include <Rcpp.h>
+#include "Columns.hpp"
+#include "Hashing.hpp"
+#include "Parallel.hpp"
+
+/*
+ * Group boundaries for the by prefix. The data must already be grouped
+ * (sorted, in Stata's terms) by the by variables, so each group is a run
+ * of adjacent rows, found by comparing each row's key with the previous
+ * row's, in parallel. The commands under by then work on row ranges of
+ * the table as it is, with nothing copied or split. To check that the
+ * data really is grouped, the first row of every run goes into a hash
+ * table: a key turning up at the head of two runs means the rows with
+ * that key aren't together.
+ */
+
+namespace {
+
+// Each thread should get at least this many rows
+const size_t MIN_ROWS_PER_THREAD = 1 << 16;
+
+} // namespace
+
+// The first row (from 1) of each run of rows with equal values of the key
+// columns in cols, or NULL if some key value is split over several runs.
+// [[Rcpp::export]]
+SEXP
+group_starts(Rcpp::List cols)
+{
+    KeyColumns keys(cols);
+    size_t n = keys.nrow();
+
+    std::vector<char> head(n);
+    int nthreads = ado_threads_for(n, MIN_ROWS_PER_THREAD);
+
+    #pragma omp parallel for num_threads(nthreads)
+    for(R_xlen_t i = 0; i < (R_xlen_t) n; i++)
+        head[i] = i == 0 || !keys.equal(i, i - 1);
+
+    std::vector<int> starts;
+    for(size_t i = 0; i < n; i++)
+        if(head[i])
+            starts.push_back((int) i);
+
+    RowTable table(starts.size());
+    for(size_t k = 0; k < starts.size(); k++)
+    {
+        bool inserted;
+        table.insert(starts[k], keys.hash(starts[k]),
+                     [&keys](int64_t a, int64_t b) { return keys.equal(a, b); },
+                     &inserted);
+
+        if(!inserted)
+            return R_NilValue;
+    }
+
+    Rcpp::IntegerVector ret(Rcpp::no_init(starts.size()));
+    for(size_t k = 0; k < starts.size(); k++)
+        ret[k] = starts[k] + 1;
+
+    return ret;
+}
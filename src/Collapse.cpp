@@ -0,0 +1,705 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <Rcpp.h>
+#include "Columns.hpp"
+#include "Grouping.hpp"
+#include "Parallel.hpp"
+#include "Statistics.hpp"
+
+/*
+ * The aggregation engine behind collapse. Rows are numbered by group with
+ * a hash table, and then every statistic asked for is computed from one
+ * scan of the rows, whatever the number of statistics or variables:
+ *
+ *     o) With few groups, each thread accumulates running sums, moments,
+ *        extremes and first/last rows for its own block of rows into
+ *        private per-group slots, and the threads' partials are merged at
+ *        the end.
+ *     o) With many groups, per-thread copies of the per-group state would
+ *        cost more memory than the data, so the rows are instead sorted
+ *        into one run per group and the runs are aggregated independently
+ *        in parallel. Percentiles need their group's values in order
+ *        anyway, so they always take this route.
+ */
+
+namespace {
+
+enum Stat
+{
+    ST_MEAN,
+    ST_SUM,
+    ST_RAWSUM,
+    ST_COUNT,
+    ST_PERCENT,
+    ST_SD,
+    ST_SEMEAN,
+    ST_MIN,
+    ST_MAX,
+    ST_FIRST,
+    ST_LAST,
+    ST_FIRSTNM,
+    ST_LASTNM,
+    ST_PCTILE,
+    ST_IQR
+};
+
+enum WeightKind
+{
+    WT_NONE,
+    WT_FREQ,
+    WT_ANALYTIC,
+    WT_IMPORTANCE,
+    WT_PROB
+};
+
+// Each thread should get at least this many rows
+const size_t MIN_ROWS_PER_THREAD = 1 << 16;
+
+// Below this many rows, grouping in parallel costs more than it saves
+const size_t PARALLEL_GROUP_ROWS = 1 << 20;
+
+Stat
+parse_stat(const std::string &s)
+{
+    static const char *names[] = {
+        "mean", "sum", "rawsum", "count", "percent", "sd", "semean",
+        "min", "max", "first", "last", "firstnm", "lastnm", "pctile", "iqr"
+    };
+
+    for(size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+        if(s == names[i])
+            return (Stat) i;
+
+    throw std::runtime_error("Unknown statistic: " + s);
+}
+
+WeightKind
+parse_weight_kind(const std::string &s)
+{
+    if(s == "")
+        return WT_NONE;
+    if(s == "fweight")
+        return WT_FREQ;
+    if(s == "aweight")
+        return WT_ANALYTIC;
+    if(s == "iweight")
+        return WT_IMPORTANCE;
+    if(s == "pweight")
+        return WT_PROB;
+
+    throw std::runtime_error("Unknown weight type: " + s);
+}
+
+bool
+needs_order(Stat s)
+{
+    return s == ST_PCTILE || s == ST_IQR;
+}
+
+// Statistics whose values are some row's value, and which can keep an
+// integer variable's storage
+bool
+picks_value(Stat s)
+{
+    return s == ST_MIN || s == ST_MAX || s == ST_FIRST || s == ST_LAST ||
+           s == ST_FIRSTNM || s == ST_LASTNM;
+}
+
+struct Source
+{
+    const int *itg;
+    const double *dbl;
+
+    double
+    value(size_t i) const
+    {
+        if(itg)
+            return itg[i] == NA_INTEGER ? NA_REAL : (double) itg[i];
+        return dbl[i];
+    }
+
+    bool
+    missing(size_t i) const
+    {
+        return itg ? itg[i] == NA_INTEGER : std::isnan(dbl[i]);
+    }
+};
+
+struct Spec
+{
+    Stat stat;
+    int source;
+    double pct;
+};
+
+struct Output
+{
+    int *itg;
+    double *dbl;
+};
+
+// Everything but the percentiles for one variable in one group. Rows must
+// be added in ascending order, and a partial merged into one covering
+// earlier rows.
+struct Accum
+{
+    double n, w;
+    double sum, rawsum;
+    double mean, m2;
+    double min, max;
+    int64_t first, last, firstnm, lastnm;
+
+    Accum()
+        : n(0), w(0), sum(0), rawsum(0), mean(0), m2(0),
+          min(INFINITY), max(-INFINITY),
+          first(-1), last(-1), firstnm(-1), lastnm(-1)
+    {
+    }
+
+    void
+    add(int64_t row, double x, double wt, bool miss)
+    {
+        if(first < 0)
+            first = row;
+        last = row;
+
+        if(miss)
+            return;
+
+        if(firstnm < 0)
+            firstnm = row;
+        lastnm = row;
+
+        n += 1;
+        sum += wt * x;
+        rawsum += x;
+
+        if(x < min)
+            min = x;
+        if(x > max)
+            max = x;
+
+        // West's weighted update of the mean and sum of squared deviations
+        double w2 = w + wt;
+        double d = x - mean;
+        if(w2 != 0)
+            mean += d * wt / w2;
+        m2 += wt * d * (x - mean);
+        w = w2;
+    }
+
+    void
+    merge(const Accum &o)
+    {
+        if(first < 0)
+            first = o.first;
+        if(o.last >= 0)
+            last = o.last;
+        if(firstnm < 0)
+            firstnm = o.firstnm;
+        if(o.lastnm >= 0)
+            lastnm = o.lastnm;
+
+        if(o.n == 0)
+            return;
+
+        if(n == 0)
+        {
+            n = o.n;
+            w = o.w;
+            sum = o.sum;
+            rawsum = o.rawsum;
+            mean = o.mean;
+            m2 = o.m2;
+            min = o.min;
+            max = o.max;
+
+            return;
+        }
+
+        // Chan et al.'s pairwise combination
+        double w2 = w + o.w;
+        double d = o.mean - mean;
+        if(w2 != 0)
+        {
+            m2 += o.m2 + d * d * w * o.w / w2;
+            mean += d * o.w / w2;
+        }
+        w = w2;
+
+        n += o.n;
+        sum += o.sum;
+        rawsum += o.rawsum;
+        min = std::min(min, o.min);
+        max = std::max(max, o.max);
+    }
+};
+
+// The count statistic: frequency-like weights count for what they say,
+// analytic weights just scale the observations they're on
+double
+weighted_count(const Accum &a, WeightKind kind)
+{
+    if(kind == WT_FREQ || kind == WT_IMPORTANCE || kind == WT_PROB)
+        return a.w;
+    return a.n;
+}
+
+double
+std_dev(const Accum &a, WeightKind kind)
+{
+    double var;
+
+    if(kind == WT_FREQ || kind == WT_IMPORTANCE)
+    {
+        if(a.w <= 1)
+            return NA_REAL;
+        var = a.m2 / (a.w - 1);
+    } else
+    {
+        // Analytic weights are rescaled to sum to the number of
+        // observations, which unweighted data trivially satisfies
+        if(a.n <= 1 || a.w == 0)
+            return NA_REAL;
+        var = a.m2 / a.w * a.n / (a.n - 1);
+    }
+
+    return std::sqrt(std::max(var, 0.0));
+}
+
+class Collapser
+{
+    public:
+        Collapser(const std::vector<Source> &sources,
+                  const std::vector<Spec> &specs,
+                  const std::vector<Output> &outputs,
+                  const double *weights, WeightKind kind)
+            : sources(sources), specs(specs), outputs(outputs),
+              weights(weights), kind(kind)
+        {
+        }
+
+        void
+        by_partials(const Groups &groups, int nthreads)
+        {
+            size_t n = groups.id.size(), ngroups = groups.count();
+            size_t nvars = sources.size();
+
+            // Slot (t, v, g) is thread t's partial for variable v, group g
+            std::vector<Accum> acc((size_t) nthreads * nvars * ngroups);
+
+            #pragma omp parallel num_threads(nthreads)
+            {
+                int t = ado_thread_num();
+                Accum *mine = &acc[(size_t) t * nvars * ngroups];
+
+                // Static scheduling hands thread t the t-th block of rows,
+                // which is what the merge below relies on
+                #pragma omp for schedule(static)
+                for(R_xlen_t i = 0; i < (R_xlen_t) n; i++)
+                {
+                    size_t g = groups.id[i];
+                    double wt = weights ? weights[i] : 1;
+
+                    for(size_t v = 0; v < nvars; v++)
+                        mine[v * ngroups + g].add(i, sources[v].value(i), wt,
+                                                  sources[v].missing(i));
+                }
+            }
+
+            #pragma omp parallel for num_threads(nthreads)
+            for(R_xlen_t k = 0; k < (R_xlen_t) (nvars * ngroups); k++)
+                for(int t = 1; t < nthreads; t++)
+                    acc[k].merge(acc[(size_t) t * nvars * ngroups + k]);
+
+            std::vector<std::pair<double, double> > none;
+
+            #pragma omp parallel for num_threads(nthreads)
+            for(R_xlen_t g = 0; g < (R_xlen_t) ngroups; g++)
+                for(size_t s = 0; s < specs.size(); s++)
+                    finish(s, g, acc[specs[s].source * ngroups + g], none);
+        }
+
+        void
+        by_runs(const Groups &groups, int nthreads)
+        {
+            GroupRuns runs = group_runs(groups);
+            size_t ngroups = groups.count();
+
+            std::vector<bool> ordered(sources.size(), false);
+            for(size_t s = 0; s < specs.size(); s++)
+                if(needs_order(specs[s].stat))
+                    ordered[specs[s].source] = true;
+
+            #pragma omp parallel num_threads(nthreads)
+            {
+                std::vector<std::pair<double, double> > sorted;
+
+                #pragma omp for schedule(dynamic, 64)
+                for(R_xlen_t g = 0; g < (R_xlen_t) ngroups; g++)
+                {
+                    for(size_t v = 0; v < sources.size(); v++)
+                    {
+                        const Source &src = sources[v];
+                        Accum a;
+                        sorted.clear();
+
+                        for(size_t k = runs.starts[g]; k < runs.starts[g + 1]; k++)
+                        {
+                            size_t i = runs.rows[k];
+                            double wt = weights ? weights[i] : 1;
+                            bool miss = src.missing(i);
+                            double x = src.value(i);
+
+                            a.add(i, x, wt, miss);
+                            if(ordered[v] && !miss)
+                                sorted.push_back(std::make_pair(x, wt));
+                        }
+
+                        if(ordered[v])
+                            std::sort(sorted.begin(), sorted.end());
+
+                        for(size_t s = 0; s < specs.size(); s++)
+                            if(specs[s].source == (int) v)
+                                finish(s, g, a, sorted);
+                    }
+                }
+            }
+        }
+
+        // Percentages need every group's count first
+        void
+        finish_percents(size_t ngroups)
+        {
+            for(size_t s = 0; s < specs.size(); s++)
+            {
+                if(specs[s].stat != ST_PERCENT)
+                    continue;
+
+                double *out = outputs[s].dbl, total = 0;
+                for(size_t g = 0; g < ngroups; g++)
+                    total += out[g];
+
+                for(size_t g = 0; g < ngroups; g++)
+                    out[g] = total > 0 ? 100 * out[g] / total : NA_REAL;
+            }
+        }
+
+    private:
+        const std::vector<Source> &sources;
+        const std::vector<Spec> &specs;
+        const std::vector<Output> &outputs;
+        const double *weights;
+        WeightKind kind;
+
+        // Write spec s's value for group g
+        void
+        finish(size_t s, size_t g, const Accum &a,
+               const std::vector<std::pair<double, double> > &sorted)
+        {
+            const Spec &spec = specs[s];
+            const Source &src = sources[spec.source];
+            const Output &out = outputs[s];
+
+            if(out.itg)
+            {
+                int64_t row = -1;
+                switch(spec.stat)
+                {
+                    case ST_FIRST: row = a.first; break;
+                    case ST_LAST: row = a.last; break;
+                    case ST_FIRSTNM: row = a.firstnm; break;
+                    case ST_LASTNM: row = a.lastnm; break;
+                    case ST_COUNT: out.itg[g] = (int) a.n; return;
+                    case ST_MIN: out.itg[g] = a.n > 0 ? (int) a.min : NA_INTEGER; return;
+                    case ST_MAX: out.itg[g] = a.n > 0 ? (int) a.max : NA_INTEGER; return;
+                    default: break;
+                }
+
+                out.itg[g] = row >= 0 ? src.itg[row] : NA_INTEGER;
+                return;
+            }
+
+            double val = NA_REAL;
+            switch(spec.stat)
+            {
+                case ST_MEAN:
+                    if(a.n > 0 && a.w != 0)
+                        val = a.sum / a.w;
+                    break;
+
+                case ST_SUM:
+                    // Analytic weights are normalized to sum to the number
+                    // of observations in the group
+                    if(kind == WT_ANALYTIC)
+                        val = a.w != 0 ? a.sum * a.n / a.w : 0;
+                    else
+                        val = a.sum;
+                    break;
+
+                case ST_RAWSUM: val = a.rawsum; break;
+
+                case ST_COUNT:
+                case ST_PERCENT:
+                    val = weighted_count(a, kind);
+                    break;
+
+                case ST_SD: val = std_dev(a, kind); break;
+
+                case ST_SEMEAN:
+                    val = std_dev(a, kind);
+                    if(!std::isnan(val))
+                        val /= std::sqrt(kind == WT_FREQ || kind == WT_IMPORTANCE ? a.w : a.n);
+                    break;
+
+                case ST_MIN:
+                    if(a.n > 0)
+                        val = a.min;
+                    break;
+
+                case ST_MAX:
+                    if(a.n > 0)
+                        val = a.max;
+                    break;
+
+                case ST_FIRST:
+                    if(a.first >= 0)
+                        val = src.value(a.first);
+                    break;
+
+                case ST_LAST:
+                    if(a.last >= 0)
+                        val = src.value(a.last);
+                    break;
+
+                case ST_FIRSTNM:
+                    if(a.firstnm >= 0)
+                        val = src.value(a.firstnm);
+                    break;
+
+                case ST_LASTNM:
+                    if(a.lastnm >= 0)
+                        val = src.value(a.lastnm);
+                    break;
+
+                case ST_PCTILE:
+                    if(!sorted.empty())
+                        val = weighted_percentile(sorted, a.w, spec.pct);
+                    break;
+
+                case ST_IQR:
+                    if(!sorted.empty())
+                        val = weighted_percentile(sorted, a.w, 75) -
+                              weighted_percentile(sorted, a.w, 25);
+                    break;
+            }
+
+            out.dbl[g] = val;
+        }
+};
+
+// Run the engine over groups, choosing between per-thread partials and
+// per-group runs by their memory cost
+void
+aggregate(Collapser &engine, const Groups &groups, size_t nvars, bool ordered,
+          int nthreads)
+{
+    double partial_bytes = (double) nthreads * nvars * groups.count() * sizeof(Accum);
+    double run_bytes = (double) groups.id.size() * 2 * sizeof(size_t);
+
+    if(ordered || partial_bytes > run_bytes)
+        engine.by_runs(groups, nthreads);
+    else
+        engine.by_partials(groups, nthreads);
+
+    engine.finish_percents(groups.count());
+}
+
+Source
+source_of(SEXP x)
+{
+    Source s = { NULL, NULL };
+
+    if(TYPEOF(x) == INTSXP)
+        s.itg = INTEGER(x);
+    else if(TYPEOF(x) == LGLSXP)
+        s.itg = LOGICAL(x);
+    else if(TYPEOF(x) == REALSXP)
+        s.dbl = REAL(x);
+    else
+        Rcpp::stop("Cannot aggregate a non-numeric variable");
+
+    return s;
+}
+
+} // namespace
+
+// Aggregate the variables in vars within the groups defined by the key
+// columns in by (all rows together if by is empty). Spec k computes
+// stats[k] of vars[[sources[k]]], with pcts[k] the percentile for
+// "pctile". weights is NULL or a double vector of nonnegative, nonmissing
+// weights of kind weight_kind ("" or "fweight", "aweight", ...).
+//
+// Returns a list: first, the first row (from 1) of each group, in order of
+// first appearance, and values, the statistics per group.
+// [[Rcpp::export]]
+Rcpp::List
+collapse_data(Rcpp::List by, Rcpp::List vars, Rcpp::IntegerVector sources,
+              Rcpp::CharacterVector stats, Rcpp::NumericVector pcts,
+              SEXP weights, std::string weight_kind)
+{
+    if(vars.size() == 0)
+        Rcpp::stop("No variables to collapse");
+
+    R_xlen_t n = Rf_xlength(vars[0]);
+    WeightKind kind = parse_weight_kind(weight_kind);
+
+    std::vector<Source> src;
+    for(R_xlen_t v = 0; v < vars.size(); v++)
+    {
+        SEXP x = vars[v];
+        if(Rf_xlength(x) != n)
+            Rcpp::stop("Variables differ in length");
+
+        src.push_back(source_of(x));
+    }
+
+    const double *wt = NULL;
+    if(!Rf_isNull(weights))
+    {
+        if(TYPEOF(weights) != REALSXP || Rf_xlength(weights) != n)
+            Rcpp::stop("Bad weights");
+        wt = REAL(weights);
+    }
+
+    int nthreads = ado_threads_for(n, MIN_ROWS_PER_THREAD);
+
+    Groups groups;
+    if(by.size() > 0)
+    {
+        KeyColumns keys(by);
+        if((R_xlen_t) keys.nrow() != n)
+            Rcpp::stop("Group variables differ in length");
+
+        groups = find_groups(keys, (size_t) n < PARALLEL_GROUP_ROWS ? 1 : nthreads);
+    } else
+    {
+        groups.id.assign(n, 0);
+        if(n > 0)
+            groups.first.push_back(0);
+    }
+    size_t ngroups = groups.count();
+
+    // Allocate the results here, on the main thread, and have the workers
+    // write through raw pointers
+    std::vector<Spec> specs;
+    std::vector<Output> outputs;
+    Rcpp::List values(stats.size());
+    bool ordered = false;
+
+    for(R_xlen_t k = 0; k < stats.size(); k++)
+    {
+        Spec spec = { parse_stat(Rcpp::as<std::string>(stats[k])),
+                      sources[k] - 1, pcts[k] };
+        if(spec.source < 0 || spec.source >= (int) src.size())
+            Rcpp::stop("Bad source variable index");
+
+        bool integer = (picks_value(spec.stat) && src[spec.source].itg) ||
+                       (spec.stat == ST_COUNT && kind == WT_NONE);
+
+        Output out = { NULL, NULL };
+        if(integer)
+        {
+            Rcpp::IntegerVector x(ngroups);
+            out.itg = INTEGER(x);
+            values[k] = x;
+        } else
+        {
+            Rcpp::NumericVector x(ngroups);
+            out.dbl = REAL(x);
+            values[k] = x;
+        }
+
+        ordered = ordered || needs_order(spec.stat);
+        specs.push_back(spec);
+        outputs.push_back(out);
+    }
+
+    Collapser engine(src, specs, outputs, wt, kind);
+    aggregate(engine, groups, src.size(), ordered, nthreads);
+
+    Rcpp::IntegerVector first(ngroups);
+    for(size_t g = 0; g < ngroups; g++)
+        first[g] = (int) groups.first[g] + 1;
+
+    return Rcpp::List::create(Rcpp::Named("first") = first,
+                              Rcpp::Named("values") = values);
+}
+
+// Statistic stat of x within groups, for egen: as collapse_data computes
+// it without weights, but with the groups given by number, from 1, as
+// group_index returns them. Rows whose number is NA are left out. Returns
+// each row's group's value, and NA for the rows left out.
+// [[Rcpp::export]]
+SEXP
+group_stat(Rcpp::IntegerVector ids, int ngroups, SEXP x, std::string stat,
+           double pct)
+{
+    R_xlen_t n = ids.size();
+    if(Rf_xlength(x) != n)
+        Rcpp::stop("Variable and group numbers differ in length");
+
+    std::vector<Source> src(1, source_of(x));
+    Groups groups = groups_from_ids(INTEGER(ids), n, ngroups);
+
+    Spec spec = { parse_stat(stat), 0, pct };
+    std::vector<Spec> specs(1, spec);
+
+    // One extra slot, for the rows left out
+    bool integer = (picks_value(spec.stat) && src[0].itg) || spec.stat == ST_COUNT;
+    Output out = { NULL, NULL };
+    Rcpp::RObject values;
+
+    if(integer)
+    {
+        values = Rcpp::IntegerVector(ngroups + 1);
+        out.itg = INTEGER(values);
+    } else
+    {
+        values = Rcpp::NumericVector(ngroups + 1);
+        out.dbl = REAL(values);
+    }
+    std::vector<Output> outputs(1, out);
+
+    int nthreads = ado_threads_for(n, MIN_ROWS_PER_THREAD);
+    Collapser engine(src, specs, outputs, NULL, WT_NONE);
+    aggregate(engine, groups, 1, needs_order(spec.stat), nthreads);
+
+    // Spread the values back over the rows
+    Rcpp::RObject ret = Rf_allocVector(integer ? INTSXP : REALSXP, n);
+    const int *id = INTEGER(ids);
+
+    if(integer)
+    {
+        int *dst = INTEGER(ret);
+
+        #pragma omp parallel for num_threads(nthreads)
+        for(R_xlen_t i = 0; i < n; i++)
+            dst[i] = id[i] == NA_INTEGER ? NA_INTEGER : out.itg[groups.id[i]];
+    } else
+    {
+        double *dst = REAL(ret);
+
+        #pragma omp parallel for num_threads(nthreads)
+        for(R_xlen_t i = 0; i < n; i++)
+            dst[i] = id[i] == NA_INTEGER ? NA_REAL : out.dbl[groups.id[i]];
+    }
+
+    return ret;
+}
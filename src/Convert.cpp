@@ -0,0 +1,289 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <Rcpp.h>
+#include "Parallel.hpp"
+#include "TextParse.hpp"
+
+/*
+ * The kernels behind destring and tostring. Both split the column into
+ * one chunk per thread. The R API isn't safe off the main thread, so the
+ * string pointers are collected before the parallel part (destring), or
+ * each thread formats into its own text buffer and the CHARSXPs are made
+ * from the buffers afterward (tostring).
+ *
+ * destring parses every cell into a new vector and counts the cells that
+ * aren't numbers, so the caller can look at the whole column before
+ * deciding whether to keep the result. tostring formats each value in a
+ * Stata display format, or else with the fewest significant digits that
+ * read back as the same double, and counts the values that don't read
+ * back exactly.
+ */
+
+namespace {
+
+// Each thread should get at least this many rows
+const R_xlen_t MIN_ROWS_PER_THREAD = 1 << 14;
+
+// A Stata numeric display format, %[-][0]w.d{f,e,g}[c]
+struct DisplayFormat
+{
+    int width;
+    int digits;
+    char kind;
+    bool comma;
+};
+
+DisplayFormat
+parse_format(const std::string &s)
+{
+    DisplayFormat f = { 0, 0, 'g', false };
+    size_t i = 0;
+
+    if(i < s.size() && s[i] == '%')
+        i++;
+    else
+        Rcpp::stop("Invalid format: " + s);
+
+    while(i < s.size() && (s[i] == '-' || s[i] == '~' || s[i] == '0'))
+        i++;
+
+    size_t start = i;
+    while(i < s.size() && s[i] >= '0' && s[i] <= '9')
+        f.width = f.width * 10 + (s[i++] - '0');
+
+    if(i == start || i >= s.size() || s[i] != '.')
+        Rcpp::stop("Invalid format: " + s);
+    i++;
+
+    start = i;
+    while(i < s.size() && s[i] >= '0' && s[i] <= '9')
+        f.digits = f.digits * 10 + (s[i++] - '0');
+
+    if(i == start || i >= s.size() ||
+       (s[i] != 'f' && s[i] != 'e' && s[i] != 'g'))
+    {
+        Rcpp::stop("Invalid format: " + s);
+    }
+    f.kind = s[i++];
+
+    if(i < s.size() && s[i] == 'c')
+    {
+        f.comma = true;
+        i++;
+    }
+
+    if(i != s.size() || f.digits > 17 || f.width > 244)
+        Rcpp::stop("Invalid format: " + s);
+
+    return f;
+}
+
+// Put thousands separators into the integer part of a formatted number
+void
+add_commas(std::string &s)
+{
+    size_t begin = s[0] == '-' ? 1 : 0, end = begin;
+    while(end < s.size() && s[end] >= '0' && s[end] <= '9')
+        end++;
+
+    for(size_t k = end; k > begin + 3; k -= 3)
+        s.insert(k - 3, 1, ',');
+}
+
+// Format one value, appending it to out. Stata has no infinities, so
+// they're missing like NaN, and -0 is written as 0.
+void
+format_value(double v, const DisplayFormat *f, std::string &out)
+{
+    char buf[512];
+    int len;
+
+    if(!std::isfinite(v))
+    {
+        out += '.';
+        return;
+    }
+    if(v == 0)
+        v = 0;
+
+    if(f == NULL)
+    {
+        // Whole numbers directly; anything else with the fewest
+        // significant digits that read back as the same double
+        if(v == std::floor(v) && std::fabs(v) < 9007199254740992.0)
+        {
+            len = snprintf(buf, sizeof(buf), "%.0f", v);
+        } else
+        {
+            for(int prec = 15; ; prec++)
+            {
+                len = snprintf(buf, sizeof(buf), "%.*g", prec, v);
+                if(prec == 17 || strtod(buf, NULL) == v)
+                    break;
+            }
+        }
+
+        out.append(buf, len);
+        return;
+    }
+
+    if(f->kind == 'g' && f->digits == 0)
+    {
+        // As many significant digits as fit in the width
+        for(int prec = 17; ; prec--)
+        {
+            len = snprintf(buf, sizeof(buf), "%.*g", prec, v);
+            if(prec == 1 || len <= f->width)
+                break;
+        }
+    } else
+    {
+        char spec[8] = { '%', '.', '*', f->kind, '\0' };
+        len = snprintf(buf, sizeof(buf), spec, f->digits, v);
+    }
+
+    std::string s(buf, len);
+    if(f->comma)
+        add_commas(s);
+
+    out += s;
+}
+
+} // namespace
+
+// Parse the strings in x as numbers. Every byte in ignore is removed from
+// each cell first, and surrounding whitespace dropped; with percent, "%"
+// signs are removed too and the values divided by 100, and with dpcomma,
+// a comma is the decimal point. Empty cells and missing-value tokens ("."
+// and the like) are missing. Returns a list: values, with NA for cells
+// that aren't numbers, and bad, how many such cells there are.
+// [[Rcpp::export]]
+Rcpp::List
+parse_numbers(Rcpp::CharacterVector x, std::string ignore, bool percent,
+              bool dpcomma)
+{
+    R_xlen_t n = x.size();
+    NumberSyntax syntax(ignore, percent, dpcomma);
+
+    std::vector<const char *> cells(n);
+    std::vector<int> lens(n);
+    for(R_xlen_t i = 0; i < n; i++)
+    {
+        SEXP s = STRING_ELT(x, i);
+
+        cells[i] = s == NA_STRING ? NULL : CHAR(s);
+        lens[i] = s == NA_STRING ? 0 : LENGTH(s);
+    }
+
+    Rcpp::NumericVector values(Rcpp::no_init(n));
+    double *out = REAL(values);
+    double bad = 0;
+
+    int nthreads = ado_threads_for(n, MIN_ROWS_PER_THREAD);
+
+    #pragma omp parallel num_threads(nthreads) reduction(+:bad)
+    {
+        std::string scratch;
+
+        #pragma omp for schedule(static)
+        for(R_xlen_t i = 0; i < n; i++)
+        {
+            NumberSyntax::Cell c = NumberSyntax::CELL_MISSING;
+            if(cells[i] != NULL)
+                c = syntax.parse(cells[i], (size_t) lens[i], scratch, &out[i]);
+
+            if(c != NumberSyntax::CELL_NUMBER)
+                out[i] = NA_REAL;
+            if(c == NumberSyntax::CELL_BAD)
+                bad++;
+        }
+    }
+
+    return Rcpp::List::create(Rcpp::Named("values") = values,
+                              Rcpp::Named("bad") = bad);
+}
+
+// Format the numbers in x as strings: in the Stata display format fmt, or
+// if it's empty, with the fewest digits that read back exactly. Missing
+// values and infinities become ".". Returns a list: strings, and lossy, how many of them
+// don't read back as the value they came from.
+// [[Rcpp::export]]
+Rcpp::List
+format_numbers(Rcpp::NumericVector x, std::string fmt)
+{
+    R_xlen_t n = x.size();
+    const double *xp = REAL(x);
+
+    DisplayFormat f;
+    const DisplayFormat *fp = NULL;
+    if(!fmt.empty())
+    {
+        f = parse_format(fmt);
+        fp = &f;
+    }
+
+    // Each thread formats one contiguous chunk into its own buffer
+    int nthreads = ado_threads_for(n, MIN_ROWS_PER_THREAD);
+    std::vector<std::string> text(nthreads);
+    std::vector<std::vector<size_t> > ends(nthreads);
+    std::vector<R_xlen_t> first(nthreads + 1);
+    for(int t = 0; t <= nthreads; t++)
+        first[t] = n * t / nthreads;
+
+    double lossy = 0;
+
+    #pragma omp parallel for schedule(static, 1) num_threads(nthreads) reduction(+:lossy)
+    for(int t = 0; t < nthreads; t++)
+    {
+        std::string &buf = text[t], plain;
+
+        for(R_xlen_t i = first[t]; i < first[t + 1]; i++)
+        {
+            size_t start = buf.size();
+            format_value(xp[i], fp, buf);
+            ends[t].push_back(buf.size());
+
+            if(!std::isfinite(xp[i]))
+                continue;
+
+            // Commas don't read back, so they're left out of the check
+            const char *p = buf.data() + start;
+            size_t len = buf.size() - start;
+            if(fp != NULL && fp->comma)
+            {
+                plain.assign(p, len);
+                plain.erase(std::remove(plain.begin(), plain.end(), ','), plain.end());
+
+                p = plain.data();
+                len = plain.size();
+            }
+
+            trim_span(p, len);
+
+            double back;
+            if(!parse_double(p, len, &back) || back != xp[i])
+                lossy++;
+        }
+    }
+
+    Rcpp::CharacterVector strings(n);
+    for(int t = 0; t < nthreads; t++)
+    {
+        size_t start = 0;
+        for(R_xlen_t i = first[t]; i < first[t + 1]; i++)
+        {
+            size_t end = ends[t][i - first[t]];
+            SET_STRING_ELT(strings, i, Rf_mkCharLenCE(text[t].data() + start,
+                                                      (int) (end - start), CE_UTF8));
+            start = end;
+        }
+    }
+
+    return Rcpp::List::create(Rcpp::Named("strings") = strings,
+                              Rcpp::Named("lossy") = lossy);
+}
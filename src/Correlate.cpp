@@ -0,0 +1,363 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <Rcpp.h>
+#include "CrossProducts.hpp"
+#include "NumericColumns.hpp"
+#include "Parallel.hpp"
+
+/*
+ * The cross-product engine behind correlate and pwcorr. A first pass finds
+ * each column's (weighted) mean; a second accumulates sums of products of
+ * deviations from those means, from which the covariances and correlations
+ * follow.
+ *
+ * The rows are split into one contiguous range per thread, and each thread
+ * goes through its range CHUNK_ROWS rows at a time: the values it keeps are
+ * centered, weighted and gathered into a small column-major buffer, and
+ * the buffer's cross products are added into the thread's own accumulators
+ * by cross_add() (see CrossProducts.hpp), a register-blocked tile at a
+ * time, so with many columns the work is bound by arithmetic rather than
+ * by memory. The threads' accumulators are summed in order at the end, so
+ * the result doesn't depend on scheduling.
+ *
+ * Which columns each row has values for is kept as a bitmask. Casewise
+ * (listwise) deletion keeps only the rows with every bit set. Pairwise
+ * deletion keeps every row, with indicators of presence gathered alongside
+ * the values, so the count, sums and sums of squares of each pair's common
+ * rows are cross products too; a chunk whose rows are all complete skips
+ * those and just adds its column sums.
+ */
+
+namespace {
+
+// Each thread should get at least this many rows
+const R_xlen_t MIN_ROWS_PER_THREAD = 1 << 14;
+
+// Rows gathered into a buffer at a time
+const size_t CHUNK_ROWS = 256;
+
+// The threads' accumulators together hold at most this many doubles
+const size_t MAX_ACCUMULATED = (size_t) 1 << 24;
+
+// The presence bitmasks of rows [lo, hi), nw words per row
+void
+row_patterns(const std::vector<NumericColumn> &cols, R_xlen_t lo, R_xlen_t hi,
+             size_t nw, std::vector<uint64_t> &pat)
+{
+    pat.assign((size_t) (hi - lo) * nw, 0);
+
+    for(size_t j = 0; j < cols.size(); j++)
+    {
+        uint64_t bit = (uint64_t) 1 << (j % 64);
+        for(R_xlen_t i = lo; i < hi; i++)
+            if(!std::isnan(cols[j].value(i)))
+                pat[(size_t) (i - lo) * nw + j / 64] |= bit;
+    }
+}
+
+// Does the bitmask at pat have all of p bits set?
+inline bool
+complete(const uint64_t *pat, size_t p)
+{
+    for(size_t w = 0; w < p / 64; w++)
+        if(pat[w] != ~(uint64_t) 0)
+            return false;
+
+    return p % 64 == 0 || pat[p / 64] == ((uint64_t) 1 << (p % 64)) - 1;
+}
+
+// One thread's sums. Casewise, cross holds the products of deviations;
+// pairwise, count, sum_w, sum and sum2 are the pair's common rows' count
+// and weight, and column j's sum and sum of squares of deviations over the
+// rows it shares with column k (at j * p + k), and cross their products.
+struct Sums
+{
+    double n, w;
+    std::vector<double> colsum, count, sum_w, sum, sum2, cross;
+};
+
+} // namespace
+
+// The sums of (weighted) products of deviations from the mean of the
+// numeric columns cols, over the rows mask selects (every row if it's
+// NULL), weighted by weights (if not NULL). Casewise, only the rows with
+// every column nonmissing are used; with pairwise, each pair of columns
+// uses the rows where both are nonmissing. Returns a list of p x p
+// matrices: obs and sum_w, the count and total weight of each pair's
+// rows; comoment, the sum of products of deviations of the pair from
+// their means over those rows; and m2, at [j, k], the sum of squared
+// deviations of column j over the rows it shares with k. Also the means
+// of the columns (over their own rows, with pairwise).
+// [[Rcpp::export]]
+Rcpp::List
+cross_products(Rcpp::List cols, SEXP mask, SEXP weights, bool pairwise)
+{
+    size_t p = (size_t) cols.size();
+    R_xlen_t n = p > 0 ? Rf_xlength(cols[0]) : 0;
+
+    std::vector<NumericColumn> cs(p);
+    for(size_t j = 0; j < p; j++)
+        cs[j] = numeric_column(cols[j], n, "A column of the cross products");
+
+    if(!Rf_isNull(mask) && (TYPEOF(mask) != LGLSXP || Rf_xlength(mask) != n))
+        Rcpp::stop("Mask must be a logical vector with one element per row");
+    if(!Rf_isNull(weights) && (TYPEOF(weights) != REALSXP || Rf_xlength(weights) != n))
+        Rcpp::stop("Weights must be a double vector with one element per row");
+
+    const int *mp = Rf_isNull(mask) ? NULL : LOGICAL(mask);
+    const double *wp = Rf_isNull(weights) ? NULL : REAL(weights);
+    size_t nw = (p + 63) / 64, pp = p * p;
+
+    size_t per_thread = pairwise ? 5 * pp : pp;
+    int nthreads = std::min(ado_threads_for(n, MIN_ROWS_PER_THREAD),
+                            (int) std::max(MAX_ACCUMULATED / std::max(per_thread, (size_t) 1),
+                                           (size_t) 1));
+
+    std::vector<Sums> sums(nthreads);
+    for(int t = 0; t < nthreads; t++)
+    {
+        sums[t].n = sums[t].w = 0;
+        sums[t].colsum.assign(2 * p, 0);
+        sums[t].cross.assign(pp, 0);
+        if(pairwise)
+        {
+            sums[t].count.assign(pp, 0);
+            sums[t].sum_w.assign(pp, 0);
+            sums[t].sum.assign(pp, 0);
+            sums[t].sum2.assign(pp, 0);
+        }
+    }
+
+    // First the means: each column's over its own rows with pairwise,
+    // otherwise over the complete rows
+    #pragma omp parallel for schedule(static, 1) num_threads(nthreads)
+    for(int t = 0; t < nthreads; t++)
+    {
+        Sums &s = sums[t];
+        R_xlen_t lo = n * t / nthreads, hi = n * (t + 1) / nthreads;
+        std::vector<uint64_t> pat;
+
+        for(R_xlen_t c = lo; c < hi; c += CHUNK_ROWS)
+        {
+            R_xlen_t end = std::min(c + (R_xlen_t) CHUNK_ROWS, hi);
+            row_patterns(cs, c, end, nw, pat);
+
+            for(R_xlen_t i = c; i < end; i++)
+            {
+                double wt = weight_of(wp, i);
+                const uint64_t *pt = &pat[(size_t) (i - c) * nw];
+                if(!selected(mp, i) || wt <= 0 || (!pairwise && !complete(pt, p)))
+                    continue;
+
+                for(size_t j = 0; j < p; j++)
+                {
+                    if(!(pt[j / 64] >> (j % 64) & 1))
+                        continue;
+
+                    s.colsum[j] += wt * cs[j].value(i);
+                    s.colsum[p + j] += wt;
+                }
+            }
+        }
+    }
+
+    std::vector<double> mean(p, 0), total(p, 0);
+    for(int t = 0; t < nthreads; t++)
+    {
+        for(size_t j = 0; j < p; j++)
+        {
+            mean[j] += sums[t].colsum[j];
+            total[j] += sums[t].colsum[p + j];
+        }
+    }
+    for(size_t j = 0; j < p; j++)
+        mean[j] = total[j] > 0 ? mean[j] / total[j] : 0;
+
+    // Then the cross products. Pairwise, the buffers hold (column-major,
+    // CHUNK_ROWS to a column) for each kept row and column with a value:
+    // pres, 1; wpres, the weight; wdev, the weighted deviation; wdev2, the
+    // weighted squared deviation; and dev, the deviation; all 0 where the
+    // value is missing. Casewise, only dev is needed, scaled by the square
+    // root of the weight.
+    #pragma omp parallel for schedule(static, 1) num_threads(nthreads)
+    for(int t = 0; t < nthreads; t++)
+    {
+        Sums &s = sums[t];
+        R_xlen_t lo = n * t / nthreads, hi = n * (t + 1) / nthreads;
+        size_t ld = CHUNK_ROWS, bufsize = p * ld;
+
+        std::vector<uint64_t> pat;
+        std::vector<R_xlen_t> rows;
+        std::vector<double> wts, dev(bufsize);
+        std::vector<double> pres, wpres, wdev, wdev2;
+        if(pairwise)
+        {
+            pres.resize(bufsize);
+            wpres.resize(bufsize);
+            wdev.resize(bufsize);
+            wdev2.resize(bufsize);
+        }
+
+        for(R_xlen_t c = lo; c < hi; c += CHUNK_ROWS)
+        {
+            R_xlen_t end = std::min(c + (R_xlen_t) CHUNK_ROWS, hi);
+            row_patterns(cs, c, end, nw, pat);
+
+            // The rows to use, and whether they're all complete
+            rows.clear();
+            wts.clear();
+            bool all_complete = true;
+            for(R_xlen_t i = c; i < end; i++)
+            {
+                double wt = weight_of(wp, i);
+                const uint64_t *pt = &pat[(size_t) (i - c) * nw];
+                if(!selected(mp, i) || wt <= 0)
+                    continue;
+
+                bool full = complete(pt, p);
+                if(!pairwise && !full)
+                    continue;
+
+                all_complete = all_complete && full;
+                rows.push_back(i);
+                wts.push_back(wt);
+            }
+
+            size_t nr = rows.size();
+            if(nr == 0)
+                continue;
+
+            s.n += nr;
+            for(size_t r = 0; r < nr; r++)
+                s.w += wts[r];
+
+            if(!pairwise)
+            {
+                for(size_t j = 0; j < p; j++)
+                    for(size_t r = 0; r < nr; r++)
+                        dev[j * ld + r] = std::sqrt(wts[r]) * (cs[j].value(rows[r]) - mean[j]);
+
+                cross_add(&dev[0], p, &dev[0], p, ld, nr, &s.cross[0], true);
+                continue;
+            }
+
+            for(size_t j = 0; j < p; j++)
+            {
+                for(size_t r = 0; r < nr; r++)
+                {
+                    double d = cs[j].value(rows[r]) - mean[j];
+                    bool has = !std::isnan(d);
+                    size_t at = j * ld + r;
+
+                    pres[at] = has ? 1 : 0;
+                    wpres[at] = has ? wts[r] : 0;
+                    dev[at] = has ? d : 0;
+                    wdev[at] = has ? wts[r] * d : 0;
+                    wdev2[at] = has ? wts[r] * d * d : 0;
+                }
+            }
+
+            cross_add(&wdev[0], p, &dev[0], p, ld, nr, &s.cross[0], true);
+
+            if(all_complete)
+            {
+                // Every pair has every row, so the pairs' sums are the
+                // columns'
+                double cw = 0;
+                for(size_t r = 0; r < nr; r++)
+                    cw += wts[r];
+
+                for(size_t j = 0; j < p; j++)
+                {
+                    double sj = 0, s2j = 0;
+                    for(size_t r = 0; r < nr; r++)
+                    {
+                        sj += wdev[j * ld + r];
+                        s2j += wdev2[j * ld + r];
+                    }
+
+                    for(size_t k = 0; k < p; k++)
+                    {
+                        s.count[j * p + k] += nr;
+                        s.sum_w[j * p + k] += cw;
+                        s.sum[j * p + k] += sj;
+                        s.sum2[j * p + k] += s2j;
+                    }
+                }
+            } else
+            {
+                cross_add(&pres[0], p, &pres[0], p, ld, nr, &s.count[0], true);
+                cross_add(&wpres[0], p, &pres[0], p, ld, nr, &s.sum_w[0], true);
+                cross_add(&wdev[0], p, &pres[0], p, ld, nr, &s.sum[0], false);
+                cross_add(&wdev2[0], p, &pres[0], p, ld, nr, &s.sum2[0], false);
+            }
+        }
+    }
+
+    // Sum up the threads' results, in order
+    for(int t = 1; t < nthreads; t++)
+    {
+        sums[0].n += sums[t].n;
+        sums[0].w += sums[t].w;
+        for(size_t k = 0; k < pp; k++)
+            sums[0].cross[k] += sums[t].cross[k];
+
+        if(pairwise)
+        {
+            for(size_t k = 0; k < pp; k++)
+            {
+                sums[0].count[k] += sums[t].count[k];
+                sums[0].sum_w[k] += sums[t].sum_w[k];
+                sums[0].sum[k] += sums[t].sum[k];
+                sums[0].sum2[k] += sums[t].sum2[k];
+            }
+        }
+    }
+
+    Sums &s = sums[0];
+    Rcpp::NumericMatrix obs(p, p), sum_w(p, p), comoment(p, p), m2(p, p);
+    Rcpp::NumericVector means(mean.begin(), mean.end());
+
+    if(pairwise)
+    {
+        symmetrize(&s.cross[0], p);
+        symmetrize(&s.count[0], p);
+        symmetrize(&s.sum_w[0], p);
+    }
+    else
+        symmetrize(&s.cross[0], p);
+
+    // The sums are of deviations from the columns' own means, which
+    // pairwise aren't the means over a pair's rows; correct for that
+    for(size_t j = 0; j < p; j++)
+    {
+        for(size_t k = 0; k < p; k++)
+        {
+            size_t jk = j * p + k, kj = k * p + j;
+
+            if(!pairwise)
+            {
+                obs(j, k) = s.n;
+                sum_w(j, k) = s.w;
+                comoment(j, k) = s.cross[jk];
+                m2(j, k) = s.cross[j * p + j];
+                continue;
+            }
+
+            double W = s.sum_w[jk];
+            obs(j, k) = s.count[jk];
+            sum_w(j, k) = W;
+            comoment(j, k) = W > 0 ? s.cross[jk] - s.sum[jk] * s.sum[kj] / W : 0;
+            m2(j, k) = W > 0 ? s.sum2[jk] - s.sum[jk] * s.sum[jk] / W : 0;
+        }
+    }
+
+    return Rcpp::List::create(Rcpp::Named("obs") = obs,
+                              Rcpp::Named("sum_w") = sum_w,
+                              Rcpp::Named("comoment") = comoment,
+                              Rcpp::Named("m2") = m2,
+                              Rcpp::Named("mean") = means);
+}
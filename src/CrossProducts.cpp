@@ -0,0 +1,105 @@
+#include <algorithm>
+#include <cstddef>
+
+#include "CrossProducts.hpp"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// out[j * ldo + k] += the sum over r < nr of a[j * ld + r] * b[k * ld + r],
+// for the 4 columns j of a and 2 columns k of b starting at those pointers
+inline void
+block_4x2(const double *a, const double *b, size_t ld, size_t nr, double *out,
+          size_t ldo)
+{
+    double s[4][2];
+    size_t r = 0;
+
+#ifdef __SSE2__
+    __m128d acc[4][2];
+    for(int x = 0; x < 4; x++)
+        acc[x][0] = acc[x][1] = _mm_setzero_pd();
+
+    for(; r + 2 <= nr; r += 2)
+    {
+        __m128d b0 = _mm_loadu_pd(b + r), b1 = _mm_loadu_pd(b + ld + r);
+
+        for(int x = 0; x < 4; x++)
+        {
+            __m128d av = _mm_loadu_pd(a + x * ld + r);
+            acc[x][0] = _mm_add_pd(acc[x][0], _mm_mul_pd(av, b0));
+            acc[x][1] = _mm_add_pd(acc[x][1], _mm_mul_pd(av, b1));
+        }
+    }
+
+    for(int x = 0; x < 4; x++)
+    {
+        for(int y = 0; y < 2; y++)
+        {
+            double h[2];
+            _mm_storeu_pd(h, acc[x][y]);
+            s[x][y] = h[0] + h[1];
+        }
+    }
+#else
+    for(int x = 0; x < 4; x++)
+        s[x][0] = s[x][1] = 0;
+#endif
+
+    for(; r < nr; r++)
+    {
+        for(int x = 0; x < 4; x++)
+        {
+            s[x][0] += a[x * ld + r] * b[r];
+            s[x][1] += a[x * ld + r] * b[ld + r];
+        }
+    }
+
+    for(int x = 0; x < 4; x++)
+    {
+        out[x * ldo] += s[x][0];
+        out[x * ldo + 1] += s[x][1];
+    }
+}
+
+} // namespace
+
+void
+cross_add(const double *a, size_t pa, const double *b, size_t pb, size_t ld,
+          size_t nr, double *out, bool upper)
+{
+    for(size_t j = 0; j < pa; j += 4)
+    {
+        for(size_t k = upper ? j - j % 2 : 0; k < pb; k += 2)
+        {
+            if(j + 4 <= pa && k + 2 <= pb)
+            {
+                block_4x2(a + j * ld, b + k * ld, ld, nr, out + j * pb + k, pb);
+                continue;
+            }
+
+            // The ragged edge
+            for(size_t x = j; x < std::min(j + 4, pa); x++)
+            {
+                for(size_t y = k; y < std::min(k + 2, pb); y++)
+                {
+                    double s = 0;
+                    for(size_t r = 0; r < nr; r++)
+                        s += a[x * ld + r] * b[y * ld + r];
+                    out[x * pb + y] += s;
+                }
+            }
+        }
+    }
+}
+
+void
+symmetrize(double *m, size_t p)
+{
+    for(size_t j = 0; j < p; j++)
+        for(size_t k = 0; k < j; k++)
+            m[j * p + k] = m[k * p + j];
+}
@@ -0,0 +1,599 @@
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include <Rcpp.h>
+#include "MappedFile.hpp"
+#include "Parallel.hpp"
+#include "TextParse.hpp"
+
+/*
+ * A native reader for delimited text, used by insheet. The file is mapped
+ * into memory, split into chunks at record boundaries, and the chunks are
+ * parsed in parallel straight into preallocated R vectors. Column types
+ * are inferred from a sample of leading records and widened afterward, for
+ * just the affected columns, if a later value doesn't fit.
+ */
+
+namespace {
+
+enum CsvType
+{
+    CSV_INT = 0,
+    CSV_DOUBLE = 1,
+    CSV_STRING = 2
+};
+
+// A field's location in the mapped file. Quoted fields are stored without
+// their quotes; escaped means the contents still contain doubled quotes.
+struct Span
+{
+    const char *p;
+    uint32_t len;
+    bool escaped;
+};
+
+struct CsvColumn
+{
+    int field;    // position of this column in a record
+    int type;     // a CsvType
+    std::atomic<int> needed; // widest type any value so far has required
+
+    double *dbl;
+    int *itg;
+    std::vector<Span> spans;
+};
+
+const int SAMPLE_RECORDS = 1000;
+
+// Is this record empty, i.e., just a line ending? Blank lines are skipped.
+inline bool
+blank_record(const char *p, const char *end)
+{
+    return *p == '\n' || (*p == '\r' && (p + 1 == end || p[1] == '\n'));
+}
+
+// Advance past one record without storing its fields. Quotes mean the
+// same thing here as in parse_record, so the two always agree on where
+// records end, even with newlines inside quoted fields.
+inline const char *
+skip_record(const char *p, const char *end, char sep)
+{
+    while(true)
+    {
+        if(p < end && *p == '"')
+        {
+            p++;
+            while(true)
+            {
+                p = find_byte(p, end, '"');
+                if(p + 1 < end && p[1] == '"')
+                {
+                    p += 2;
+                    continue;
+                }
+                break;
+            }
+
+            if(p < end)
+                p++;
+        }
+
+        p = find_any2(p, end, sep, '\n');
+        if(p == end)
+            return end;
+
+        if(*p == '\n')
+            return p + 1;
+
+        p++; // the delimiter
+    }
+}
+
+// Split one record into fields. Returns the position just past the record.
+inline const char *
+parse_record(const char *p, const char *end, char sep, std::vector<Span> &fields)
+{
+    fields.clear();
+
+    while(true)
+    {
+        Span sp;
+        sp.escaped = false;
+        bool quoted = (p < end && *p == '"');
+
+        if(quoted)
+        {
+            // quoted field: runs to the next quote that isn't doubled
+            const char *start = ++p;
+            while(true)
+            {
+                p = find_byte(p, end, '"');
+                if(p + 1 < end && p[1] == '"')
+                {
+                    sp.escaped = true;
+                    p += 2;
+                    continue;
+                }
+                break;
+            }
+
+            sp.p = start;
+            sp.len = (uint32_t) (p - start);
+
+            if(p < end)
+                p++; // the closing quote
+
+            // tolerate junk between the closing quote and the delimiter
+            p = find_any2(p, end, sep, '\n');
+        } else
+        {
+            const char *start = p;
+            p = find_any2(p, end, sep, '\n');
+
+            sp.p = start;
+            sp.len = (uint32_t) (p - start);
+        }
+
+        if(p == end || *p == '\n')
+        {
+            // drop the \r of a \r\n line ending
+            if(!quoted && sp.len > 0 && sp.p[sp.len - 1] == '\r')
+                sp.len--;
+
+            fields.push_back(sp);
+            return p == end ? end : p + 1;
+        }
+
+        fields.push_back(sp);
+        p++; // the delimiter
+    }
+}
+
+// The field's contents with doubled quotes collapsed
+std::string
+unescape(const Span &sp)
+{
+    std::string s;
+    s.reserve(sp.len);
+
+    for(uint32_t i = 0; i < sp.len; i++)
+    {
+        s.push_back(sp.p[i]);
+        if(sp.p[i] == '"' && i + 1 < sp.len && sp.p[i + 1] == '"')
+            i++;
+    }
+
+    return s;
+}
+
+// The narrowest type that can hold this value
+inline int
+value_type(const Span &sp)
+{
+    const char *p = sp.p;
+    size_t len = sp.len;
+    trim_span(p, len);
+
+    if(is_missing_token(p, len))
+        return CSV_INT;
+
+    int i;
+    if(parse_int(p, len, &i))
+        return CSV_INT;
+
+    double d;
+    if(parse_double(p, len, &d))
+        return CSV_DOUBLE;
+
+    return CSV_STRING;
+}
+
+inline void
+store_value(CsvColumn &col, const Span &sp, size_t row)
+{
+    if(col.type == CSV_STRING)
+    {
+        col.spans[row] = sp;
+        return;
+    }
+
+    const char *p = sp.p;
+    size_t len = sp.len;
+    trim_span(p, len);
+
+    if(col.type == CSV_INT)
+    {
+        if(is_missing_token(p, len))
+        {
+            col.itg[row] = NA_INTEGER;
+        } else if(!parse_int(p, len, col.itg + row))
+        {
+            int t = value_type(sp);
+            int cur = col.needed.load();
+            while(t > cur && !col.needed.compare_exchange_weak(cur, t))
+                ;
+
+            col.itg[row] = NA_INTEGER;
+        }
+    } else
+    {
+        if(is_missing_token(p, len))
+        {
+            col.dbl[row] = NA_REAL;
+        } else if(!parse_double(p, len, col.dbl + row))
+        {
+            int cur = col.needed.load();
+            while(CSV_STRING > cur && !col.needed.compare_exchange_weak(cur, CSV_STRING))
+                ;
+
+            col.dbl[row] = NA_REAL;
+        }
+    }
+}
+
+// Chunk boundaries, all at the start of a record, such that each chunk is
+// roughly the same size
+std::vector<const char *>
+chunk_bounds(const char *begin, const char *end, char sep, int nchunks)
+{
+    std::vector<const char *> bounds;
+    bounds.push_back(begin);
+
+    size_t size = (size_t) (end - begin);
+    bool has_quotes = (find_byte(begin, end, '"') != end);
+
+    const char *p = begin;
+    for(int i = 1; i < nchunks; i++)
+    {
+        const char *target = begin + size / nchunks * i;
+        if(target <= p)
+            continue;
+
+        if(!has_quotes)
+        {
+            // any newline is a record boundary
+            p = find_byte(target, end, '\n');
+            if(p < end)
+                p++;
+        } else
+        {
+            // quoted fields may contain newlines, so walk the records
+            while(p < target)
+                p = skip_record(p, end, sep);
+        }
+
+        if(p >= end)
+            break;
+
+        bounds.push_back(p);
+    }
+
+    bounds.push_back(end);
+    return bounds;
+}
+
+size_t
+count_records(const char *p, const char *end, char sep)
+{
+    size_t n = 0;
+
+    while(p < end)
+    {
+        if(!blank_record(p, end))
+            n++;
+
+        p = skip_record(p, end, sep);
+    }
+
+    return n;
+}
+
+// Parse every chunk in parallel, storing values for the given columns
+void
+parse_chunks(const std::vector<const char *> &bounds,
+             const std::vector<size_t> &row_offsets, char sep,
+             std::vector<CsvColumn *> &cols)
+{
+    int nchunks = (int) bounds.size() - 1;
+
+    #pragma omp parallel for schedule(dynamic) num_threads(ado_threads_for(nchunks, 1))
+    for(int c = 0; c < nchunks; c++)
+    {
+        std::vector<Span> fields;
+        Span empty = { "", 0, false };
+
+        const char *p = bounds[c];
+        const char *end = bounds[c + 1];
+        size_t row = row_offsets[c];
+
+        while(p < end && row < row_offsets[c + 1])
+        {
+            if(blank_record(p, end))
+            {
+                p = skip_record(p, end, sep);
+                continue;
+            }
+
+            p = parse_record(p, end, sep, fields);
+
+            for(size_t j = 0; j < cols.size(); j++)
+            {
+                CsvColumn &col = *cols[j];
+                const Span &sp = col.field < (int) fields.size() ? fields[col.field] : empty;
+
+                store_value(col, sp, row);
+            }
+
+            row++;
+        }
+    }
+}
+
+struct CsvFile
+{
+    MappedFile file;
+    const char *begin;
+    const char *end;
+
+    CsvFile(std::string path)
+        : file(path)
+    {
+        begin = file.data();
+        end = begin + file.size();
+
+        // skip a UTF-8 byte order mark
+        if(file.size() >= 3 && memcmp(begin, "\xEF\xBB\xBF", 3) == 0)
+            begin += 3;
+    }
+
+    // the first non-blank record
+    const char *first_record(char sep)
+    {
+        const char *p = begin;
+        while(p < end && blank_record(p, end))
+            p = skip_record(p, end, sep);
+
+        return p;
+    }
+};
+
+std::vector<std::string>
+header_names(CsvFile &csv, char sep, bool header, const char **data_start)
+{
+    std::vector<Span> fields;
+    std::vector<std::string> names;
+
+    const char *p = csv.first_record(sep);
+    const char *next = p < csv.end ? parse_record(p, csv.end, sep, fields) : p;
+
+    for(size_t i = 0; i < fields.size(); i++)
+    {
+        if(header)
+        {
+            std::string nm = fields[i].escaped ? unescape(fields[i]) :
+                             std::string(fields[i].p, fields[i].len);
+
+            const char *q = nm.c_str();
+            size_t len = nm.size();
+            trim_span(q, len);
+
+            names.push_back(std::string(q, len));
+        } else
+        {
+            names.push_back("v" + std::to_string(i + 1));
+        }
+    }
+
+    *data_start = header ? next : p;
+    return names;
+}
+
+} // namespace
+
+// The names of the columns in a delimited file: from the header row if
+// header is true, otherwise v1, v2, etc.
+// [[Rcpp::export]]
+Rcpp::CharacterVector
+delimited_header(std::string path, std::string sep, bool header)
+{
+    CsvFile csv(path);
+
+    const char *data_start;
+    std::vector<std::string> names = header_names(csv, sep[0], header, &data_start);
+
+    return Rcpp::wrap(names);
+}
+
+// Guess the delimiter of a file the way Stata does: look for a character
+// that appears the same nonzero number of times in each of the first few
+// lines. Returns "" if there isn't exactly one such candidate.
+// [[Rcpp::export]]
+std::string
+sniff_delimiter(std::string path, int nlines)
+{
+    static const char candidates[] = ",\t;| :";
+    const int ncand = (int) strlen(candidates);
+
+    CsvFile csv(path);
+    std::vector<std::vector<size_t> > counts;
+
+    const char *p = csv.first_record('\n');
+    for(int i = 0; i < nlines && p < csv.end; i++)
+    {
+        const char *eol = find_byte(p, csv.end, '\n');
+
+        std::vector<size_t> cnt;
+        for(int j = 0; j < ncand; j++)
+            cnt.push_back(count_byte(p, eol, candidates[j]));
+        counts.push_back(cnt);
+
+        p = eol < csv.end ? eol + 1 : eol;
+    }
+
+    std::string found;
+    for(int j = 0; j < ncand && counts.size() > 0; j++)
+    {
+        bool same = counts[0][j] > 0;
+        for(size_t i = 1; i < counts.size() && same; i++)
+            same = (counts[i][j] == counts[0][j]);
+
+        if(same)
+        {
+            if(found.size() > 0)
+                return std::string(""); // ambiguous
+
+            found = std::string(1, candidates[j]);
+        }
+    }
+
+    return found;
+}
+
+// Read a delimited file into a named list of columns. Only the columns
+// whose entry in keep is TRUE are parsed and returned; an empty keep
+// vector means all of them.
+// [[Rcpp::export]]
+Rcpp::List
+read_delimited(std::string path, std::string sep, bool header,
+               Rcpp::LogicalVector keep)
+{
+    CsvFile csv(path);
+    char delim = sep[0];
+
+    const char *data;
+    std::vector<std::string> names = header_names(csv, delim, header, &data);
+    int nfields = (int) names.size();
+
+    // Columns we're going to materialize, typed from a sample of records
+    std::vector<CsvColumn> cols(nfields);
+    std::vector<CsvColumn *> active;
+    std::vector<std::string> active_names;
+
+    for(int j = 0; j < nfields; j++)
+    {
+        cols[j].field = j;
+        cols[j].type = CSV_INT;
+        cols[j].needed = CSV_INT;
+        cols[j].dbl = NULL;
+        cols[j].itg = NULL;
+
+        if(keep.size() == 0 || (j < keep.size() && keep[j] == TRUE))
+        {
+            active.push_back(&cols[j]);
+            active_names.push_back(names[j]);
+        }
+    }
+
+    std::vector<Span> fields;
+    const char *p = data;
+    for(int i = 0; i < SAMPLE_RECORDS && p < csv.end; )
+    {
+        if(blank_record(p, csv.end))
+        {
+            p = skip_record(p, csv.end, delim);
+            continue;
+        }
+
+        p = parse_record(p, csv.end, delim, fields);
+        for(size_t j = 0; j < active.size(); j++)
+        {
+            CsvColumn &col = *active[j];
+            if(col.field < (int) fields.size())
+                col.type = std::max(col.type, value_type(fields[col.field]));
+        }
+
+        i++;
+    }
+
+    // Split the data into chunks and find where each one's rows start
+    int nthreads = ado_threads_for(csv.end - data, 1 << 20);
+    std::vector<const char *> bounds = chunk_bounds(data, csv.end, delim, nthreads * 4);
+    int nchunks = (int) bounds.size() - 1;
+
+    std::vector<size_t> row_offsets(nchunks + 1, 0);
+
+    #pragma omp parallel for schedule(dynamic) num_threads(nthreads)
+    for(int c = 0; c < nchunks; c++)
+        row_offsets[c + 1] = count_records(bounds[c], bounds[c + 1], delim);
+
+    for(int c = 0; c < nchunks; c++)
+        row_offsets[c + 1] += row_offsets[c];
+
+    size_t nrow = row_offsets[nchunks];
+
+    // Allocate the output vectors on this thread, then parse into them.
+    // Widening a column re-parses just that column; a column can be
+    // widened at most twice (int to double to string).
+    Rcpp::List out(active.size());
+    std::vector<CsvColumn *> todo = active;
+
+    while(todo.size() > 0)
+    {
+        for(size_t j = 0; j < todo.size(); j++)
+        {
+            CsvColumn &col = *todo[j];
+            col.needed = col.type;
+
+            size_t k = std::find(active.begin(), active.end(), &col) - active.begin();
+            if(col.type == CSV_INT)
+            {
+                Rcpp::IntegerVector v(Rcpp::no_init(nrow));
+                col.itg = v.begin();
+                out[k] = v;
+            } else if(col.type == CSV_DOUBLE)
+            {
+                Rcpp::NumericVector v(Rcpp::no_init(nrow));
+                col.dbl = v.begin();
+                out[k] = v;
+            } else
+            {
+                col.spans.resize(nrow);
+            }
+        }
+
+        parse_chunks(bounds, row_offsets, delim, todo);
+
+        std::vector<CsvColumn *> widen;
+        for(size_t j = 0; j < todo.size(); j++)
+        {
+            if(todo[j]->needed > todo[j]->type)
+            {
+                todo[j]->type = todo[j]->needed;
+                widen.push_back(todo[j]);
+            }
+        }
+
+        todo = widen;
+    }
+
+    // Strings have to be made into CHARSXPs here, on the main thread
+    for(size_t k = 0; k < active.size(); k++)
+    {
+        CsvColumn &col = *active[k];
+        if(col.type != CSV_STRING)
+            continue;
+
+        Rcpp::CharacterVector v(nrow);
+        for(size_t i = 0; i < nrow; i++)
+        {
+            const Span &sp = col.spans[i];
+
+            if(sp.escaped)
+            {
+                std::string s = unescape(sp);
+                SET_STRING_ELT(v, i, Rf_mkCharLenCE(s.data(), (int) s.size(), CE_NATIVE));
+            } else
+            {
+                SET_STRING_ELT(v, i, Rf_mkCharLenCE(sp.p, (int) sp.len, CE_NATIVE));
+            }
+        }
+
+        std::vector<Span>().swap(col.spans);
+        out[k] = v;
+    }
+
+    out.attr("names") = Rcpp::wrap(active_names);
+    return out;
+}
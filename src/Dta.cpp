@@ -0,0 +1,235 @@
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <map>
+
+#include "Dta.hpp"
+
+namespace dta {
+
+namespace {
+
+void
+expect(const char *buf, size_t len, size_t &pos, const char *tag)
+{
+    size_t n = strlen(tag);
+
+    if(pos + n > len || memcmp(buf + pos, tag, n) != 0)
+        throw std::runtime_error(std::string("Malformed .dta file: expected ") + tag);
+
+    pos += n;
+}
+
+void
+require(size_t len, size_t pos, size_t n)
+{
+    if(pos + n > len)
+        throw std::runtime_error("Malformed .dta file: unexpected end of file");
+}
+
+// A NUL-terminated string in a fixed-width field
+std::string
+fixed_string(const char *p, size_t width)
+{
+    return std::string(p, str_length(p, width));
+}
+
+} // namespace
+
+int
+Meta::var_index(const std::string &name) const
+{
+    for(size_t i = 0; i < varnames.size(); i++)
+        if(varnames[i] == name)
+            return (int) i;
+
+    return -1;
+}
+
+void
+parse_meta(const char *buf, size_t len, Meta &m)
+{
+    size_t pos = 0;
+
+    expect(buf, len, pos, "<stata_dta><header><release>");
+    require(len, pos, 3);
+
+    m.release = (int) std::strtol(std::string(buf + pos, 3).c_str(), NULL, 10);
+    if(m.release != 117 && m.release != 118 && m.release != 119)
+        throw std::runtime_error("Unsupported .dta release");
+    pos += 3;
+
+    expect(buf, len, pos, "</release><byteorder>");
+    require(len, pos, 3);
+
+    bool lsf = (memcmp(buf + pos, "LSF", 3) == 0);
+    if(!lsf && memcmp(buf + pos, "MSF", 3) != 0)
+        throw std::runtime_error("Malformed .dta file: bad byte order");
+    m.swap = (lsf != host_is_lsf());
+    pos += 3;
+
+    expect(buf, len, pos, "</byteorder><K>");
+    if(m.release == 119)
+    {
+        require(len, pos, 4);
+        m.nvar = load<uint32_t>(buf + pos, m.swap);
+        pos += 4;
+    } else
+    {
+        require(len, pos, 2);
+        m.nvar = load<uint16_t>(buf + pos, m.swap);
+        pos += 2;
+    }
+
+    expect(buf, len, pos, "</K><N>");
+    if(m.release == 117)
+    {
+        require(len, pos, 4);
+        m.nobs = load<uint32_t>(buf + pos, m.swap);
+        pos += 4;
+    } else
+    {
+        require(len, pos, 8);
+        m.nobs = (int64_t) load<uint64_t>(buf + pos, m.swap);
+        pos += 8;
+    }
+
+    expect(buf, len, pos, "</N><label>");
+    size_t lbllen;
+    if(m.release == 117)
+    {
+        require(len, pos, 1);
+        lbllen = (unsigned char) buf[pos];
+        pos += 1;
+    } else
+    {
+        require(len, pos, 2);
+        lbllen = load<uint16_t>(buf + pos, m.swap);
+        pos += 2;
+    }
+    require(len, pos, lbllen);
+    m.label = std::string(buf + pos, lbllen);
+    pos += lbllen;
+
+    expect(buf, len, pos, "</label><timestamp>");
+    require(len, pos, 1);
+    size_t tslen = (unsigned char) buf[pos];
+    pos += 1;
+    require(len, pos, tslen);
+    m.timestamp = std::string(buf + pos, tslen);
+    pos += tslen;
+
+    expect(buf, len, pos, "</timestamp></header><map>");
+    require(len, pos, 8 * MAP_SIZE);
+    for(int i = 0; i < MAP_SIZE; i++)
+        m.map[i] = load<uint64_t>(buf + pos + 8 * i, m.swap);
+
+    size_t K = (size_t) m.nvar;
+
+    // variable types
+    pos = m.map[MAP_VARIABLE_TYPES];
+    expect(buf, len, pos, "<variable_types>");
+    require(len, pos, 2 * K);
+
+    m.types.resize(K);
+    m.offsets.resize(K);
+    m.rowwidth = 0;
+    for(size_t i = 0; i < K; i++)
+    {
+        m.types[i] = load<uint16_t>(buf + pos + 2 * i, m.swap);
+
+        size_t w = type_width(m.types[i]);
+        if(w == 0)
+            throw std::runtime_error("Malformed .dta file: bad variable type");
+
+        m.offsets[i] = m.rowwidth;
+        m.rowwidth += w;
+    }
+
+    // the fixed-width string fields
+    struct { int section; const char *tag; size_t width; std::vector<std::string> *out; }
+    fields[] = {
+        { MAP_VARNAMES, "<varnames>", name_width(m.release), &m.varnames },
+        { MAP_FORMATS, "<formats>", format_width(m.release), &m.formats },
+        { MAP_VALUE_LABEL_NAMES, "<value_label_names>", name_width(m.release), &m.lblnames },
+        { MAP_VARIABLE_LABELS, "<variable_labels>", varlabel_width(m.release), &m.varlabels }
+    };
+
+    for(size_t f = 0; f < sizeof(fields) / sizeof(fields[0]); f++)
+    {
+        pos = m.map[fields[f].section];
+        expect(buf, len, pos, fields[f].tag);
+        require(len, pos, K * fields[f].width);
+
+        fields[f].out->resize(K);
+        for(size_t i = 0; i < K; i++)
+            (*fields[f].out)[i] = fixed_string(buf + pos + i * fields[f].width,
+                                               fields[f].width);
+    }
+
+    pos = m.map[MAP_DATA];
+    expect(buf, len, pos, "<data>");
+    m.data_start = pos;
+
+    if(m.map[MAP_STRLS] < m.data_start ||
+       m.map[MAP_STRLS] - m.data_start < (uint64_t) m.nobs * m.rowwidth)
+        throw std::runtime_error("Malformed .dta file: truncated data section");
+}
+
+std::map<std::string, ValueLabels>
+parse_value_labels(const char *buf, size_t len, const Meta &m)
+{
+    std::map<std::string, ValueLabels> ret;
+
+    size_t pos = m.map[MAP_VALUE_LABELS];
+    expect(buf, len, pos, "<value_labels>");
+
+    size_t nw = name_width(m.release);
+    while(pos + 5 <= len && memcmp(buf + pos, "<lbl>", 5) == 0)
+    {
+        pos += 5;
+
+        require(len, pos, 4 + nw + 3);
+        size_t tablen = load<uint32_t>(buf + pos, m.swap);
+        std::string name = fixed_string(buf + pos + 4, nw);
+        pos += 4 + nw + 3;
+
+        require(len, pos, tablen);
+        const char *t = buf + pos;
+
+        if(tablen >= 8)
+        {
+            size_t n = load<uint32_t>(t, m.swap);
+            size_t txtlen = load<uint32_t>(t + 4, m.swap);
+
+            if(8 + 8 * n + txtlen <= tablen)
+            {
+                const char *offs = t + 8;
+                const char *vals = offs + 4 * n;
+                const char *txt = vals + 4 * n;
+
+                ValueLabels &vl = ret[name];
+                vl.values.resize(n);
+                vl.labels.resize(n);
+
+                for(size_t i = 0; i < n; i++)
+                {
+                    size_t off = load<uint32_t>(offs + 4 * i, m.swap);
+                    vl.values[i] = (int32_t) load<uint32_t>(vals + 4 * i, m.swap);
+
+                    if(off < txtlen)
+                        vl.labels[i] = fixed_string(txt + off, txtlen - off);
+                }
+            }
+        }
+
+        pos += tablen;
+        expect(buf, len, pos, "</lbl>");
+    }
+
+    return ret;
+}
+
+} // namespace dta
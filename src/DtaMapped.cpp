@@ -0,0 +1,475 @@
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <Rcpp.h>
+#include <Rversion.h>
+
+#if R_VERSION >= R_Version(3, 5, 0)
+#define ADO_HAVE_ALTREP 1
+
+#if R_VERSION < R_Version(3, 6, 0)
+// R 3.5's Altrep.h uses "class" as an identifier and lacks C linkage
+#define class klass
+extern "C" {
+#include <R_ext/Altrep.h>
+}
+#undef class
+#else
+#include <R_ext/Altrep.h>
+#endif
+#endif
+
+#include "Dta.hpp"
+#include "DtaReader.hpp"
+#include "MappedFile.hpp"
+#include "Parallel.hpp"
+
+/*
+ * Columns of a .dta file exposed to R as ALTREP vectors over a mapping of
+ * the file, for datasets too big to load. Nothing is decoded until it's
+ * asked for: single elements and regions (which is how printing, length()
+ * and x[i] get at them) are decoded from the mapped rows on demand, so the
+ * OS faults in only the pages those rows live on. Anything that needs a
+ * pointer to the data, which includes every write, makes the column an
+ * ordinary owned vector first and the ALTREP object forwards to that from
+ * then on.
+ *
+ * The file must not be changed or truncated while it's mapped.
+ */
+
+#ifdef ADO_HAVE_ALTREP
+
+namespace {
+
+R_altrep_class_t dta_integer_class;
+R_altrep_class_t dta_real_class;
+R_altrep_class_t dta_string_class;
+
+// An open file, shared by all the columns mapped from it
+struct DtaMapping
+{
+    MappedFile file;
+    dta::Meta meta;
+    cetype_t enc;
+
+    bool strls_indexed;
+    std::unordered_map<uint64_t, dta::Gso> strls;
+
+    DtaMapping(const std::string &path)
+        : file(path), strls_indexed(false)
+    {
+        dta::parse_meta(file.data(), file.size(), meta);
+        enc = meta.release >= 118 ? CE_UTF8 : CE_NATIVE;
+    }
+
+    const char *
+    cell(size_t row, size_t offset) const
+    {
+        return file.data() + meta.data_start + row * meta.rowwidth + offset;
+    }
+
+    // strLs are located by scanning the <strls> section, which we only
+    // do the first time a strL column is read
+    const dta::Gso *
+    strl(uint64_t key)
+    {
+        if(!strls_indexed)
+        {
+            dta::for_each_gso(file.data(), file.size(), meta,
+                              [this](uint64_t k, const dta::Gso &g) { strls[k] = g; });
+            strls_indexed = true;
+        }
+
+        std::unordered_map<uint64_t, dta::Gso>::const_iterator it = strls.find(key);
+        return it == strls.end() ? NULL : &it->second;
+    }
+};
+
+// One variable over a window of rows, held in the ALTREP object's data1
+struct DtaColumn
+{
+    std::shared_ptr<DtaMapping> map;
+    std::string name;
+    int type;
+    size_t offset;
+    size_t lo;
+    size_t n;
+};
+
+DtaColumn *
+column(SEXP x)
+{
+    return (DtaColumn *) R_ExternalPtrAddr(R_altrep_data1(x));
+}
+
+// The owned copy of the column, or NULL if it hasn't been made
+SEXP
+owned(SEXP x)
+{
+    SEXP d = R_altrep_data2(x);
+    return d == R_NilValue ? NULL : d;
+}
+
+inline int
+column_int(const DtaColumn *c, size_t i)
+{
+    int32_t v;
+    return dta::decode_integer(c->map->cell(c->lo + i, c->offset), c->type,
+                               c->map->meta.swap, &v) ? v : NA_INTEGER;
+}
+
+inline double
+column_real(const DtaColumn *c, size_t i)
+{
+    double v;
+    return dta::decode_double(c->map->cell(c->lo + i, c->offset), c->type,
+                              c->map->meta.swap, &v) ? v : NA_REAL;
+}
+
+SEXP
+column_string(const DtaColumn *c, size_t i)
+{
+    const char *p = c->map->cell(c->lo + i, c->offset);
+
+    if(c->type == dta::STRL)
+    {
+        const dta::Gso *g = c->map->strl(dta::decode_strl_ref(p, c->map->meta.release,
+                                                              c->map->meta.swap));
+        if(g == NULL)
+            return R_BlankString;
+
+        // R strings can't hold NULs, so binary strLs are truncated
+        size_t len = g->binary ? dta::str_length(g->p, g->len) : g->len;
+        return Rf_mkCharLenCE(g->p, (int) len, c->map->enc);
+    }
+
+    return Rf_mkCharLenCE(p, (int) dta::str_length(p, c->type), c->map->enc);
+}
+
+void
+finalize_column(SEXP ptr)
+{
+    delete (DtaColumn *) R_ExternalPtrAddr(ptr);
+    R_ClearExternalPtr(ptr);
+}
+
+SEXP
+make_column(std::shared_ptr<DtaMapping> map, int var, size_t lo, size_t n)
+{
+    DtaColumn *c = new DtaColumn;
+    c->map = map;
+    c->name = map->meta.varnames[var];
+    c->type = map->meta.types[var];
+    c->offset = map->meta.offsets[var];
+    c->lo = lo;
+    c->n = n;
+
+    SEXP ptr = PROTECT(R_MakeExternalPtr(c, R_NilValue, R_NilValue));
+    R_RegisterCFinalizerEx(ptr, finalize_column, TRUE);
+
+    R_altrep_class_t cls = dta::is_string_type(c->type) ? dta_string_class :
+                           dta::is_integer_type(c->type) ? dta_integer_class :
+                                                           dta_real_class;
+
+    SEXP ret = R_new_altrep(cls, ptr, R_NilValue);
+    UNPROTECT(1);
+
+    return ret;
+}
+
+// Promote a column to an ordinary vector, decoding all of it
+SEXP
+materialize(SEXP x)
+{
+    SEXP d = owned(x);
+    if(d != NULL)
+        return d;
+
+    const DtaColumn *c = column(x);
+    R_xlen_t n = (R_xlen_t) c->n;
+    int nthreads = ado_threads_for(c->n, 1 << 16);
+
+    d = PROTECT(Rf_allocVector(TYPEOF(x), n));
+    if(TYPEOF(x) == INTSXP)
+    {
+        int *out = INTEGER(d);
+
+        #pragma omp parallel for num_threads(nthreads)
+        for(R_xlen_t i = 0; i < n; i++)
+            out[i] = column_int(c, i);
+    } else if(TYPEOF(x) == REALSXP)
+    {
+        double *out = REAL(d);
+
+        #pragma omp parallel for num_threads(nthreads)
+        for(R_xlen_t i = 0; i < n; i++)
+            out[i] = column_real(c, i);
+    } else
+    {
+        for(R_xlen_t i = 0; i < n; i++)
+            SET_STRING_ELT(d, i, column_string(c, i));
+    }
+
+    R_set_altrep_data2(x, d);
+    UNPROTECT(1);
+
+    return d;
+}
+
+/*
+ * Methods common to all three classes
+ */
+
+R_xlen_t
+column_length(SEXP x)
+{
+    SEXP d = owned(x);
+    return d != NULL ? XLENGTH(d) : (R_xlen_t) column(x)->n;
+}
+
+Rboolean
+column_inspect(SEXP x, int, int, int, void (*)(SEXP, int, int, int))
+{
+    const DtaColumn *c = column(x);
+    Rprintf("mapped .dta column %s (%s)\n", c->name.c_str(),
+            owned(x) != NULL ? "materialized" : "lazy");
+    return TRUE;
+}
+
+// A copy shares the mapping, but gets its own owned vector when needed
+SEXP
+column_duplicate(SEXP x, Rboolean)
+{
+    SEXP d = owned(x);
+    if(d != NULL)
+        return Rf_duplicate(d);
+
+    const DtaColumn *c = column(x);
+
+    DtaColumn *copy = new DtaColumn(*c);
+    SEXP ptr = PROTECT(R_MakeExternalPtr(copy, R_NilValue, R_NilValue));
+    R_RegisterCFinalizerEx(ptr, finalize_column, TRUE);
+
+    R_altrep_class_t cls = TYPEOF(x) == STRSXP ? dta_string_class :
+                           TYPEOF(x) == INTSXP ? dta_integer_class :
+                                                 dta_real_class;
+
+    SEXP ret = R_new_altrep(cls, ptr, R_NilValue);
+    UNPROTECT(1);
+
+    return ret;
+}
+
+void *
+column_dataptr(SEXP x, Rboolean)
+{
+    return DATAPTR(materialize(x));
+}
+
+const void *
+column_dataptr_or_null(SEXP x)
+{
+    SEXP d = owned(x);
+    return d != NULL ? DATAPTR(d) : NULL;
+}
+
+// x[indx] decodes just the rows asked for
+SEXP
+column_extract_subset(SEXP x, SEXP indx, SEXP)
+{
+    if(owned(x) != NULL || (TYPEOF(indx) != INTSXP && TYPEOF(indx) != REALSXP))
+        return NULL; // R's default handles it
+
+    const DtaColumn *c = column(x);
+    R_xlen_t n = XLENGTH(indx);
+
+    SEXP ret = PROTECT(Rf_allocVector(TYPEOF(x), n));
+    for(R_xlen_t k = 0; k < n; k++)
+    {
+        double i = TYPEOF(indx) == INTSXP ?
+                   (INTEGER(indx)[k] == NA_INTEGER ? -1 : INTEGER(indx)[k] - 1) :
+                   (ISNAN(REAL(indx)[k]) ? -1 : REAL(indx)[k] - 1);
+        bool ok = i >= 0 && i < (double) c->n;
+
+        if(TYPEOF(x) == INTSXP)
+            INTEGER(ret)[k] = ok ? column_int(c, (size_t) i) : NA_INTEGER;
+        else if(TYPEOF(x) == REALSXP)
+            REAL(ret)[k] = ok ? column_real(c, (size_t) i) : NA_REAL;
+        else
+            SET_STRING_ELT(ret, k, ok ? column_string(c, (size_t) i) : NA_STRING);
+    }
+
+    UNPROTECT(1);
+    return ret;
+}
+
+/*
+ * Type-specific methods
+ */
+
+int
+integer_elt(SEXP x, R_xlen_t i)
+{
+    SEXP d = owned(x);
+    return d != NULL ? INTEGER(d)[i] : column_int(column(x), i);
+}
+
+R_xlen_t
+integer_get_region(SEXP x, R_xlen_t start, R_xlen_t size, int *buf)
+{
+    SEXP d = owned(x);
+    R_xlen_t n = std::min(size, column_length(x) - start);
+
+    for(R_xlen_t k = 0; k < n; k++)
+        buf[k] = d != NULL ? INTEGER(d)[start + k] : column_int(column(x), start + k);
+
+    return n;
+}
+
+double
+real_elt(SEXP x, R_xlen_t i)
+{
+    SEXP d = owned(x);
+    return d != NULL ? REAL(d)[i] : column_real(column(x), i);
+}
+
+R_xlen_t
+real_get_region(SEXP x, R_xlen_t start, R_xlen_t size, double *buf)
+{
+    SEXP d = owned(x);
+    R_xlen_t n = std::min(size, column_length(x) - start);
+
+    for(R_xlen_t k = 0; k < n; k++)
+        buf[k] = d != NULL ? REAL(d)[start + k] : column_real(column(x), start + k);
+
+    return n;
+}
+
+SEXP
+string_elt(SEXP x, R_xlen_t i)
+{
+    SEXP d = owned(x);
+    return d != NULL ? STRING_ELT(d, i) : column_string(column(x), i);
+}
+
+void
+string_set_elt(SEXP x, R_xlen_t i, SEXP v)
+{
+    SET_STRING_ELT(materialize(x), i, v);
+}
+
+void
+set_common_methods(R_altrep_class_t cls)
+{
+    R_set_altrep_Length_method(cls, column_length);
+    R_set_altrep_Inspect_method(cls, column_inspect);
+    R_set_altrep_Duplicate_method(cls, column_duplicate);
+    R_set_altvec_Dataptr_method(cls, column_dataptr);
+    R_set_altvec_Dataptr_or_null_method(cls, column_dataptr_or_null);
+    R_set_altvec_Extract_subset_method(cls, column_extract_subset);
+}
+
+} // namespace
+
+#endif /* ADO_HAVE_ALTREP */
+
+// Register the ALTREP classes when the package is loaded
+// [[Rcpp::init]]
+void
+init_dta_mapped(DllInfo *dll)
+{
+#ifdef ADO_HAVE_ALTREP
+    dta_integer_class = R_make_altinteger_class("dta_integer", "ado", dll);
+    set_common_methods(dta_integer_class);
+    R_set_altinteger_Elt_method(dta_integer_class, integer_elt);
+    R_set_altinteger_Get_region_method(dta_integer_class, integer_get_region);
+
+    dta_real_class = R_make_altreal_class("dta_real", "ado", dll);
+    set_common_methods(dta_real_class);
+    R_set_altreal_Elt_method(dta_real_class, real_elt);
+    R_set_altreal_Get_region_method(dta_real_class, real_get_region);
+
+    dta_string_class = R_make_altstring_class("dta_string", "ado", dll);
+    set_common_methods(dta_string_class);
+    R_set_altstring_Elt_method(dta_string_class, string_elt);
+    R_set_altstring_Set_elt_method(dta_string_class, string_set_elt);
+#else
+    (void) dll;
+#endif
+}
+
+// Map rows first through last (1-based, inclusive) of the variables in
+// select (all of them if it's empty) from a .dta file without reading
+// them. Returns list(data=, attrs=) like read_dta, except that labeled
+// variables are left as integers: making factors would mean reading them.
+// [[Rcpp::export]]
+Rcpp::List
+map_dta(std::string path, Rcpp::CharacterVector select, double first,
+        double last)
+{
+#ifdef ADO_HAVE_ALTREP
+    std::shared_ptr<DtaMapping> map = std::make_shared<DtaMapping>(path);
+    const dta::Meta &m = map->meta;
+
+    std::vector<int> vars;
+    if(select.size() == 0)
+    {
+        for(int j = 0; j < (int) m.nvar; j++)
+            vars.push_back(j);
+    } else
+    {
+        for(R_xlen_t j = 0; j < select.size(); j++)
+        {
+            int idx = m.var_index(Rcpp::as<std::string>(select[j]));
+            if(idx < 0)
+                throw std::runtime_error("Variable not found: " +
+                                         Rcpp::as<std::string>(select[j]));
+            vars.push_back(idx);
+        }
+    }
+
+    size_t lo = (size_t) std::max(first, 1.0) - 1;
+    size_t hi = (size_t) std::max(std::min(last, (double) m.nobs), 0.0);
+    size_t n = hi > lo ? hi - lo : 0;
+
+    Rcpp::List data(vars.size());
+    std::vector<std::string> names;
+    for(size_t j = 0; j < vars.size(); j++)
+    {
+        data[j] = make_column(map, vars[j], lo, n);
+        names.push_back(m.varnames[vars[j]]);
+    }
+    data.attr("names") = Rcpp::wrap(names);
+
+    std::map<std::string, dta::ValueLabels> vls =
+        dta::parse_value_labels(map->file.data(), map->file.size(), m);
+
+    return Rcpp::List::create(Rcpp::Named("data") = data,
+                              Rcpp::Named("attrs") = dta_attributes(m, vars, vls));
+#else
+    (void) path; (void) select; (void) first; (void) last;
+    throw std::runtime_error("Mapped datasets require R 3.5.0 or later");
+#endif
+}
+
+// Whether x is a mapped .dta column, and if so whether it's been read into
+// an owned vector: "lazy", "materialized", or "" for any other vector
+// [[Rcpp::export]]
+std::string
+mapped_state(SEXP x)
+{
+#ifdef ADO_HAVE_ALTREP
+    if(!ALTREP(x) || !(R_altrep_inherits(x, dta_integer_class) ||
+                       R_altrep_inherits(x, dta_real_class) ||
+                       R_altrep_inherits(x, dta_string_class)))
+        return "";
+
+    return owned(x) != NULL ? "materialized" : "lazy";
+#else
+    (void) x;
+    return "";
+#endif
+}
@@ -0,0 +1,451 @@
+#include <algorithm>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <Rcpp.h>
+#include "Dta.hpp"
+#include "DtaReader.hpp"
+#include "MappedFile.hpp"
+#include "Parallel.hpp"
+
+/*
+ * A native reader for .dta files in formats 117 through 119, used by the
+ * use command. It maps the file, decodes only the selected variables, and
+ * looks only at the rows in the requested range; simple comparisons of a
+ * numeric variable with a constant are evaluated against the raw rows, so
+ * that rows failing them are never decoded. Values go straight into the
+ * final R vectors.
+ */
+
+namespace {
+
+enum FilterOp
+{
+    OP_LT,
+    OP_LE,
+    OP_GT,
+    OP_GE,
+    OP_EQ,
+    OP_NE
+};
+
+struct Filter
+{
+    size_t offset;
+    int type;
+    FilterOp op;
+    double value;
+};
+
+// A selected variable and where its decoded values go
+struct OutColumn
+{
+    int var;
+    int type;
+    size_t offset;
+
+    int *itg;
+    double *dbl;
+    std::vector<const char *> strs;   // str#: start of each value
+    std::vector<uint64_t> strls;      // strL: (v, o) key of each value
+};
+
+FilterOp
+parse_op(const std::string &op)
+{
+    if(op == "<") return OP_LT;
+    if(op == "<=") return OP_LE;
+    if(op == ">") return OP_GT;
+    if(op == ">=") return OP_GE;
+    if(op == "==") return OP_EQ;
+    if(op == "!=") return OP_NE;
+
+    throw std::runtime_error("Bad comparison operator: " + op);
+}
+
+// Does a row satisfy all the filters? Missing values satisfy none of them,
+// as with comparisons against NA in the interpreter.
+inline bool
+row_passes(const char *row, const std::vector<Filter> &filters, bool swap)
+{
+    for(size_t f = 0; f < filters.size(); f++)
+    {
+        const Filter &flt = filters[f];
+
+        double x;
+        if(!dta::decode_double(row + flt.offset, flt.type, swap, &x))
+            return false;
+
+        bool ok;
+        switch(flt.op)
+        {
+            case OP_LT: ok = x < flt.value; break;
+            case OP_LE: ok = x <= flt.value; break;
+            case OP_GT: ok = x > flt.value; break;
+            case OP_GE: ok = x >= flt.value; break;
+            case OP_EQ: ok = x == flt.value; break;
+            default:    ok = x != flt.value; break;
+        }
+
+        if(!ok)
+            return false;
+    }
+
+    return true;
+}
+
+inline void
+decode_into(OutColumn &col, const char *row, size_t i, const dta::Meta &m)
+{
+    const char *p = row + col.offset;
+
+    if(dta::is_integer_type(col.type))
+    {
+        int32_t v;
+        col.itg[i] = dta::decode_integer(p, col.type, m.swap, &v) ? v : NA_INTEGER;
+    } else if(col.type == dta::DOUBLE || col.type == dta::FLOAT)
+    {
+        double v;
+        col.dbl[i] = dta::decode_double(p, col.type, m.swap, &v) ? v : NA_REAL;
+    } else if(col.type == dta::STRL)
+    {
+        col.strls[i] = dta::decode_strl_ref(p, m.release, m.swap);
+    } else
+    {
+        col.strs[i] = p;
+    }
+}
+
+// Turn a labeled integer column into a factor if every non-missing value
+// has a label and the labels are distinct; returns false otherwise.
+bool
+make_factor(Rcpp::IntegerVector &v, const dta::ValueLabels &vl)
+{
+    std::vector<std::pair<int32_t, std::string> > lbl;
+    for(size_t i = 0; i < vl.values.size(); i++)
+        lbl.push_back(std::make_pair(vl.values[i], vl.labels[i]));
+    std::sort(lbl.begin(), lbl.end());
+
+    std::vector<std::string> seen;
+    for(size_t i = 0; i < lbl.size(); i++)
+        seen.push_back(lbl[i].second);
+    std::sort(seen.begin(), seen.end());
+    if(std::adjacent_find(seen.begin(), seen.end()) != seen.end())
+        return false;
+
+    std::vector<int32_t> keys;
+    for(size_t i = 0; i < lbl.size(); i++)
+        keys.push_back(lbl[i].first);
+
+    R_xlen_t n = v.size();
+    std::vector<int> codes(n);
+    for(R_xlen_t i = 0; i < n; i++)
+    {
+        if(v[i] == NA_INTEGER)
+        {
+            codes[i] = NA_INTEGER;
+            continue;
+        }
+
+        std::vector<int32_t>::iterator it = std::lower_bound(keys.begin(), keys.end(), v[i]);
+        if(it == keys.end() || *it != v[i])
+            return false;
+
+        codes[i] = (int) (it - keys.begin()) + 1;
+    }
+
+    std::copy(codes.begin(), codes.end(), v.begin());
+
+    Rcpp::CharacterVector levels(lbl.size());
+    for(size_t i = 0; i < lbl.size(); i++)
+        levels[i] = lbl[i].second;
+
+    v.attr("levels") = levels;
+    v.attr("class") = "factor";
+
+    return true;
+}
+
+} // namespace
+
+// The attributes read.dta13 would set on a data.frame of the variables in
+// vars, so that both readers leave the same information behind
+Rcpp::List
+dta_attributes(const dta::Meta &m, const std::vector<int> &vars,
+               const std::map<std::string, dta::ValueLabels> &vls)
+{
+    std::vector<std::string> formats, lblnames, varlabels;
+    std::vector<int> types;
+    for(size_t j = 0; j < vars.size(); j++)
+    {
+        formats.push_back(m.formats[vars[j]]);
+        types.push_back(m.types[vars[j]]);
+        lblnames.push_back(m.lblnames[vars[j]]);
+        varlabels.push_back(m.varlabels[vars[j]]);
+    }
+
+    Rcpp::List table(vls.size());
+    std::vector<std::string> tnames;
+
+    size_t k = 0;
+    for(std::map<std::string, dta::ValueLabels>::const_iterator it = vls.begin();
+        it != vls.end(); ++it, ++k)
+    {
+        Rcpp::IntegerVector v(it->second.values.begin(), it->second.values.end());
+        v.attr("names") = Rcpp::wrap(it->second.labels);
+
+        table[k] = v;
+        tnames.push_back(it->first);
+    }
+    table.attr("names") = Rcpp::wrap(tnames);
+
+    return Rcpp::List::create(
+        Rcpp::Named("datalabel") = m.label,
+        Rcpp::Named("time.stamp") = m.timestamp,
+        Rcpp::Named("formats") = Rcpp::wrap(formats),
+        Rcpp::Named("types") = Rcpp::wrap(types),
+        Rcpp::Named("val.labels") = Rcpp::wrap(lblnames),
+        Rcpp::Named("var.labels") = Rcpp::wrap(varlabels),
+        Rcpp::Named("version") = m.release,
+        Rcpp::Named("label.table") = table,
+        Rcpp::Named("byteorder") = (m.swap == dta::host_is_lsf()) ? "MSF" : "LSF",
+        Rcpp::Named("orig.dim") = Rcpp::NumericVector::create((double) m.nobs,
+                                                               (double) m.nvar));
+}
+
+// The release, number of observations and variable names and types of a
+// .dta file, read from its header without touching the data
+// [[Rcpp::export]]
+Rcpp::List
+dta_info(std::string path)
+{
+    MappedFile f(path);
+
+    dta::Meta m;
+    dta::parse_meta(f.data(), f.size(), m);
+
+    return Rcpp::List::create(Rcpp::Named("release") = m.release,
+                              Rcpp::Named("nobs") = (double) m.nobs,
+                              Rcpp::Named("names") = Rcpp::wrap(m.varnames),
+                              Rcpp::Named("types") = Rcpp::wrap(m.types));
+}
+
+// Read rows first through last (1-based, inclusive) of the variables in
+// select (all of them if it's empty) from a .dta file, keeping only rows
+// where filter_vars[k] filter_ops[k] filter_values[k] holds for all k.
+// Returns list(data=, attrs=), with attrs like those read.dta13 sets.
+// [[Rcpp::export]]
+Rcpp::List
+read_dta(std::string path, Rcpp::CharacterVector select, double first,
+         double last, Rcpp::CharacterVector filter_vars,
+         Rcpp::CharacterVector filter_ops, Rcpp::NumericVector filter_values,
+         bool convert_factors)
+{
+    MappedFile f(path);
+
+    dta::Meta m;
+    dta::parse_meta(f.data(), f.size(), m);
+
+    // Which variables, in what order
+    std::vector<int> vars;
+    if(select.size() == 0)
+    {
+        for(int j = 0; j < (int) m.nvar; j++)
+            vars.push_back(j);
+    } else
+    {
+        for(R_xlen_t j = 0; j < select.size(); j++)
+        {
+            int idx = m.var_index(Rcpp::as<std::string>(select[j]));
+            if(idx < 0)
+                throw std::runtime_error("Variable not found: " +
+                                         Rcpp::as<std::string>(select[j]));
+            vars.push_back(idx);
+        }
+    }
+
+    std::vector<Filter> filters;
+    for(R_xlen_t k = 0; k < filter_vars.size(); k++)
+    {
+        int idx = m.var_index(Rcpp::as<std::string>(filter_vars[k]));
+        if(idx < 0 || dta::is_string_type(m.types[idx]))
+            throw std::runtime_error("Bad filter variable");
+
+        Filter flt;
+        flt.offset = m.offsets[idx];
+        flt.type = m.types[idx];
+        flt.op = parse_op(Rcpp::as<std::string>(filter_ops[k]));
+        flt.value = filter_values[k];
+        filters.push_back(flt);
+    }
+
+    // The row range
+    size_t lo = (size_t) std::max(first, 1.0) - 1;
+    size_t hi = (size_t) std::max(std::min(last, (double) m.nobs), 0.0);
+    size_t nrange = hi > lo ? hi - lo : 0;
+
+    const char *rows = f.data() + m.data_start + lo * m.rowwidth;
+    f.willneed(m.data_start + lo * m.rowwidth, nrange * m.rowwidth);
+
+    // Work out which rows pass the filters and where each chunk's output
+    // starts, so the output can be allocated at its final size
+    int nthreads = ado_threads_for(nrange, 1 << 16);
+    int nchunks = nthreads == 1 ? 1 : nthreads * 4;
+    size_t chunk = (nrange + nchunks - 1) / std::max(nchunks, 1);
+
+    std::vector<unsigned char> pass;
+    std::vector<size_t> out_offsets(nchunks + 1, 0);
+
+    if(filters.size() > 0)
+    {
+        pass.resize(nrange);
+
+        #pragma omp parallel for schedule(dynamic) num_threads(nthreads)
+        for(int c = 0; c < nchunks; c++)
+        {
+            size_t b = std::min(c * chunk, nrange), e = std::min(b + chunk, nrange);
+            size_t cnt = 0;
+
+            for(size_t r = b; r < e; r++)
+            {
+                pass[r] = row_passes(rows + r * m.rowwidth, filters, m.swap);
+                cnt += pass[r];
+            }
+
+            out_offsets[c + 1] = cnt;
+        }
+    } else
+    {
+        for(int c = 0; c < nchunks; c++)
+            out_offsets[c + 1] = std::min((c + 1) * chunk, nrange) -
+                                 std::min(c * chunk, nrange);
+    }
+
+    for(int c = 0; c < nchunks; c++)
+        out_offsets[c + 1] += out_offsets[c];
+    size_t nout = out_offsets[nchunks];
+
+    // Allocate the output on this thread, then decode into it in parallel
+    Rcpp::List data(vars.size());
+    std::vector<OutColumn> cols(vars.size());
+
+    for(size_t j = 0; j < vars.size(); j++)
+    {
+        OutColumn &col = cols[j];
+        col.var = vars[j];
+        col.type = m.types[col.var];
+        col.offset = m.offsets[col.var];
+        col.itg = NULL;
+        col.dbl = NULL;
+
+        if(dta::is_integer_type(col.type))
+        {
+            Rcpp::IntegerVector v(Rcpp::no_init(nout));
+            col.itg = v.begin();
+            data[j] = v;
+        } else if(col.type == dta::DOUBLE || col.type == dta::FLOAT)
+        {
+            Rcpp::NumericVector v(Rcpp::no_init(nout));
+            col.dbl = v.begin();
+            data[j] = v;
+        } else if(col.type == dta::STRL)
+        {
+            col.strls.resize(nout);
+        } else
+        {
+            col.strs.resize(nout);
+        }
+    }
+
+    #pragma omp parallel for schedule(dynamic) num_threads(nthreads)
+    for(int c = 0; c < nchunks; c++)
+    {
+        size_t b = std::min(c * chunk, nrange), e = std::min(b + chunk, nrange);
+        size_t i = out_offsets[c];
+
+        for(size_t r = b; r < e; r++)
+        {
+            if(pass.size() > 0 && !pass[r])
+                continue;
+
+            const char *row = rows + r * m.rowwidth;
+            for(size_t j = 0; j < cols.size(); j++)
+                decode_into(cols[j], row, i, m);
+
+            i++;
+        }
+    }
+
+    // Strings become CHARSXPs here on the main thread. Releases before 118
+    // don't specify an encoding, so those strings are taken as native.
+    cetype_t enc = m.release >= 118 ? CE_UTF8 : CE_NATIVE;
+
+    std::unordered_map<uint64_t, size_t> strl_index;
+    for(size_t j = 0; j < cols.size(); j++)
+        for(size_t i = 0; i < cols[j].strls.size(); i++)
+            strl_index.insert(std::make_pair(cols[j].strls[i], strl_index.size()));
+
+    Rcpp::CharacterVector strl_pool(strl_index.size());
+    if(strl_index.size() > 0)
+    {
+        dta::for_each_gso(f.data(), f.size(), m, [&](uint64_t key, const dta::Gso &g)
+        {
+            std::unordered_map<uint64_t, size_t>::iterator it = strl_index.find(key);
+            if(it == strl_index.end())
+                return;
+
+            // R strings can't hold NULs, so binary strLs are truncated
+            size_t len = g.binary ? dta::str_length(g.p, g.len) : g.len;
+            SET_STRING_ELT(strl_pool, it->second, Rf_mkCharLenCE(g.p, (int) len, enc));
+        });
+    }
+
+    for(size_t j = 0; j < cols.size(); j++)
+    {
+        OutColumn &col = cols[j];
+        if(!dta::is_string_type(col.type))
+            continue;
+
+        Rcpp::CharacterVector v(nout);
+        for(size_t i = 0; i < nout; i++)
+        {
+            if(col.type == dta::STRL)
+            {
+                SET_STRING_ELT(v, i, STRING_ELT(strl_pool, strl_index[col.strls[i]]));
+            } else
+            {
+                const char *p = col.strs[i];
+                size_t len = dta::str_length(p, col.type);
+                SET_STRING_ELT(v, i, Rf_mkCharLenCE(p, (int) len, enc));
+            }
+        }
+
+        data[j] = v;
+    }
+
+    // Value labels, and factors for the labeled columns
+    std::map<std::string, dta::ValueLabels> vls =
+        dta::parse_value_labels(f.data(), f.size(), m);
+
+    std::vector<std::string> names;
+    for(size_t j = 0; j < cols.size(); j++)
+    {
+        int var = cols[j].var;
+        names.push_back(m.varnames[var]);
+
+        std::map<std::string, dta::ValueLabels>::iterator it = vls.find(m.lblnames[var]);
+        if(convert_factors && dta::is_integer_type(cols[j].type) && it != vls.end())
+        {
+            Rcpp::IntegerVector v = data[j];
+            make_factor(v, it->second);
+        }
+    }
+    data.attr("names") = Rcpp::wrap(names);
+
+    Rcpp::List attrs = dta_attributes(m, vars, vls);
+
+    return Rcpp::List::create(Rcpp::Named("data") = data,
+                              Rcpp::Named("attrs") = attrs);
+}
@@ -0,0 +1,691 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <Rcpp.h>
+#include "Dta.hpp"
+#include "Parallel.hpp"
+
+/*
+ * A native writer for .dta files in formats 117 and 118, used by save and
+ * saveold. Each column is encoded once into the row-major data section:
+ * blocks of rows are encoded in parallel into one of two buffers while a
+ * separate thread writes out the other, so encoding overlaps with I/O. The
+ * strL section is likewise laid out in parallel before anything's written,
+ * so that the offsets in the <map> can be known up front.
+ */
+
+namespace {
+
+// Aim for blocks of about this many bytes
+const size_t BLOCK_BYTES = 4 << 20;
+
+// The days from 1 Jan 1960, where Stata's dates start, to 1 Jan 1970
+const double DATE_SHIFT = 3653;
+
+struct WriteColumn
+{
+    std::string name;
+    int type;
+    size_t offset;
+
+    SEXPTYPE rtype;
+    const int *itg;
+    const double *dbl;
+
+    // Added to every number: R Dates count days from 1970, Stata's from 1960
+    double shift;
+
+    // strings: start and length of each value; strLs: (v, o) of each
+    std::vector<const char *> strs;
+    std::vector<int> lens;
+    std::vector<uint64_t> refs;
+
+    std::string format;
+    std::string lblname;
+    std::string varlabel;
+};
+
+struct StrlEntry
+{
+    uint32_t v;
+    uint64_t o;
+    const char *p;
+    size_t len;
+};
+
+class Output
+{
+    public:
+        Output(const std::string &path)
+        {
+            fp = fopen(path.c_str(), "wb");
+            if(fp == NULL)
+                throw std::runtime_error("Cannot open file for writing: " + path);
+        }
+
+        ~Output()
+        {
+            if(fp != NULL)
+                fclose(fp);
+        }
+
+        void
+        write(const void *p, size_t n)
+        {
+            if(n > 0 && fwrite(p, 1, n, fp) != n)
+                throw std::runtime_error("Error writing file");
+        }
+
+        void write(const std::string &s) { write(s.data(), s.size()); }
+
+        void
+        close()
+        {
+            FILE *f = fp;
+            fp = NULL;
+
+            if(fclose(f) != 0)
+                throw std::runtime_error("Error writing file");
+        }
+
+        FILE *fp;
+
+    private:
+        Output(const Output& that); // no copy ctor
+        Output& operator=(Output const &); // no assignment
+};
+
+template<typename T>
+std::string
+bytes(T v)
+{
+    std::string s(sizeof(T), '\0');
+    dta::store<T>(&s[0], v, false);
+    return s;
+}
+
+// The first n characters of a UTF-8 string, never splitting one
+std::string
+utf8_prefix(const std::string &s, size_t n)
+{
+    size_t i = 0;
+    for(size_t chars = 0; i < s.size(); i++)
+    {
+        // Continuation bytes look like 10xxxxxx
+        if(((unsigned char) s[i] & 0xc0) != 0x80 && chars++ == n)
+            break;
+    }
+
+    return s.substr(0, i);
+}
+
+// s in a NUL-padded field of width bytes. From 118 on, text is UTF-8 and
+// is cut to at most chars characters as well, never splitting one.
+std::string
+fixed(const std::string &s, size_t width, int release, size_t chars)
+{
+    std::string ret = s.substr(0, width - 1);
+    if(release >= 118)
+    {
+        ret = utf8_prefix(s, chars);
+
+        size_t len = std::min(ret.size(), width - 1);
+        while(len < ret.size() && len > 0 && ((unsigned char) ret[len] & 0xc0) == 0x80)
+            len--;
+        ret.resize(len);
+    }
+
+    ret.resize(width, '\0');
+    return ret;
+}
+
+// The smallest integer type that holds every value of an integer or
+// logical vector, or double if none do
+int
+integer_storage(const int *x, R_xlen_t n)
+{
+    int lo = 0, hi = 0;
+    int nthreads = ado_threads_for(n, 1 << 16);
+
+    #pragma omp parallel for reduction(min:lo) reduction(max:hi) num_threads(nthreads)
+    for(R_xlen_t i = 0; i < n; i++)
+    {
+        if(x[i] == NA_INTEGER)
+            continue;
+
+        lo = std::min(lo, x[i]);
+        hi = std::max(hi, x[i]);
+    }
+
+    if(lo >= -127 && hi <= dta::MAX_BYTE)
+        return dta::BYTE;
+    if(lo >= -32767 && hi <= dta::MAX_INT)
+        return dta::INT;
+    if(hi <= dta::MAX_LONG)
+        return dta::LONG;
+
+    return dta::DOUBLE;
+}
+
+std::string
+default_format(int type)
+{
+    if(type == dta::BYTE || type == dta::INT)
+        return "%8.0g";
+    if(type == dta::LONG)
+        return "%12.0g";
+    if(type == dta::DOUBLE)
+        return "%10.0g";
+    if(type == dta::STRL)
+        return "%9s";
+
+    return "%" + std::to_string(std::max(type, 1)) + "s";
+}
+
+// Whether the display format fmt suits a variable of the given type: a
+// string format (%[-~]w s) for strings and any other for numbers, and for
+// dates a date format
+bool
+format_fits(const std::string &fmt, int type, bool date)
+{
+    if(fmt.size() < 2 || fmt[0] != '%')
+        return false;
+
+    size_t i = 1;
+    if(fmt[i] == '-' || fmt[i] == '~')
+        i++;
+    while(i < fmt.size() && fmt[i] >= '0' && fmt[i] <= '9')
+        i++;
+
+    bool str = i + 1 == fmt.size() && fmt[i] == 's';
+    if(str != dta::is_string_type(type))
+        return false;
+
+    return !date || fmt.find('t') != std::string::npos;
+}
+
+// The text of a value label, in UTF-8 from 118 on
+std::string
+label_text(SEXP s, bool utf8)
+{
+    return (utf8 && Rf_getCharCE(s) == CE_LATIN1) ? Rf_translateCharUTF8(s) : CHAR(s);
+}
+
+inline void
+encode_cell(const WriteColumn &col, size_t i, char *p, int release)
+{
+    switch(col.type)
+    {
+        case dta::BYTE:
+        {
+            int v = col.itg[i];
+            p[0] = (char) (int8_t) (v == NA_INTEGER ? dta::MAX_BYTE + 1 : v);
+            break;
+        }
+
+        case dta::INT:
+        {
+            int v = col.itg[i];
+            dta::store<uint16_t>(p, (uint16_t) (v == NA_INTEGER ? dta::MAX_INT + 1 : v), false);
+            break;
+        }
+
+        case dta::LONG:
+        {
+            int v = col.itg[i];
+            dta::store<uint32_t>(p, (uint32_t) (v == NA_INTEGER ? dta::MAX_LONG + 1 : v), false);
+            break;
+        }
+
+        case dta::DOUBLE:
+        {
+            double v;
+            if(col.rtype == REALSXP)
+                v = col.dbl[i];
+            else
+                v = col.itg[i] == NA_INTEGER ? NAN : col.itg[i];
+            v += col.shift;
+
+            // Stata has no infinities; they're written as missing too
+            if(std::isfinite(v))
+                memcpy(p, &v, sizeof(double));
+            else
+                dta::store<uint64_t>(p, dta::MISSING_DOUBLE, false);
+            break;
+        }
+
+        case dta::STRL:
+        {
+            uint64_t ref = col.refs[i];
+            dta::encode_strl_ref(p, release, ref & 0xffffffff, ref >> 32, false);
+            break;
+        }
+
+        default:
+        {
+            size_t len = (size_t) col.lens[i];
+            memcpy(p, col.strs[i], len);
+            memset(p + len, 0, col.type - len);
+            break;
+        }
+    }
+}
+
+// Encode rows [b, e) into buf, in parallel
+void
+encode_rows(const std::vector<WriteColumn> &cols, size_t rowwidth, size_t b,
+            size_t e, int release, std::vector<char> &buf)
+{
+    buf.resize((e - b) * rowwidth);
+    int nthreads = ado_threads_for(e - b, 1 << 12);
+
+    #pragma omp parallel for num_threads(nthreads)
+    for(R_xlen_t r = (R_xlen_t) b; r < (R_xlen_t) e; r++)
+    {
+        char *row = &buf[(r - b) * rowwidth];
+
+        for(size_t j = 0; j < cols.size(); j++)
+            encode_cell(cols[j], (size_t) r, row + cols[j].offset, release);
+    }
+}
+
+// Lay out the <strls> section's GSOs in a buffer, in parallel
+std::vector<char>
+encode_strls(const std::vector<StrlEntry> &entries, int release)
+{
+    size_t olen = release == 117 ? 4 : 8;
+    size_t n = entries.size();
+
+    std::vector<size_t> offsets(n + 1, 0);
+    for(size_t k = 0; k < n; k++)
+        offsets[k + 1] = offsets[k] + 3 + 4 + olen + 1 + 4 + entries[k].len + 1;
+
+    std::vector<char> buf(offsets[n]);
+    int nthreads = ado_threads_for(offsets[n], 1 << 20);
+
+    #pragma omp parallel for schedule(dynamic, 1024) num_threads(nthreads)
+    for(R_xlen_t k = 0; k < (R_xlen_t) n; k++)
+    {
+        const StrlEntry &s = entries[k];
+        char *p = &buf[offsets[k]];
+
+        memcpy(p, "GSO", 3);
+        dta::store<uint32_t>(p + 3, s.v, false);
+        if(olen == 4)
+            dta::store<uint32_t>(p + 7, (uint32_t) s.o, false);
+        else
+            dta::store<uint64_t>(p + 7, s.o, false);
+        p += 3 + 4 + olen;
+
+        // type 130 is an ASCII/UTF-8 string, stored with its trailing NUL
+        p[0] = (char) 130;
+        dta::store<uint32_t>(p + 1, (uint32_t) (s.len + 1), false);
+        memcpy(p + 5, s.p, s.len);
+        p[5 + s.len] = '\0';
+    }
+
+    return buf;
+}
+
+// Lay out and write a whole file. Everything before the data is built
+// first, so that the map can be filled in with the sections' final offsets.
+void
+write_file(const std::string &path, int release, const std::string &label,
+           const std::string &timestamp, const std::vector<WriteColumn> &cols,
+           size_t N, const std::vector<char> &strl_buf,
+           const std::string &lbl_section)
+{
+    size_t K = cols.size();
+    size_t rowwidth = K > 0 ? cols[K - 1].offset + dta::type_width(cols[K - 1].type) : 0;
+
+    std::string head = "<stata_dta><header><release>" + std::to_string(release) +
+                       "</release><byteorder>" + (dta::host_is_lsf() ? "LSF" : "MSF") +
+                       "</byteorder><K>" + bytes<uint16_t>((uint16_t) K) + "</K><N>";
+    head += release == 117 ? bytes<uint32_t>((uint32_t) N) : bytes<uint64_t>((uint64_t) N);
+
+    // The label is 80 bytes in 117 and 80 characters (up to 320 bytes) after
+    std::string lbl = release == 117 ? label.substr(0, 80) : utf8_prefix(label, 80);
+    head += "</N><label>";
+    head += release == 117 ? bytes<uint8_t>((uint8_t) lbl.size()) :
+                             bytes<uint16_t>((uint16_t) lbl.size());
+    head += lbl + "</label><timestamp>" + bytes<uint8_t>((uint8_t) timestamp.size()) +
+            timestamp + "</timestamp></header>";
+
+    uint64_t map[dta::MAP_SIZE];
+    map[dta::MAP_STATA_DATA] = 0;
+    map[dta::MAP_MAP] = head.size();
+
+    std::string meta;
+    size_t pos = head.size() + strlen("<map>") + 8 * dta::MAP_SIZE + strlen("</map>");
+
+    std::string types = "<variable_types>";
+    std::string varnames = "<varnames>";
+    std::string sortlist = "<sortlist>" + std::string(2 * (K + 1), '\0') + "</sortlist>";
+    std::string formats = "<formats>";
+    std::string lblnames = "<value_label_names>";
+    std::string varlbls = "<variable_labels>";
+    for(size_t j = 0; j < K; j++)
+    {
+        types += bytes<uint16_t>((uint16_t) cols[j].type);
+        varnames += fixed(cols[j].name, dta::name_width(release), release, 32);
+        formats += fixed(cols[j].format, dta::format_width(release), release,
+                         dta::format_width(release));
+        lblnames += fixed(cols[j].lblname, dta::name_width(release), release, 32);
+        varlbls += fixed(cols[j].varlabel, dta::varlabel_width(release), release, 80);
+    }
+    types += "</variable_types>";
+    varnames += "</varnames>";
+    formats += "</formats>";
+    lblnames += "</value_label_names>";
+    varlbls += "</variable_labels>";
+
+    const std::string *sections[] = { &types, &varnames, &sortlist, &formats,
+                                      &lblnames, &varlbls };
+    for(int k = 0; k < 6; k++)
+    {
+        map[dta::MAP_VARIABLE_TYPES + k] = pos;
+        pos += sections[k]->size();
+        meta += *sections[k];
+    }
+
+    std::string chars = "<characteristics></characteristics>";
+    map[dta::MAP_CHARACTERISTICS] = pos;
+    pos += chars.size();
+    meta += chars;
+
+    map[dta::MAP_DATA] = pos;
+    pos += strlen("<data>") + (uint64_t) N * rowwidth + strlen("</data>");
+
+    map[dta::MAP_STRLS] = pos;
+    pos += strlen("<strls>") + strl_buf.size() + strlen("</strls>");
+
+    map[dta::MAP_VALUE_LABELS] = pos;
+    pos += strlen("<value_labels>") + lbl_section.size() + strlen("</value_labels>");
+
+    map[dta::MAP_STATA_DATA_END] = pos;
+    pos += strlen("</stata_dta>");
+    map[dta::MAP_EOF] = pos;
+
+    std::string mapsec = "<map>";
+    for(int k = 0; k < dta::MAP_SIZE; k++)
+        mapsec += bytes<uint64_t>(map[k]);
+    mapsec += "</map>";
+
+    Output out(path);
+    out.write(head);
+    out.write(mapsec);
+    out.write(meta);
+    out.write("<data>");
+
+    // Stream the data section: encode one block while the other's written
+    size_t block = std::max((size_t) 1, BLOCK_BYTES / std::max(rowwidth, (size_t) 1));
+    std::vector<char> bufs[2];
+
+    std::thread writer;
+    std::string write_error;
+
+    try
+    {
+        for(size_t b = 0, k = 0; b < (size_t) N; b += block, k++)
+        {
+            size_t e = std::min(b + block, (size_t) N);
+            std::vector<char> &buf = bufs[k % 2];
+
+            encode_rows(cols, rowwidth, b, e, release, buf);
+
+            if(writer.joinable())
+                writer.join();
+            if(!write_error.empty())
+                break;
+
+            writer = std::thread([&out, &buf, &write_error]()
+            {
+                if(fwrite(buf.data(), 1, buf.size(), out.fp) != buf.size())
+                    write_error = "Error writing file";
+            });
+        }
+    } catch(...)
+    {
+        if(writer.joinable())
+            writer.join();
+        throw;
+    }
+
+    if(writer.joinable())
+        writer.join();
+    if(!write_error.empty())
+        throw std::runtime_error(write_error);
+
+    out.write("</data><strls>");
+    out.write(strl_buf.data(), strl_buf.size());
+    out.write("</strls><value_labels>");
+    out.write(lbl_section);
+    out.write("</value_labels></stata_dta>");
+
+    out.close();
+}
+
+} // namespace
+
+// Write the columns in data to a .dta file of the given release (117 or
+// 118). Integer and logical columns get the smallest type that holds
+// them, Dates become Stata dates, and strings too long for str2045 become
+// strLs. varlabels, formats and lblnames, if not empty, have each
+// column's variable label, display format and value label name; a format
+// that doesn't suit the column's type is replaced by the default for it
+// (%td for Dates). tables has the value labels to write, as named integer
+// vectors of values named by their labels, and each factor is written
+// with one made from its levels, named as lblnames says or else after
+// the column, in place of any table of that name.
+// [[Rcpp::export]]
+void
+write_dta(std::string path, Rcpp::List data, int release, std::string label,
+          std::string timestamp, Rcpp::CharacterVector varlabels,
+          Rcpp::CharacterVector formats, Rcpp::CharacterVector lblnames,
+          Rcpp::List tables)
+{
+    if(release != 117 && release != 118)
+        throw std::runtime_error("Can only write .dta releases 117 and 118");
+
+    size_t K = data.size();
+    R_xlen_t N = K > 0 ? Rf_xlength(data[0]) : 0;
+    bool utf8 = release >= 118;
+
+    Rcpp::CharacterVector names = Rf_getAttrib(data, R_NamesSymbol);
+    std::vector<WriteColumn> cols(K);
+    std::vector<StrlEntry> strls;
+
+    // Gather pointers to everything on this thread; the parallel encoding
+    // below works only from these
+    size_t rowwidth = 0;
+    for(size_t j = 0; j < K; j++)
+    {
+        SEXP x = data[j];
+        WriteColumn &col = cols[j];
+
+        col.name = Rcpp::as<std::string>(names[j]);
+        if(col.name.size() >= dta::name_width(release) ||
+           (utf8 && utf8_prefix(col.name, 32).size() < col.name.size()))
+            throw std::runtime_error("Variable name too long: " + col.name);
+        if(Rf_xlength(x) != N)
+            throw std::runtime_error("Columns differ in length");
+
+        col.rtype = TYPEOF(x);
+        col.itg = NULL;
+        col.dbl = NULL;
+        col.shift = 0;
+
+        bool date = Rf_inherits(x, "Date") && (col.rtype == INTSXP || col.rtype == REALSXP);
+        if(date)
+        {
+            col.itg = col.rtype == INTSXP ? INTEGER(x) : NULL;
+            col.dbl = col.rtype == REALSXP ? REAL(x) : NULL;
+            col.type = dta::DOUBLE;
+            col.shift = DATE_SHIFT;
+        } else if(col.rtype == INTSXP || col.rtype == LGLSXP)
+        {
+            col.itg = col.rtype == INTSXP ? INTEGER(x) : LOGICAL(x);
+            col.type = Rf_isFactor(x) ? dta::LONG : integer_storage(col.itg, N);
+        } else if(col.rtype == REALSXP)
+        {
+            col.dbl = REAL(x);
+            col.type = dta::DOUBLE;
+        } else if(col.rtype == STRSXP)
+        {
+            col.strs.resize(N);
+            col.lens.resize(N);
+
+            size_t width = 1;
+            for(R_xlen_t i = 0; i < N; i++)
+            {
+                SEXP s = STRING_ELT(x, i);
+                const char *p = "";
+
+                if(s != NA_STRING)
+                {
+                    bool translate = utf8 && Rf_getCharCE(s) == CE_LATIN1;
+                    p = translate ? Rf_translateCharUTF8(s) : CHAR(s);
+                }
+
+                col.strs[i] = p;
+                col.lens[i] = (int) strlen(p);
+                width = std::max(width, (size_t) col.lens[i]);
+            }
+
+            col.type = width <= (size_t) dta::MAX_STR ? (int) width : dta::STRL;
+            if(col.type == dta::STRL)
+            {
+                // Each distinct string is stored once, at its first
+                // occurrence; equal R strings share a CHARSXP, so the
+                // pointer identifies them
+                std::unordered_map<const char *, uint64_t> seen;
+                col.refs.resize(N);
+
+                for(R_xlen_t i = 0; i < N; i++)
+                {
+                    if(col.lens[i] == 0)
+                    {
+                        col.refs[i] = 0;
+                        continue;
+                    }
+
+                    uint64_t v = j + 1, o = i + 1;
+                    std::pair<std::unordered_map<const char *, uint64_t>::iterator, bool>
+                        ins = seen.insert(std::make_pair(col.strs[i], (o << 32) | v));
+
+                    col.refs[i] = ins.first->second;
+                    if(ins.second)
+                    {
+                        StrlEntry e = { (uint32_t) v, o, col.strs[i], (size_t) col.lens[i] };
+                        strls.push_back(e);
+                    }
+                }
+            }
+        } else
+        {
+            throw std::runtime_error("Cannot save column of unsupported type: " + col.name);
+        }
+
+        std::string fmt;
+        if(j < (size_t) formats.size() && formats[j] != NA_STRING)
+            fmt = Rcpp::as<std::string>(formats[j]);
+        col.format = format_fits(fmt, col.type, date) ? fmt :
+                     date ? "%td" : default_format(col.type);
+
+        if(j < (size_t) varlabels.size() && varlabels[j] != NA_STRING)
+            col.varlabel = Rcpp::as<std::string>(varlabels[j]);
+
+        if(!dta::is_string_type(col.type))
+        {
+            if(j < (size_t) lblnames.size() && lblnames[j] != NA_STRING)
+                col.lblname = Rcpp::as<std::string>(lblnames[j]);
+            if(Rf_isFactor(x) && col.lblname.empty())
+                col.lblname = col.name;
+        }
+
+        col.offset = rowwidth;
+        rowwidth += dta::type_width(col.type);
+    }
+
+    if((release == 117 && K > 32767) || (release == 118 && K > 65535))
+        throw std::runtime_error("Too many variables for this .dta release");
+
+    std::vector<char> strl_buf = encode_strls(strls, release);
+
+    // Value labels: the tables given, then one for each factor
+    typedef std::vector<std::pair<int32_t, std::string> > Table;
+    std::map<std::string, Table> vls;
+
+    SEXP tnames = Rf_getAttrib(tables, R_NamesSymbol);
+    for(R_xlen_t k = 0; k < tables.size() && !Rf_isNull(tnames); k++)
+    {
+        SEXP t = tables[k], lbls = Rf_getAttrib(t, R_NamesSymbol);
+        if((TYPEOF(t) != INTSXP && TYPEOF(t) != REALSXP) || Rf_isNull(lbls) ||
+           STRING_ELT(tnames, k) == NA_STRING)
+        {
+            continue;
+        }
+
+        Table &tab = vls[CHAR(STRING_ELT(tnames, k))];
+        tab.clear();
+        for(R_xlen_t i = 0; i < Rf_xlength(t); i++)
+        {
+            double v = TYPEOF(t) == INTSXP ?
+                       (INTEGER(t)[i] == NA_INTEGER ? NAN : INTEGER(t)[i]) : REAL(t)[i];
+            if(std::isnan(v) || STRING_ELT(lbls, i) == NA_STRING)
+                continue;
+
+            tab.push_back(std::make_pair((int32_t) v, label_text(STRING_ELT(lbls, i), utf8)));
+        }
+    }
+
+    for(size_t j = 0; j < K; j++)
+    {
+        if(!Rf_isFactor(data[j]))
+            continue;
+
+        Rcpp::CharacterVector levels = Rf_getAttrib(data[j], R_LevelsSymbol);
+        Table &tab = vls[cols[j].lblname];
+
+        tab.clear();
+        for(R_xlen_t k = 0; k < levels.size(); k++)
+            tab.push_back(std::make_pair((int32_t) (k + 1), label_text(levels[k], utf8)));
+    }
+
+    std::string lbl_section;
+    for(std::map<std::string, Table>::iterator it = vls.begin(); it != vls.end(); ++it)
+    {
+        if(it->first.empty())
+            continue;
+
+        Table &tab = it->second;
+        std::sort(tab.begin(), tab.end());
+
+        std::string offs, vals, txt;
+        for(size_t k = 0; k < tab.size(); k++)
+        {
+            offs += bytes<uint32_t>((uint32_t) txt.size());
+            vals += bytes<uint32_t>((uint32_t) tab[k].first);
+            txt += tab[k].second;
+            txt += '\0';
+        }
+
+        std::string table = bytes<uint32_t>((uint32_t) tab.size()) +
+                            bytes<uint32_t>((uint32_t) txt.size()) + offs + vals + txt;
+
+        lbl_section += "<lbl>" + bytes<uint32_t>((uint32_t) table.size()) +
+                       fixed(it->first, dta::name_width(release), release, 32) +
+                       std::string(3, '\0') + table + "</lbl>";
+    }
+
+    write_file(path, release, label, timestamp, cols, (size_t) N, strl_buf,
+               lbl_section);
+}
@@ -0,0 +1,225 @@
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <Rcpp.h>
+#include "Columns.hpp"
+#include "Grouping.hpp"
+#include "Parallel.hpp"
+
+/*
+ * Kernels for egen's functions by group. The groups are numbered once by
+ * group_index, and the R side keeps that index and hands it to every egen
+ * call with the same by variables, so repeated calls don't hash the keys
+ * again. The summary statistics (total, mean, sd, ...) go through the
+ * collapse engine instead; see group_stat in Collapse.cpp. In all of
+ * these, a row whose group number is NA is left out: it doesn't count
+ * toward its group and gets a missing (or for tag, zero) result.
+ */
+
+namespace {
+
+// Each thread should get at least this many rows
+const size_t MIN_ROWS_PER_THREAD = 1 << 16;
+
+// Below this many rows, grouping in parallel costs more than it saves
+const size_t PARALLEL_GROUP_ROWS = 1 << 20;
+
+enum RankMethod
+{
+    RANK_MEAN,      // ties get the mean of their ranks
+    RANK_FIELD,     // the largest value is 1; ties get the same rank
+    RANK_TRACK,     // the smallest value is 1; ties get the same rank
+    RANK_UNIQUE     // ties are broken by row order
+};
+
+RankMethod
+parse_rank_method(const std::string &s)
+{
+    if(s == "mean")
+        return RANK_MEAN;
+    if(s == "field")
+        return RANK_FIELD;
+    if(s == "track")
+        return RANK_TRACK;
+    if(s == "unique")
+        return RANK_UNIQUE;
+
+    Rcpp::stop("Unknown rank method: " + s);
+}
+
+// Rank the values in v, which are (value, row) pairs sorted ascending,
+// into out at each pair's row
+void
+rank_run(const std::vector<std::pair<double, size_t> > &v, RankMethod method,
+         double *out)
+{
+    size_t m = v.size();
+
+    for(size_t a = 0; a < m; )
+    {
+        size_t b = a + 1;
+        while(b < m && v[b].first == v[a].first)
+            b++;
+
+        // Positions a through b - 1 (from 0) hold one tied value
+        for(size_t k = a; k < b; k++)
+        {
+            double r;
+            switch(method)
+            {
+                case RANK_MEAN: r = (a + b + 1) / 2.0; break;
+                case RANK_FIELD: r = (double) (m - b + 1); break;
+                case RANK_TRACK: r = (double) (a + 1); break;
+                default: r = (double) (k + 1); break;
+            }
+
+            out[v[k].second] = r;
+        }
+
+        a = b;
+    }
+}
+
+} // namespace
+
+// Number the distinct values of the key columns in cols, counting from 1
+// in order of first appearance. Returns a list: id, each row's group
+// number, and first, the first row (from 1) of each group.
+// [[Rcpp::export]]
+Rcpp::List
+group_index(Rcpp::List cols)
+{
+    KeyColumns keys(cols);
+    size_t n = keys.nrow();
+
+    int nthreads = ado_threads_for(n, MIN_ROWS_PER_THREAD);
+    Groups groups = find_groups(keys, n < PARALLEL_GROUP_ROWS ? 1 : nthreads);
+
+    Rcpp::IntegerVector id(Rcpp::no_init(n)), first(Rcpp::no_init(groups.count()));
+    int *ip = INTEGER(id);
+
+    #pragma omp parallel for num_threads(nthreads)
+    for(R_xlen_t i = 0; i < (R_xlen_t) n; i++)
+        ip[i] = groups.id[i] + 1;
+
+    for(size_t g = 0; g < groups.count(); g++)
+        first[g] = (int) groups.first[g] + 1;
+
+    return Rcpp::List::create(Rcpp::Named("id") = id,
+                              Rcpp::Named("first") = first);
+}
+
+// Rank x within each group by method ("mean", "field", "track" or
+// "unique"). Missing values aren't ranked.
+// [[Rcpp::export]]
+Rcpp::NumericVector
+group_rank(Rcpp::IntegerVector ids, int ngroups, Rcpp::NumericVector x,
+           std::string method)
+{
+    R_xlen_t n = ids.size();
+    if(x.size() != n)
+        Rcpp::stop("Variable and group numbers differ in length");
+
+    RankMethod how = parse_rank_method(method);
+    const int *id = INTEGER(ids);
+    const double *xp = REAL(x);
+
+    // Missing values are left out along with the rows not in any group
+    std::vector<int> use(id, id + n);
+    for(R_xlen_t i = 0; i < n; i++)
+        if(std::isnan(xp[i]))
+            use[i] = NA_INTEGER;
+
+    Groups groups = groups_from_ids(use.data(), n, ngroups);
+    GroupRuns runs = group_runs(groups);
+
+    Rcpp::NumericVector ret(Rcpp::no_init(n));
+    double *out = REAL(ret);
+    std::fill(out, out + n, NA_REAL);
+
+    int nthreads = ado_threads_for(n, MIN_ROWS_PER_THREAD);
+
+    #pragma omp parallel num_threads(nthreads)
+    {
+        std::vector<std::pair<double, size_t> > v;
+
+        #pragma omp for schedule(dynamic, 64)
+        for(R_xlen_t g = 0; g < (R_xlen_t) ngroups; g++)
+        {
+            v.clear();
+            for(size_t k = runs.starts[g]; k < runs.starts[g + 1]; k++)
+                v.push_back(std::make_pair(xp[runs.rows[k]], runs.rows[k]));
+
+            // The runs are in row order, so pairs sort ties by row
+            std::sort(v.begin(), v.end());
+            rank_run(v, how, out);
+        }
+    }
+
+    return ret;
+}
+
+// 1 for the first row of each group, 0 for all others
+// [[Rcpp::export]]
+Rcpp::IntegerVector
+group_tag(Rcpp::IntegerVector ids, int ngroups)
+{
+    R_xlen_t n = ids.size();
+    const int *id = INTEGER(ids);
+
+    Rcpp::IntegerVector ret(n);
+    std::vector<char> seen(ngroups, 0);
+
+    for(R_xlen_t i = 0; i < n; i++)
+    {
+        int g = id[i];
+        if(g == NA_INTEGER || seen[g - 1])
+            continue;
+
+        seen[g - 1] = 1;
+        ret[i] = 1;
+    }
+
+    return ret;
+}
+
+// Number the rows of each group in order: from, from + 1, ... up to to,
+// if given (to is NA otherwise), and then from again, each number
+// repeated block times. If to is less than from, the numbers count down.
+// [[Rcpp::export]]
+Rcpp::IntegerVector
+group_seq(Rcpp::IntegerVector ids, int ngroups, int from, int to, int block)
+{
+    if(block < 1)
+        Rcpp::stop("Block size must be positive");
+
+    R_xlen_t n = ids.size();
+    const int *id = INTEGER(ids);
+
+    Rcpp::IntegerVector ret(Rcpp::no_init(n));
+    std::vector<R_xlen_t> pos(ngroups, 0);
+
+    int step = to != NA_INTEGER && to < from ? -1 : 1;
+    R_xlen_t period = to == NA_INTEGER ? 0 : (R_xlen_t) std::abs(to - from) + 1;
+
+    for(R_xlen_t i = 0; i < n; i++)
+    {
+        int g = id[i];
+        if(g == NA_INTEGER)
+        {
+            ret[i] = NA_INTEGER;
+            continue;
+        }
+
+        R_xlen_t k = pos[g - 1]++ / block;
+        if(period > 0)
+            k %= period;
+
+        ret[i] = from + step * (int) k;
+    }
+
+    return ret;
+}
@@ -0,0 +1,185 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <Rcpp.h>
+#include "Hashing.hpp"
+#include "NumericColumns.hpp"
+#include "Parallel.hpp"
+
+/*
+ * encode and decode: strings to value-labeled codes and back. R keeps one
+ * copy of each distinct string (a CHARSXP in its global cache), so two
+ * equal strings are the same pointer, and the dictionary that numbers the
+ * distinct strings is keyed by pointer: one pass over the rows hashes an
+ * address per row and never touches the characters. The labels end up as
+ * a factor's levels, one shared vector of those same cached strings.
+ *
+ * The codes don't depend on the order of the rows or on the locale: new
+ * labels are numbered in byte order of their strings, after the labels
+ * of any existing value label, so encoding the same data twice gives the
+ * same codes.
+ */
+
+namespace {
+
+// Each thread should get at least this many rows
+const R_xlen_t MIN_ROWS_PER_THREAD = 1 << 16;
+
+// An open-addressing table from distinct strings to numbers 0, 1, ...
+// in order of insertion, growing to keep the load factor under one half
+class StringDict
+{
+public:
+    StringDict()
+        : mask(15), keys(16, (SEXP) NULL), ids(16)
+    { }
+
+    size_t size() const { return strings.size(); }
+    SEXP string(size_t id) const { return strings[id]; }
+
+    // The number of s, which is added if it's new
+    int
+    id_of(SEXP s)
+    {
+        size_t i = slot(s);
+        if(keys[i] != NULL)
+            return ids[i];
+
+        keys[i] = s;
+        ids[i] = (int) strings.size();
+        strings.push_back(s);
+
+        if(2 * strings.size() > keys.size())
+            grow();
+
+        return (int) strings.size() - 1;
+    }
+
+private:
+    size_t mask;
+    std::vector<SEXP> keys;
+    std::vector<int> ids;
+    std::vector<SEXP> strings;
+
+    // The slot holding s, or the empty slot where it would go
+    size_t
+    slot(SEXP s) const
+    {
+        size_t i = hash_mix((uint64_t) (uintptr_t) s) & mask;
+        while(keys[i] != NULL && keys[i] != s)
+            i = (i + 1) & mask;
+
+        return i;
+    }
+
+    void
+    grow()
+    {
+        keys.assign(2 * keys.size(), (SEXP) NULL);
+        ids.resize(keys.size());
+        mask = keys.size() - 1;
+
+        for(size_t k = 0; k < strings.size(); k++)
+        {
+            size_t i = slot(strings[k]);
+            keys[i] = strings[k];
+            ids[i] = (int) k;
+        }
+    }
+};
+
+bool
+byte_less(SEXP a, SEXP b)
+{
+    return std::strcmp(CHAR(a), CHAR(b)) < 0;
+}
+
+} // namespace
+
+// Encode the strings in x as codes into labels: those in levels first, in
+// order, and then any others in x, sorted. Missing strings ("" or NA) and
+// rows mask leaves out (if mask isn't NULL) get NA. Returns a list: codes,
+// the code (from 1) of each row, and levels, all the labels.
+// [[Rcpp::export]]
+Rcpp::List
+encode_strings(Rcpp::CharacterVector x, Rcpp::CharacterVector levels, SEXP mask)
+{
+    R_xlen_t n = x.size();
+    if(!Rf_isNull(mask) && (TYPEOF(mask) != LGLSXP || Rf_xlength(mask) != n))
+        Rcpp::stop("Mask must be a logical vector with one element per row");
+    const int *mp = Rf_isNull(mask) ? NULL : LOGICAL(mask);
+
+    StringDict dict;
+    for(R_xlen_t k = 0; k < levels.size(); k++)
+        dict.id_of(levels[k]);
+
+    if(dict.size() != (size_t) levels.size())
+        Rcpp::stop("Duplicate labels in value label");
+
+    // Number the strings in order of first appearance
+    Rcpp::IntegerVector codes(Rcpp::no_init(n));
+    int *cp = INTEGER(codes);
+
+    for(R_xlen_t i = 0; i < n; i++)
+    {
+        SEXP s = x[i];
+        cp[i] = s == NA_STRING || s == R_BlankString || !selected(mp, i)
+              ? NA_INTEGER : dict.id_of(s);
+    }
+
+    // and then renumber the new ones in sorted order
+    size_t nold = levels.size(), nall = dict.size();
+    std::vector<int> order(nall - nold);
+    for(size_t k = 0; k < order.size(); k++)
+        order[k] = (int) (nold + k);
+
+    std::sort(order.begin(), order.end(), [&dict](int a, int b)
+              { return byte_less(dict.string(a), dict.string(b)); });
+
+    std::vector<int> code_of(nall);
+    Rcpp::CharacterVector labels(nall);
+    for(size_t k = 0; k < nall; k++)
+    {
+        int id = k < nold ? (int) k : order[k - nold];
+
+        code_of[id] = (int) k + 1;
+        labels[k] = dict.string(id);
+    }
+
+    int nthreads = ado_threads_for(n, MIN_ROWS_PER_THREAD);
+
+    #pragma omp parallel for num_threads(nthreads)
+    for(R_xlen_t i = 0; i < n; i++)
+        if(cp[i] != NA_INTEGER)
+            cp[i] = code_of[cp[i]];
+
+    return Rcpp::List::create(Rcpp::Named("codes") = codes,
+                              Rcpp::Named("levels") = labels);
+}
+
+// The labels of the codes (from 1) into levels, with "" for missing codes,
+// codes without a label and rows mask leaves out (if mask isn't NULL)
+// [[Rcpp::export]]
+Rcpp::CharacterVector
+decode_codes(Rcpp::IntegerVector codes, Rcpp::CharacterVector levels, SEXP mask)
+{
+    R_xlen_t n = codes.size(), nlev = levels.size();
+    if(!Rf_isNull(mask) && (TYPEOF(mask) != LGLSXP || Rf_xlength(mask) != n))
+        Rcpp::stop("Mask must be a logical vector with one element per row");
+    const int *mp = Rf_isNull(mask) ? NULL : LOGICAL(mask);
+
+    const int *cp = INTEGER(codes);
+    Rcpp::CharacterVector ret(Rcpp::no_init(n));
+
+    for(R_xlen_t i = 0; i < n; i++)
+    {
+        int c = cp[i];
+        bool labeled = c != NA_INTEGER && c >= 1 && c <= nlev && selected(mp, i);
+
+        SET_STRING_ELT(ret, i, labeled ? STRING_ELT(levels, c - 1) : R_BlankString);
+    }
+
+    return ret;
+}
@@ -0,0 +1,864 @@
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <Rcpp.h>
+#include "CrossProducts.hpp"
+#include "LinearAlgebra.hpp"
+#include "NumericColumns.hpp"
+#include "Parallel.hpp"
+
+/*
+ * Generalized linear models by iteratively reweighted least squares, for
+ * glm, binreg, logit, logistic, probit and poisson. A model is a Link,
+ * which takes the linear predictor eta to the mean, and a Family, which
+ * gives the variance as a function of the mean, the deviance and the log
+ * likelihood; adding one means writing a subclass and a line in
+ * make_link() or make_family().
+ *
+ * Each iteration is one parallel pass over the rows, streamed from the
+ * dataset's columns as regress's are (see Regress.cpp): every thread
+ * gathers a chunk of rows at a time, works out their working weights and
+ * working response from the current coefficients, and adds X'WX and X'Wz
+ * for them to its own accumulator with cross_add() (see CrossProducts.hpp).
+ * The accumulators are added up in order, so the result doesn't depend on
+ * the number of threads, and the weighted least-squares step is solved by
+ * solve_in_order() (see LinearAlgebra.hpp), which leaves out collinear
+ * variables as regress does. The iterations stop, as Stata's do, when the
+ * coefficients and the deviance both stop changing (relative to
+ * tolerance and ltolerance), and a step that makes the deviance worse is
+ * halved. A last pass at the estimates gives the observed information and,
+ * with robust, the sum of the squared scores.
+ */
+
+namespace {
+
+// Each thread should get at least this many rows
+const R_xlen_t MIN_ROWS_PER_THREAD = 1 << 14;
+
+// Rows gathered into a buffer at a time
+const size_t CHUNK_ROWS = 256;
+
+// The threads' accumulators together hold at most this many doubles
+const size_t MAX_ACCUMULATED = (size_t) 1 << 24;
+
+// A variable is collinear with the ones before it if less than this
+// fraction of its sum of squares is left after taking them out
+const double COLLINEAR_TOL = 1e-13;
+
+// How many times a step that makes the deviance worse is halved
+const int MAX_HALVINGS = 10;
+
+// Probabilities are kept this far from 0 and 1
+const double PROB_EPS = 1e-12;
+
+// y log(y / mu), which is 0 when y is
+inline double
+ylog(double y, double mu)
+{
+    return y == 0 ? 0 : y * std::log(y / mu);
+}
+
+// The standard normal quantile of p, by Acklam's rational approximation
+// polished with a step of Newton's method; the links are evaluated inside
+// parallel regions, where R's qnorm() can't be called
+double
+inverse_normal(double p)
+{
+    static const double a[] = {-3.969683028665376e+01, 2.209460984245205e+02,
+                               -2.759285104469687e+02, 1.383577518672690e+02,
+                               -3.066479806614716e+01, 2.506628277459239e+00};
+    static const double b[] = {-5.447609879822406e+01, 1.615858368580409e+02,
+                               -1.556989798598866e+02, 6.680131188771972e+01,
+                               -1.328068155288572e+01};
+    static const double c[] = {-7.784894002430293e-03, -3.223964580411365e-01,
+                               -2.400758277161838e+00, -2.549732539343734e+00,
+                               4.374664141464968e+00, 2.938163982698783e+00};
+    static const double d[] = {7.784695709041462e-03, 3.224671290700398e-01,
+                               2.445134137142996e+00, 3.754408661907416e+00};
+
+    if(!(p > 0 && p < 1))
+        return p == 0 ? -INFINITY : (p == 1 ? INFINITY : NAN);
+
+    double x;
+    if(p < 0.02425 || p > 1 - 0.02425)
+    {
+        double r = std::sqrt(-2 * std::log(std::min(p, 1 - p)));
+        x = (((((c[0] * r + c[1]) * r + c[2]) * r + c[3]) * r + c[4]) * r + c[5]) /
+            ((((d[0] * r + d[1]) * r + d[2]) * r + d[3]) * r + 1);
+        if(p > 0.5)
+            x = -x;
+    } else
+    {
+        double r = (p - 0.5) * (p - 0.5);
+        x = (((((a[0] * r + a[1]) * r + a[2]) * r + a[3]) * r + a[4]) * r + a[5]) * (p - 0.5) /
+            (((((b[0] * r + b[1]) * r + b[2]) * r + b[3]) * r + b[4]) * r + 1);
+    }
+
+    double e = 0.5 * std::erfc(-x / M_SQRT2) - p;
+    return x - e * std::sqrt(2 * M_PI) * std::exp(0.5 * x * x);
+}
+
+//
+// Links
+//
+
+// The inverse link takes eta to the mean of one trial: the probability,
+// for the binomial family, or just the mean for the others
+class Link
+{
+public:
+    virtual ~Link() {}
+
+    // g(mu), the linear predictor for mean mu
+    virtual double eta(double mu) const = 0;
+
+    // The inverse, and its first two derivatives
+    virtual double mu(double eta) const = 0;
+    virtual double dmu(double eta) const = 0;
+    virtual double d2mu(double eta) const = 0;
+};
+
+class IdentityLink : public Link
+{
+public:
+    double eta(double mu) const { return mu; }
+    double mu(double eta) const { return eta; }
+    double dmu(double) const { return 1; }
+    double d2mu(double) const { return 0; }
+};
+
+class LogLink : public Link
+{
+public:
+    double eta(double mu) const { return std::log(mu); }
+    double mu(double eta) const { return std::exp(eta); }
+    double dmu(double eta) const { return std::exp(eta); }
+    double d2mu(double eta) const { return std::exp(eta); }
+};
+
+class LogitLink : public Link
+{
+public:
+    double eta(double mu) const { return std::log(mu / (1 - mu)); }
+    double mu(double eta) const { return 1 / (1 + std::exp(-eta)); }
+
+    double
+    dmu(double eta) const
+    {
+        double p = mu(eta);
+        return p * (1 - p);
+    }
+
+    double
+    d2mu(double eta) const
+    {
+        double p = mu(eta);
+        return p * (1 - p) * (1 - 2 * p);
+    }
+};
+
+class ProbitLink : public Link
+{
+public:
+    double eta(double mu) const { return inverse_normal(mu); }
+
+    double mu(double eta) const { return 0.5 * std::erfc(-eta / M_SQRT2); }
+    double dmu(double eta) const { return std::exp(-0.5 * eta * eta) / std::sqrt(2 * M_PI); }
+    double d2mu(double eta) const { return -eta * dmu(eta); }
+};
+
+class CloglogLink : public Link
+{
+public:
+    double eta(double mu) const { return std::log(-std::log(1 - mu)); }
+    double mu(double eta) const { return -std::expm1(-std::exp(eta)); }
+    double dmu(double eta) const { return std::exp(eta - std::exp(eta)); }
+    double d2mu(double eta) const { return dmu(eta) * (1 - std::exp(eta)); }
+};
+
+class LoglogLink : public Link
+{
+public:
+    double eta(double mu) const { return -std::log(-std::log(mu)); }
+    double mu(double eta) const { return std::exp(-std::exp(-eta)); }
+    double dmu(double eta) const { return std::exp(-eta - std::exp(-eta)); }
+    double d2mu(double eta) const { return dmu(eta) * (std::exp(-eta) - 1); }
+};
+
+// log(1 - mu), binreg's link for health ratios
+class LogComplementLink : public Link
+{
+public:
+    double eta(double mu) const { return std::log1p(-mu); }
+    double mu(double eta) const { return -std::expm1(eta); }
+    double dmu(double eta) const { return -std::exp(eta); }
+    double d2mu(double eta) const { return -std::exp(eta); }
+};
+
+// mu^a; power 0 is the log link
+class PowerLink : public Link
+{
+public:
+    explicit PowerLink(double a) : a(a) {}
+
+    double eta(double mu) const { return std::pow(mu, a); }
+    double mu(double eta) const { return std::pow(eta, 1 / a); }
+    double dmu(double eta) const { return std::pow(eta, 1 / a - 1) / a; }
+    double d2mu(double eta) const { return (1 / a - 1) * std::pow(eta, 1 / a - 2) / a; }
+
+private:
+    double a;
+};
+
+std::unique_ptr<Link>
+make_link(const std::string &name, double param)
+{
+    if(name == "identity")
+        return std::unique_ptr<Link>(new IdentityLink());
+    if(name == "log" || (name == "power" && param == 0))
+        return std::unique_ptr<Link>(new LogLink());
+    if(name == "logit")
+        return std::unique_ptr<Link>(new LogitLink());
+    if(name == "probit")
+        return std::unique_ptr<Link>(new ProbitLink());
+    if(name == "cloglog")
+        return std::unique_ptr<Link>(new CloglogLink());
+    if(name == "loglog")
+        return std::unique_ptr<Link>(new LoglogLink());
+    if(name == "logc")
+        return std::unique_ptr<Link>(new LogComplementLink());
+    if(name == "power")
+        return std::unique_ptr<Link>(new PowerLink(param));
+
+    Rcpp::stop("Unknown link function: " + name);
+}
+
+//
+// Families
+//
+
+// Everything here is per observation: y is the response, mu its fitted
+// mean and n its number of trials (1 for families that don't have them)
+class Family
+{
+public:
+    virtual ~Family() {}
+
+    // The response as fitted, and the mean it starts from
+    virtual double response(double y) const { return y; }
+    virtual double start(double y, double ybar, double) const { return (y + ybar) / 2; }
+
+    // A mean kept within the family's range
+    virtual double fitted(double mu, double) const { return mu; }
+
+    // The variance function and its derivative
+    virtual double variance(double mu, double n) const = 0;
+    virtual double dvariance(double mu, double n) const = 0;
+
+    // The contribution to the deviance and to the log likelihood (NaN if
+    // that depends on a scale the family estimates)
+    virtual double deviance(double y, double mu, double n) const = 0;
+    virtual double loglik(double, double, double) const { return NAN; }
+};
+
+class GaussianFamily : public Family
+{
+public:
+    double variance(double, double) const { return 1; }
+    double dvariance(double, double) const { return 0; }
+    double deviance(double y, double mu, double) const { return (y - mu) * (y - mu); }
+};
+
+// Binomial with n trials, of which y succeed; with bernoulli, as for
+// logit and probit, y is whether the response is nonzero
+class BinomialFamily : public Family
+{
+public:
+    explicit BinomialFamily(bool bernoulli) : bernoulli(bernoulli) {}
+
+    double response(double y) const { return bernoulli ? (double) (y != 0) : y; }
+    double start(double y, double, double n) const { return n * (y + 0.5) / (n + 1); }
+
+    double
+    fitted(double mu, double n) const
+    {
+        return std::min(std::max(mu, n * PROB_EPS), n * (1 - PROB_EPS));
+    }
+
+    double variance(double mu, double n) const { return mu * (1 - mu / n); }
+    double dvariance(double mu, double n) const { return 1 - 2 * mu / n; }
+
+    double
+    deviance(double y, double mu, double n) const
+    {
+        return 2 * (ylog(y, mu) + ylog(n - y, n - mu));
+    }
+
+    double
+    loglik(double y, double mu, double n) const
+    {
+        double ll = (y == 0 ? 0 : y * std::log(mu / n)) +
+                    (n - y == 0 ? 0 : (n - y) * std::log1p(-mu / n));
+        if(n != 1)
+            ll += std::lgamma(n + 1) - std::lgamma(y + 1) - std::lgamma(n - y + 1);
+        return ll;
+    }
+
+private:
+    bool bernoulli;
+};
+
+class PoissonFamily : public Family
+{
+public:
+    double variance(double mu, double) const { return mu; }
+    double dvariance(double, double) const { return 1; }
+    double deviance(double y, double mu, double) const { return 2 * (ylog(y, mu) - (y - mu)); }
+
+    double
+    loglik(double y, double mu, double) const
+    {
+        return (y == 0 ? 0 : y * std::log(mu)) - mu - std::lgamma(y + 1);
+    }
+};
+
+class GammaFamily : public Family
+{
+public:
+    double variance(double mu, double) const { return mu * mu; }
+    double dvariance(double mu, double) const { return 2 * mu; }
+    double deviance(double y, double mu, double) const { return 2 * ((y - mu) / mu - std::log(y / mu)); }
+};
+
+class InverseGaussianFamily : public Family
+{
+public:
+    double variance(double mu, double) const { return mu * mu * mu; }
+    double dvariance(double mu, double) const { return 3 * mu * mu; }
+    double deviance(double y, double mu, double) const { return (y - mu) * (y - mu) / (mu * mu * y); }
+};
+
+// Negative binomial with a known dispersion k
+class NegativeBinomialFamily : public Family
+{
+public:
+    explicit NegativeBinomialFamily(double k) : k(k) {}
+
+    double variance(double mu, double) const { return mu + k * mu * mu; }
+    double dvariance(double mu, double) const { return 1 + 2 * k * mu; }
+
+    double
+    deviance(double y, double mu, double) const
+    {
+        return 2 * (ylog(y, mu) - (y + 1 / k) * std::log((1 + k * y) / (1 + k * mu)));
+    }
+
+    double
+    loglik(double y, double mu, double) const
+    {
+        return std::lgamma(y + 1 / k) - std::lgamma(y + 1) - std::lgamma(1 / k) -
+               std::log1p(k * mu) / k + (y == 0 ? 0 : y * std::log(k * mu / (1 + k * mu)));
+    }
+
+private:
+    double k;
+};
+
+std::unique_ptr<Family>
+make_family(const std::string &name, double param)
+{
+    if(name == "gaussian")
+        return std::unique_ptr<Family>(new GaussianFamily());
+    if(name == "binomial" || name == "bernoulli")
+        return std::unique_ptr<Family>(new BinomialFamily(name == "bernoulli"));
+    if(name == "poisson")
+        return std::unique_ptr<Family>(new PoissonFamily());
+    if(name == "gamma")
+        return std::unique_ptr<Family>(new GammaFamily());
+    if(name == "igaussian")
+        return std::unique_ptr<Family>(new InverseGaussianFamily());
+    if(name == "nbinomial")
+    {
+        if(!(param > 0))
+            Rcpp::stop("The negative binomial's dispersion must be positive");
+        return std::unique_ptr<Family>(new NegativeBinomialFamily(param));
+    }
+
+    Rcpp::stop("Unknown family: " + name);
+}
+
+//
+// The fit
+//
+
+// What one pass over the rows adds up. cross is (q + 1) x (q + 1): X'WX
+// and, in its last column, X'Wz. observed and meat, q x q, are only filled
+// in by a final pass.
+struct Sums
+{
+    double obs, sum_w, ybar, deviance, loglik, pearson;
+    std::vector<double> cross, observed, meat;
+};
+
+class Irls
+{
+public:
+    Irls(const std::vector<NumericColumn> &xs, NumericColumn y,
+         const NumericColumn *trials, const NumericColumn *offset, const int *mp,
+         const double *wp, R_xlen_t n, const Family &family, const Link &link,
+         bool constant, bool frequency)
+        : xs(xs), y(y), trials(trials), offset(offset), mp(mp), wp(wp), n(n),
+          family(family), link(link), constant(constant), frequency(frequency),
+          k(xs.size()), q(k + (constant ? 1 : 0)), ybar(0)
+    {
+        size_t p = q + 1;
+        nthreads = std::min(ado_threads_for(n, MIN_ROWS_PER_THREAD),
+                            (int) std::max(MAX_ACCUMULATED / (3 * p * p), (size_t) 1));
+    }
+
+    // The count, total weight and weighted mean of the response, which
+    // the starting values need
+    Sums
+    count() const
+    {
+        std::vector<double> obs(nthreads, 0), tw(nthreads, 0), sy(nthreads, 0);
+
+        #pragma omp parallel for schedule(static, 1) num_threads(nthreads)
+        for(int t = 0; t < nthreads; t++)
+        {
+            R_xlen_t lo = n * t / nthreads, hi = n * (t + 1) / nthreads;
+            std::vector<R_xlen_t> rows;
+            std::vector<double> wts;
+
+            for(R_xlen_t c = lo; c < hi; c += CHUNK_ROWS)
+            {
+                usable_rows(c, std::min(c + (R_xlen_t) CHUNK_ROWS, hi), rows, wts);
+                for(size_t r = 0; r < rows.size(); r++)
+                {
+                    obs[t]++;
+                    tw[t] += wts[r];
+                    sy[t] += wts[r] * family.response(y.value(rows[r])) / trials_of(rows[r]);
+                }
+            }
+        }
+
+        Sums s = Sums();
+        for(int t = 0; t < nthreads; t++)
+        {
+            s.obs += obs[t];
+            s.sum_w += tw[t];
+            s.ybar += sy[t];
+        }
+        s.ybar = s.sum_w > 0 ? s.ybar / s.sum_w : 0;
+
+        return s;
+    }
+
+    void set_ybar(double yb) { ybar = yb; }
+
+    // One pass at coefficients b (the constant last), or from the family's
+    // starting means if b is empty. With final, also the observed
+    // information and, with robust, the meat of the sandwich.
+    Sums
+    pass(const std::vector<double> &b, bool final, bool robust) const
+    {
+        size_t p = q + 1, pp = p * p, qq = q * q;
+        std::vector<double> cross(nthreads * pp, 0);
+        std::vector<double> observed(final ? nthreads * qq : 0, 0);
+        std::vector<double> meat(final && robust ? nthreads * qq : 0, 0);
+        std::vector<double> dev(nthreads, 0), ll(nthreads, 0), chi2(nthreads, 0);
+        bool from_start = b.empty();
+
+        #pragma omp parallel for schedule(static, 1) num_threads(nthreads)
+        for(int t = 0; t < nthreads; t++)
+        {
+            R_xlen_t lo = n * t / nthreads, hi = n * (t + 1) / nthreads;
+            size_t ld = CHUNK_ROWS;
+            std::vector<R_xlen_t> rows;
+            std::vector<double> wts, cols(p * ld), wcols(p * ld);
+            std::vector<double> ocols(final ? q * ld : 0), scols(final && robust ? q * ld : 0);
+
+            for(R_xlen_t c = lo; c < hi; c += CHUNK_ROWS)
+            {
+                usable_rows(c, std::min(c + (R_xlen_t) CHUNK_ROWS, hi), rows, wts);
+                size_t nr = rows.size();
+                if(nr == 0)
+                    continue;
+
+                for(size_t r = 0; r < nr; r++)
+                {
+                    R_xlen_t i = rows[r];
+                    double yi = family.response(y.value(i)), ni = trials_of(i);
+                    double off = offset == NULL ? 0 : offset->value(i);
+
+                    double eta = off;
+                    for(size_t j = 0; j < k; j++)
+                    {
+                        cols[j * ld + r] = xs[j].value(i);
+                        if(!from_start)
+                            eta += b[j] * cols[j * ld + r];
+                    }
+                    if(constant)
+                    {
+                        cols[k * ld + r] = 1;
+                        if(!from_start)
+                            eta += b[k];
+                    }
+                    if(from_start)
+                        eta = link.eta(family.start(yi, ybar, ni) / ni);
+
+                    double mu = family.fitted(ni * link.mu(eta), ni);
+                    double dmu = ni * link.dmu(eta), v = family.variance(mu, ni);
+                    double we = wts[r] * dmu * dmu / v, z = eta - off + (yi - mu) / dmu;
+
+                    // A row that has no say in the step, where the mean is
+                    // flat in eta
+                    if(!std::isfinite(we) || !std::isfinite(z))
+                        we = z = 0;
+
+                    dev[t] += wts[r] * family.deviance(yi, mu, ni);
+                    ll[t] += wts[r] * family.loglik(yi, mu, ni);
+                    chi2[t] += wts[r] * (yi - mu) * (yi - mu) / v;
+
+                    cols[q * ld + r] = z;
+                    for(size_t j = 0; j < p; j++)
+                        wcols[j * ld + r] = we * cols[j * ld + r];
+
+                    if(!final)
+                        continue;
+
+                    // The observed information has the expected, less
+                    // (y - mu) times the derivative of dmu / v in eta
+                    double g = dmu / v;
+                    double dg = (ni * link.d2mu(eta) * v -
+                                 dmu * dmu * family.dvariance(mu, ni)) / (v * v);
+                    double wo = wts[r] * (dmu * g - (yi - mu) * dg);
+                    if(!std::isfinite(wo))
+                        wo = 0;
+                    for(size_t j = 0; j < q; j++)
+                        ocols[j * ld + r] = wo * cols[j * ld + r];
+
+                    if(robust)
+                    {
+                        double s = (yi - mu) * g;
+                        double u2 = (frequency ? 1 : wts[r]) * wts[r] * s * s;
+                        if(!std::isfinite(u2))
+                            u2 = 0;
+                        for(size_t j = 0; j < q; j++)
+                            scols[j * ld + r] = u2 * cols[j * ld + r];
+                    }
+                }
+
+                cross_add(&wcols[0], p, &cols[0], p, ld, nr, &cross[t * pp], true);
+                if(final && q > 0)
+                    cross_add(&ocols[0], q, &cols[0], q, ld, nr, &observed[t * qq], true);
+                if(final && robust && q > 0)
+                    cross_add(&scols[0], q, &cols[0], q, ld, nr, &meat[t * qq], true);
+            }
+        }
+
+        Sums s = Sums();
+        s.cross = add_up(cross, p);
+        if(final)
+            s.observed = add_up(observed, q);
+        if(final && robust)
+            s.meat = add_up(meat, q);
+        for(int t = 0; t < nthreads; t++)
+        {
+            s.deviance += dev[t];
+            s.loglik += ll[t];
+            s.pearson += chi2[t];
+        }
+
+        return s;
+    }
+
+    int threads() const { return nthreads; }
+
+private:
+    const std::vector<NumericColumn> &xs;
+    NumericColumn y;
+    const NumericColumn *trials, *offset;
+    const int *mp;
+    const double *wp;
+    R_xlen_t n;
+    const Family &family;
+    const Link &link;
+    bool constant, frequency;
+    size_t k, q;
+    double ybar;
+    int nthreads;
+
+    double
+    trials_of(R_xlen_t i) const
+    {
+        return trials == NULL ? 1 : trials->value(i);
+    }
+
+    // The rows of [lo, hi) the fit uses, and their weights
+    void
+    usable_rows(R_xlen_t lo, R_xlen_t hi, std::vector<R_xlen_t> &rows,
+                std::vector<double> &wts) const
+    {
+        rows.clear();
+        wts.clear();
+
+        for(R_xlen_t i = lo; i < hi; i++)
+        {
+            double wt = weight_of(wp, i);
+            if(!selected(mp, i) || wt == 0 || std::isnan(y.value(i)))
+                continue;
+            if(trials != NULL && std::isnan(trials->value(i)))
+                continue;
+            if(offset != NULL && std::isnan(offset->value(i)))
+                continue;
+
+            bool complete = true;
+            for(size_t j = 0; j < k && complete; j++)
+                complete = !std::isnan(xs[j].value(i));
+
+            if(complete)
+            {
+                rows.push_back(i);
+                wts.push_back(wt);
+            }
+        }
+    }
+
+    // The threads' p x p accumulators added up in order, and made symmetric
+    std::vector<double>
+    add_up(const std::vector<double> &acc, size_t p) const
+    {
+        std::vector<double> ret(p * p, 0);
+        for(int t = 0; t < nthreads; t++)
+            for(size_t h = 0; h < p * p; h++)
+                ret[h] += acc[t * p * p + h];
+        if(p > 0)
+            symmetrize(&ret[0], p);
+
+        return ret;
+    }
+};
+
+} // namespace
+
+// Fit the generalized linear model of the numeric vector y on the numeric
+// columns x by IRLS, over the rows mask selects (every row if it's NULL)
+// with no missing values and nonzero weights, weighted by weights (if not
+// NULL). family and link name the model ("bernoulli" is the binomial
+// family with y taken as whether it's nonzero), family_param is the
+// negative binomial's dispersion and link_param the power link's
+// exponent. trials, for the binomial, and offset, added to the linear
+// predictor, are numeric vectors or NULL. start, if not empty, has the
+// coefficients to start from, the constant last; control has iterate,
+// tolerance and ltolerance, as for Stata's ml, and vce, which is "oim",
+// "eim" or "robust", and frequency, whether the weights are fweights.
+//
+// Returns a list: b, the coefficients, the constant (if any) last and 0
+// for the ones omitted, which omitted says; inv, the inverse of the
+// information (observed or expected as vce asks) and robust, with vce
+// robust, the sandwich made with that inverse; obs, sum_w, deviance,
+// pearson, loglik (NA if the family doesn't give it), the deviance and log
+// likelihood at each iteration, iterations, converged, rank, and with
+// null_model, loglik_0, the log likelihood of the model with only the
+// constant over the same rows.
+// [[Rcpp::export]]
+Rcpp::List
+irls_fit(Rcpp::List x, SEXP y, SEXP mask, SEXP weights, SEXP trials, SEXP offset,
+         std::string family, std::string link, double family_param,
+         double link_param, Rcpp::NumericVector start, bool constant,
+         bool null_model, Rcpp::List control)
+{
+    size_t k = (size_t) x.size(), q = k + (constant ? 1 : 0);
+    R_xlen_t n = Rf_xlength(y);
+
+    std::vector<NumericColumn> xs(k);
+    for(size_t j = 0; j < k; j++)
+        xs[j] = numeric_column(x[j], n, "An independent variable");
+    NumericColumn yc = numeric_column(y, n, "The dependent variable");
+    NumericColumn tc = NumericColumn(), oc = NumericColumn();
+    if(!Rf_isNull(trials))
+        tc = numeric_column(trials, n, "The number of trials");
+    if(!Rf_isNull(offset))
+        oc = numeric_column(offset, n, "The offset");
+
+    if(!Rf_isNull(mask) && (TYPEOF(mask) != LGLSXP || Rf_xlength(mask) != n))
+        Rcpp::stop("Mask must be a logical vector with one element per row");
+    if(!Rf_isNull(weights) && (TYPEOF(weights) != REALSXP || Rf_xlength(weights) != n))
+        Rcpp::stop("Weights must be a double vector with one element per row");
+    if(start.size() != 0 && (size_t) start.size() != q)
+        Rcpp::stop("Starting values must have one element per coefficient");
+
+    int maxiter = Rcpp::as<int>(control["iterate"]);
+    double tol = Rcpp::as<double>(control["tolerance"]);
+    double ltol = Rcpp::as<double>(control["ltolerance"]);
+    std::string vce = Rcpp::as<std::string>(control["vce"]);
+    bool frequency = Rcpp::as<bool>(control["frequency"]);
+    bool robust = vce == "robust";
+
+    std::unique_ptr<Family> fam = make_family(family, family_param);
+    std::unique_ptr<Link> lnk = make_link(link, link_param);
+
+    const int *mp = Rf_isNull(mask) ? NULL : LOGICAL(mask);
+    const double *wp = Rf_isNull(weights) ? NULL : REAL(weights);
+    Irls fit(xs, yc, Rf_isNull(trials) ? NULL : &tc, Rf_isNull(offset) ? NULL : &oc,
+             mp, wp, n, *fam, *lnk, constant, frequency);
+
+    Sums counts = fit.count();
+    if(counts.obs == 0)
+        Rcpp::stop("No observations");
+    fit.set_ybar(counts.ybar);
+
+    // The variables are taken in order for collinearity with the constant
+    // first, so that it's the one kept, as in Stata
+    std::vector<size_t> order;
+    if(constant)
+        order.push_back(k);
+    for(size_t j = 0; j < k; j++)
+        order.push_back(j);
+
+    std::vector<bool> omitted(q, false);
+    std::vector<double> b(start.begin(), start.end()), prev, inv;
+    std::vector<double> log_dev, log_ll;
+    double prev_dev = NAN;
+    int iter = 0, halvings = 0;
+    bool converged = false;
+    Sums s;
+
+    while(true)
+    {
+        s = fit.pass(b, false, false);
+
+        // A step that makes the deviance worse, or leaves it undefined, is
+        // halved back toward where it came from
+        if(!prev.empty() && halvings < MAX_HALVINGS &&
+           (!std::isfinite(s.deviance) || s.deviance > prev_dev * (1 + 1e-12)))
+        {
+            for(size_t j = 0; j < q; j++)
+                b[j] = (b[j] + prev[j]) / 2;
+            halvings++;
+            continue;
+        }
+        // The starting means can be outside the link's range for some rows
+        // (negative, say, for a log link with a gaussian family), which are
+        // left out of the first step; a fitted deviance has to be finite
+        if(!b.empty() && !std::isfinite(s.deviance))
+            Rcpp::stop("The deviance is not finite; the model may not fit these data");
+
+        log_dev.push_back(s.deviance);
+        log_ll.push_back(s.loglik);
+
+        if(!prev.empty())
+        {
+            double bdif = 0;
+            for(size_t j = 0; j < q; j++)
+                bdif = std::max(bdif, reldif(b[j], prev[j]));
+
+            if(bdif < tol && reldif(s.deviance, prev_dev) < ltol)
+            {
+                converged = true;
+                break;
+            }
+        }
+        if(iter >= maxiter)
+            break;
+
+        std::vector<double> step;
+        solve_in_order(&s.cross[0], q + 1, &s.cross[q * (q + 1)], order, COLLINEAR_TOL,
+                       omitted, step, inv);
+
+        // Without a start, the first pass's weights come from the starting
+        // means, and prev stays empty: there's nothing to halve back to
+        prev = b;
+        prev_dev = s.deviance;
+        b = step;
+        halvings = 0;
+        iter++;
+    }
+
+    // The information at the estimates, and the robust variance with it
+    Sums fin = fit.pass(b, true, robust);
+    const std::vector<double> &info = vce == "eim" ? fin.cross : fin.observed;
+    std::vector<double> unused;
+    solve_in_order(&info[0], vce == "eim" ? q + 1 : q, NULL, order, COLLINEAR_TOL,
+                   omitted, unused, inv);
+
+    size_t rank = 0;
+    for(size_t j = 0; j < q; j++)
+        if(omitted[j])
+            b[j] = 0;
+        else
+            rank++;
+
+    Rcpp::NumericMatrix invm(q, q);
+    for(size_t i = 0; i < q; i++)
+        for(size_t j = 0; j < q; j++)
+            invm(i, j) = inv[i * q + j];
+
+    Rcpp::List ret = Rcpp::List::create(
+        Rcpp::Named("b") = Rcpp::NumericVector(b.begin(), b.end()),
+        Rcpp::Named("omitted") = Rcpp::LogicalVector(omitted.begin(), omitted.end()),
+        Rcpp::Named("inv") = invm,
+        Rcpp::Named("obs") = counts.obs,
+        Rcpp::Named("sum_w") = counts.sum_w,
+        Rcpp::Named("deviance") = fin.deviance,
+        Rcpp::Named("pearson") = fin.pearson,
+        Rcpp::Named("loglik") = std::isnan(fin.loglik) ? NA_REAL : fin.loglik,
+        Rcpp::Named("log_deviance") = Rcpp::NumericVector(log_dev.begin(), log_dev.end()),
+        Rcpp::Named("log_loglik") = Rcpp::NumericVector(log_ll.begin(), log_ll.end()),
+        Rcpp::Named("iterations") = iter,
+        Rcpp::Named("converged") = converged,
+        Rcpp::Named("rank") = (double) rank);
+
+    if(robust)
+    {
+        // inv meat inv
+        std::vector<double> left(q * q, 0);
+        Rcpp::NumericMatrix sandwich(q, q);
+        for(size_t i = 0; i < q; i++)
+            for(size_t j = 0; j < q; j++)
+                for(size_t h = 0; h < q; h++)
+                    left[i * q + j] += inv[i * q + h] * fin.meat[h * q + j];
+        for(size_t i = 0; i < q; i++)
+            for(size_t j = 0; j < q; j++)
+                for(size_t h = 0; h < q; h++)
+                    sandwich(i, j) += left[i * q + h] * inv[h * q + j];
+
+        ret["robust"] = sandwich;
+    }
+
+    if(null_model && constant)
+    {
+        // The constant-only model, over the same rows: the same fit with
+        // the variables there only to pick the rows out
+        std::vector<double> b0(q, 0), prev0;
+        double dev0 = NAN;
+        std::vector<bool> om0(q, true);
+        om0[k] = false;
+        std::vector<double> inv0;
+        Sums s0 = fit.pass(std::vector<double>(), false, false);
+
+        for(int it = 0; it <= maxiter; it++)
+        {
+            std::vector<double> step;
+            solve_in_order(&s0.cross[0], q + 1, &s0.cross[q * (q + 1)], order, COLLINEAR_TOL,
+                           om0, step, inv0);
+            b0 = step;
+            s0 = fit.pass(b0, false, false);
+
+            if(reldif(s0.deviance, dev0) < ltol && (prev0.empty() ||
+               reldif(b0[k], prev0[k]) < tol))
+                break;
+            dev0 = s0.deviance;
+            prev0 = b0;
+        }
+
+        ret["loglik_0"] = std::isnan(s0.loglik) ? NA_REAL : s0.loglik;
+        ret["deviance_0"] = s0.deviance;
+    }
+
+    return ret;
+}
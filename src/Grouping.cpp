@@ -0,0 +1,216 @@
+#include <cstdint>
+#include <vector>
+
+#include "Grouping.hpp"
+#include "Hashing.hpp"
+#include "Parallel.hpp"
+
+std::vector<uint64_t>
+hash_rows(const KeyColumns &keys, int nthreads)
+{
+    size_t n = keys.nrow();
+    std::vector<uint64_t> hashes(n);
+
+    #pragma omp parallel for num_threads(nthreads)
+    for(R_xlen_t i = 0; i < (R_xlen_t) n; i++)
+        hashes[i] = keys.hash(i);
+
+    return hashes;
+}
+
+HashPartitions
+partition_by_hash(const std::vector<uint64_t> &hashes, int nthreads)
+{
+    size_t n = hashes.size();
+    HashPartitions ret;
+
+    // A power of two at least the thread count, taken from the high bits
+    // of the hashes because hash tables use the low ones
+    ret.shift = 64;
+    while((1 << (64 - ret.shift)) < nthreads)
+        ret.shift--;
+    int nparts = 1 << (64 - ret.shift);
+
+    // Count per block of rows so the scatter needs no locking; block t is
+    // rows n*t/nthreads up to n*(t+1)/nthreads in both passes, whichever
+    // thread runs it
+    std::vector<std::vector<size_t> > counts(nthreads, std::vector<size_t>(nparts, 0));
+
+    #pragma omp parallel for schedule(static, 1) num_threads(nthreads)
+    for(int t = 0; t < nthreads; t++)
+    {
+        R_xlen_t lo = (R_xlen_t) (n * t / nthreads), hi = (R_xlen_t) (n * (t + 1) / nthreads);
+        for(R_xlen_t i = lo; i < hi; i++)
+            counts[t][ret.part_of(hashes[i])]++;
+    }
+
+    // Offsets: partition-major, then block, so that each partition's rows
+    // come out in ascending order
+    ret.starts.assign(nparts + 1, 0);
+    std::vector<std::vector<size_t> > pos(nthreads, std::vector<size_t>(nparts, 0));
+
+    size_t off = 0;
+    for(int p = 0; p < nparts; p++)
+    {
+        ret.starts[p] = off;
+        for(int t = 0; t < nthreads; t++)
+        {
+            pos[t][p] = off;
+            off += counts[t][p];
+        }
+    }
+    ret.starts[nparts] = off;
+
+    ret.rows.resize(n);
+
+    #pragma omp parallel for schedule(static, 1) num_threads(nthreads)
+    for(int t = 0; t < nthreads; t++)
+    {
+        R_xlen_t lo = (R_xlen_t) (n * t / nthreads), hi = (R_xlen_t) (n * (t + 1) / nthreads);
+        for(R_xlen_t i = lo; i < hi; i++)
+            ret.rows[pos[t][ret.part_of(hashes[i])]++] = (uint32_t) i;
+    }
+
+    return ret;
+}
+
+namespace {
+
+Groups
+find_groups_serial(const KeyColumns &keys)
+{
+    size_t n = keys.nrow();
+
+    Groups ret;
+    ret.id.resize(n);
+
+    RowTable table(n);
+    std::vector<int> slot_group(table.capacity(), -1);
+
+    for(size_t i = 0; i < n; i++)
+    {
+        bool inserted;
+        size_t slot = table.insert((int64_t) i, keys.hash(i),
+                                   [&keys](int64_t a, int64_t b) { return keys.equal(a, b); },
+                                   &inserted);
+
+        if(inserted)
+        {
+            slot_group[slot] = (int) ret.first.size();
+            ret.first.push_back(i);
+        }
+
+        ret.id[i] = slot_group[slot];
+    }
+
+    return ret;
+}
+
+} // namespace
+
+Groups
+find_groups(const KeyColumns &keys, int nthreads)
+{
+    size_t n = keys.nrow();
+    if(nthreads <= 1 || n > UINT32_MAX)
+        return find_groups_serial(keys);
+
+    std::vector<uint64_t> hashes = hash_rows(keys, nthreads);
+    HashPartitions parts = partition_by_hash(hashes, nthreads);
+    int nparts = parts.count();
+
+    // Number the groups within each partition; id temporarily holds these
+    // partition-local numbers
+    Groups ret;
+    ret.id.resize(n);
+
+    std::vector<std::vector<size_t> > firsts(nparts);
+    std::vector<char> is_first(n, 0);
+
+    #pragma omp parallel for schedule(dynamic) num_threads(nthreads)
+    for(int p = 0; p < nparts; p++)
+    {
+        RowTable table(parts.starts[p + 1] - parts.starts[p]);
+        std::vector<int> slot_group(table.capacity(), -1);
+
+        for(size_t k = parts.starts[p]; k < parts.starts[p + 1]; k++)
+        {
+            size_t i = parts.rows[k];
+
+            bool inserted;
+            size_t slot = table.insert((int64_t) i, hashes[i],
+                                       [&keys](int64_t a, int64_t b) { return keys.equal(a, b); },
+                                       &inserted);
+
+            if(inserted)
+            {
+                slot_group[slot] = (int) firsts[p].size();
+                firsts[p].push_back(i);
+                is_first[i] = 1;
+            }
+
+            ret.id[i] = slot_group[slot];
+        }
+    }
+
+    // Renumber in order of first appearance across all partitions
+    std::vector<std::vector<int> > global(nparts);
+    for(int p = 0; p < nparts; p++)
+        global[p].resize(firsts[p].size());
+
+    for(size_t i = 0; i < n; i++)
+    {
+        if(is_first[i])
+        {
+            global[parts.part_of(hashes[i])][ret.id[i]] = (int) ret.first.size();
+            ret.first.push_back(i);
+        }
+    }
+
+    #pragma omp parallel for num_threads(nthreads)
+    for(R_xlen_t i = 0; i < (R_xlen_t) n; i++)
+        ret.id[i] = global[parts.part_of(hashes[i])][ret.id[i]];
+
+    return ret;
+}
+
+Groups
+groups_from_ids(const int *ids, size_t n, size_t ngroups)
+{
+    Groups ret;
+    ret.id.resize(n);
+    ret.first.assign(ngroups + 1, n);
+
+    for(size_t i = 0; i < n; i++)
+    {
+        int g = ids[i] > 0 && (size_t) ids[i] <= ngroups ? ids[i] - 1 : (int) ngroups;
+
+        ret.id[i] = g;
+        if(ret.first[g] == n)
+            ret.first[g] = i;
+    }
+
+    return ret;
+}
+
+GroupRuns
+group_runs(const Groups &groups)
+{
+    size_t n = groups.id.size(), ngroups = groups.count();
+
+    GroupRuns ret;
+    ret.starts.assign(ngroups + 1, 0);
+    ret.rows.resize(n);
+
+    for(size_t i = 0; i < n; i++)
+        ret.starts[groups.id[i] + 1]++;
+    for(size_t g = 0; g < ngroups; g++)
+        ret.starts[g + 1] += ret.starts[g];
+
+    // A counting sort, stable, so each run is in row order
+    std::vector<size_t> pos(ret.starts.begin(), ret.starts.end() - 1);
+    for(size_t i = 0; i < n; i++)
+        ret.rows[pos[groups.id[i]]++] = i;
+
+    return ret;
+}
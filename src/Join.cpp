@@ -0,0 +1,231 @@
+#include <climits>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include <Rcpp.h>
+#include "Columns.hpp"
+#include "Hashing.hpp"
+#include "Parallel.hpp"
+
+/*
+ * The row matching behind merge: given the key columns of the master and
+ * using datasets, list the pairs of rows to put together. If both sides
+ * are already in key order, one linear pass merges them and the pairs come
+ * out in key order too. Otherwise the smaller side goes into a hash table
+ * and the rows of the larger side look themselves up in it, in parallel.
+ *
+ * Uniqueness of the keys isn't checked here; merge does that up front
+ * (see key_status), and this works with duplicates on both sides anyway.
+ */
+
+namespace {
+
+// Each thread should get at least this many rows to probe
+const size_t MIN_ROWS_PER_THREAD = 1 << 15;
+
+bool
+is_sorted(const KeyColumns &keys)
+{
+    for(size_t i = 1; i < keys.nrow(); i++)
+        if(keys.compare(i - 1, keys, i) > 0)
+            return false;
+
+    return true;
+}
+
+// Pairs of row numbers, from 1, with NA where a row has no match
+struct Pairs
+{
+    std::vector<int> master;
+    std::vector<int> using_;
+
+    void
+    add(int m, int u)
+    {
+        master.push_back(m);
+        using_.push_back(u);
+    }
+};
+
+Pairs
+merge_sorted(const KeyColumns &m, const KeyColumns &u)
+{
+    size_t nm = m.nrow(), nu = u.nrow();
+    size_t i = 0, k = 0;
+    Pairs ret;
+
+    while(i < nm || k < nu)
+    {
+        int c = i == nm ? 1 : (k == nu ? -1 : m.compare(i, u, k));
+
+        if(c < 0)
+        {
+            ret.add(i++ + 1, NA_INTEGER);
+        } else if(c > 0)
+        {
+            ret.add(NA_INTEGER, k++ + 1);
+        } else
+        {
+            // The runs of this key on each side, and their cross product
+            size_t ie = i + 1, ke = k + 1;
+            while(ie < nm && m.equal(ie, i))
+                ie++;
+            while(ke < nu && u.equal(ke, k))
+                ke++;
+
+            for(size_t a = i; a < ie; a++)
+                for(size_t b = k; b < ke; b++)
+                    ret.add(a + 1, b + 1);
+
+            i = ie;
+            k = ke;
+        }
+    }
+
+    return ret;
+}
+
+// Hash the rows of build, then find each row of probe's matches. The
+// pairs come out in probe's row order, each probe row with its matches in
+// ascending order, followed by build's unmatched rows.
+void
+hash_join(const KeyColumns &build, const KeyColumns &probe,
+          std::vector<int> &build_rows, std::vector<int> &probe_rows)
+{
+    size_t nb = build.nrow(), np = probe.nrow();
+
+    // Rows with equal keys are chained together from the first one, which
+    // is the one the table holds
+    RowTable table(nb);
+    std::vector<int64_t> next(nb, -1), slot_of(nb);
+    std::vector<int64_t> tail(table.capacity(), -1);
+    std::vector<int> size(table.capacity(), 0);
+
+    for(size_t r = 0; r < nb; r++)
+    {
+        bool inserted;
+        size_t slot = table.insert((int64_t) r, build.hash(r),
+                                   [&build](int64_t a, int64_t b) { return build.equal(a, b); },
+                                   &inserted);
+
+        if(!inserted)
+            next[tail[slot]] = r;
+        tail[slot] = r;
+        size[slot]++;
+        slot_of[r] = slot;
+    }
+
+    int nthreads = ado_threads_for(np, MIN_ROWS_PER_THREAD);
+    std::vector<int64_t> match(np);
+
+    #pragma omp parallel for num_threads(nthreads)
+    for(R_xlen_t i = 0; i < (R_xlen_t) np; i++)
+    {
+        match[i] = table.find(probe.hash(i),
+                              [&build, &probe, i](int64_t r) { return build.equal(r, probe, i); });
+    }
+
+    // Where each probe row's pairs start, and which build rows were used
+    std::vector<size_t> start(np + 1);
+    std::vector<char> used(table.capacity(), 0);
+
+    size_t total = 0;
+    for(size_t i = 0; i < np; i++)
+    {
+        start[i] = total;
+        if(match[i] >= 0)
+        {
+            total += size[match[i]];
+            used[match[i]] = 1;
+        } else
+        {
+            total++;
+        }
+    }
+    start[np] = total;
+
+    for(size_t r = 0; r < nb; r++)
+        if(!used[slot_of[r]])
+            total++;
+
+    if(total > INT_MAX)
+        throw std::runtime_error("Merge result too large");
+
+    build_rows.resize(total);
+    probe_rows.resize(total);
+
+    #pragma omp parallel for num_threads(nthreads)
+    for(R_xlen_t i = 0; i < (R_xlen_t) np; i++)
+    {
+        size_t o = start[i];
+
+        if(match[i] < 0)
+        {
+            build_rows[o] = NA_INTEGER;
+            probe_rows[o] = (int) i + 1;
+            continue;
+        }
+
+        for(int64_t r = table.row_at(match[i]); r >= 0; r = next[r], o++)
+        {
+            build_rows[o] = (int) r + 1;
+            probe_rows[o] = (int) i + 1;
+        }
+    }
+
+    size_t o = start[np];
+    for(size_t r = 0; r < nb; r++)
+    {
+        if(!used[slot_of[r]])
+        {
+            build_rows[o] = (int) r + 1;
+            probe_rows[o] = NA_INTEGER;
+            o++;
+        }
+    }
+}
+
+} // namespace
+
+// Match the rows of two datasets on their key columns, given as lists of
+// vectors in the same order. Returns a list: master and using, the paired
+// row numbers (NA for a row with no match on the other side), and sorted,
+// whether the pairs are already in key order.
+// [[Rcpp::export]]
+Rcpp::List
+join_rows(Rcpp::List master, Rcpp::List using_keys)
+{
+    KeyColumns m(master), u(using_keys);
+
+    if(m.ncol() != u.ncol() || m.ncol() == 0)
+        Rcpp::stop("Key columns don't correspond");
+
+    for(size_t j = 0; j < m.ncol(); j++)
+        if((m.column(j).kind == KEY_STR) != (u.column(j).kind == KEY_STR))
+            Rcpp::stop("Key column is a string on one side only");
+
+    if(m.nrow() > INT_MAX || u.nrow() > INT_MAX)
+        Rcpp::stop("Too many rows to merge");
+
+    std::vector<int> mrows, urows;
+    bool sorted = is_sorted(m) && is_sorted(u);
+
+    if(sorted)
+    {
+        Pairs pairs = merge_sorted(m, u);
+        mrows.swap(pairs.master);
+        urows.swap(pairs.using_);
+    } else if(m.nrow() <= u.nrow())
+    {
+        hash_join(m, u, mrows, urows);
+    } else
+    {
+        hash_join(u, m, urows, mrows);
+    }
+
+    return Rcpp::List::create(
+        Rcpp::Named("master") = Rcpp::IntegerVector(mrows.begin(), mrows.end()),
+        Rcpp::Named("using") = Rcpp::IntegerVector(urows.begin(), urows.end()),
+        Rcpp::Named("sorted") = sorted);
+}
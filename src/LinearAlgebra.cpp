@@ -0,0 +1,260 @@
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+#include "LinearAlgebra.hpp"
+
+namespace {
+
+// A kept block whose Cholesky factor leaves less than this fraction of
+// some diagonal is inverted by QR instead
+const double COND_TOL = 1e-8;
+
+// The inverse of the k x k matrix with Householder QR factors qr (R on and
+// above the diagonal, the reflectors below it) and scales tau
+std::vector<double>
+qr_inverse(const std::vector<double> &qr, const std::vector<double> &tau, size_t k)
+{
+    std::vector<double> inv(k * k, 0);
+
+    for(size_t c = 0; c < k; c++)
+    {
+        // Q'e_c, then back-substitution with R
+        std::vector<double> x(k, 0);
+        x[c] = 1;
+
+        for(size_t j = 0; j < k; j++)
+        {
+            double s = x[j];
+            for(size_t i = j + 1; i < k; i++)
+                s += qr[i * k + j] * x[i];
+            s *= tau[j];
+
+            x[j] -= s;
+            for(size_t i = j + 1; i < k; i++)
+                x[i] -= s * qr[i * k + j];
+        }
+
+        for(size_t j = k; j-- > 0; )
+        {
+            double s = x[j];
+            for(size_t i = j + 1; i < k; i++)
+                s -= qr[j * k + i] * x[i];
+            x[j] = s / qr[j * k + j];
+        }
+
+        for(size_t j = 0; j < k; j++)
+            inv[j * k + c] = x[j];
+    }
+
+    return inv;
+}
+
+} // namespace
+
+double
+cholesky_in_order(const double *a, size_t p, size_t k, const double *scale,
+                  double tol, std::vector<size_t> &kept, std::vector<double> &l)
+{
+    // The factor is built a row at a time with a stride of k, and packed
+    // down to m x m at the end
+    std::vector<double> lk;
+    double worst = 1;
+    kept.clear();
+
+    for(size_t j = 0; j < k; j++)
+    {
+        size_t m = kept.size();
+        std::vector<double> row(m + 1, 0);
+
+        for(size_t i = 0; i < m; i++)
+        {
+            double s = a[j * p + kept[i]];
+            for(size_t h = 0; h < i; h++)
+                s -= row[h] * lk[i * k + h];
+            row[i] = s / lk[i * k + i];
+        }
+
+        double d = a[j * p + j];
+        for(size_t i = 0; i < m; i++)
+            d -= row[i] * row[i];
+
+        if(!(scale[j] > 0) || !(d > tol * scale[j]))
+            continue;
+
+        worst = std::min(worst, d / scale[j]);
+        row[m] = std::sqrt(d);
+
+        lk.resize((m + 1) * k, 0);
+        for(size_t i = 0; i <= m; i++)
+            lk[m * k + i] = row[i];
+
+        kept.push_back(j);
+    }
+
+    size_t m = kept.size();
+    l.assign(m * m, 0);
+    for(size_t i = 0; i < m; i++)
+        for(size_t j = 0; j <= i; j++)
+            l[i * m + j] = lk[i * k + j];
+
+    return worst;
+}
+
+std::vector<double>
+forward_solve(const std::vector<double> &l, size_t m, std::vector<double> b)
+{
+    for(size_t i = 0; i < m; i++)
+    {
+        for(size_t h = 0; h < i; h++)
+            b[i] -= l[i * m + h] * b[h];
+        b[i] /= l[i * m + i];
+    }
+
+    return b;
+}
+
+std::vector<double>
+back_solve(const std::vector<double> &l, size_t m, std::vector<double> z)
+{
+    for(size_t i = m; i-- > 0; )
+    {
+        for(size_t h = i + 1; h < m; h++)
+            z[i] -= l[h * m + i] * z[h];
+        z[i] /= l[i * m + i];
+    }
+
+    return z;
+}
+
+std::vector<double>
+cholesky_inverse(const std::vector<double> &l, size_t m)
+{
+    // L^-1, lower triangular, then L^-T L^-1
+    std::vector<double> li(m * m, 0), inv(m * m, 0);
+    for(size_t c = 0; c < m; c++)
+    {
+        li[c * m + c] = 1 / l[c * m + c];
+        for(size_t i = c + 1; i < m; i++)
+        {
+            double s = 0;
+            for(size_t h = c; h < i; h++)
+                s += l[i * m + h] * li[h * m + c];
+            li[i * m + c] = -s / l[i * m + i];
+        }
+    }
+
+    for(size_t i = 0; i < m; i++)
+    {
+        for(size_t j = 0; j <= i; j++)
+        {
+            double s = 0;
+            for(size_t h = i; h < m; h++)
+                s += li[h * m + i] * li[h * m + j];
+            inv[i * m + j] = inv[j * m + i] = s;
+        }
+    }
+
+    return inv;
+}
+
+std::vector<double>
+inverse_by_qr(std::vector<double> a, size_t m)
+{
+    std::vector<double> tau(m, 0);
+
+    for(size_t j = 0; j < m; j++)
+    {
+        double norm = 0;
+        for(size_t i = j; i < m; i++)
+            norm += a[i * m + j] * a[i * m + j];
+        norm = std::sqrt(norm);
+        if(norm == 0)
+            continue;
+
+        double alpha = a[j * m + j] > 0 ? -norm : norm;
+        double v0 = a[j * m + j] - alpha;
+
+        // The reflector is (1, a[j+1..m-1, j] / v0), scaled by tau
+        for(size_t i = j + 1; i < m; i++)
+            a[i * m + j] /= v0;
+        tau[j] = -v0 / alpha;
+        a[j * m + j] = alpha;
+
+        for(size_t c = j + 1; c < m; c++)
+        {
+            double s = a[j * m + c];
+            for(size_t i = j + 1; i < m; i++)
+                s += a[i * m + j] * a[i * m + c];
+            s *= tau[j];
+
+            a[j * m + c] -= s;
+            for(size_t i = j + 1; i < m; i++)
+                a[i * m + c] -= s * a[i * m + j];
+        }
+    }
+
+    return qr_inverse(a, tau, m);
+}
+
+void
+solve_in_order(const double *a, size_t lda, const double *rhs,
+               const std::vector<size_t> &order, double tol,
+               std::vector<bool> &omitted, std::vector<double> &x,
+               std::vector<double> &inv)
+{
+    size_t q = order.size();
+
+    // a permuted into the order given, with the omitted variables' scales
+    // zeroed so that they stay out
+    std::vector<double> ap(q * q), scale(q);
+    for(size_t i = 0; i < q; i++)
+    {
+        for(size_t j = 0; j < q; j++)
+            ap[i * q + j] = a[order[i] * lda + order[j]];
+        scale[i] = omitted[order[i]] ? 0 : ap[i * q + i];
+    }
+
+    std::vector<size_t> kept;
+    std::vector<double> l;
+    double worst = cholesky_in_order(q > 0 ? &ap[0] : NULL, q, q,
+                                     q > 0 ? &scale[0] : NULL, tol, kept, l);
+
+    size_t m = kept.size();
+    for(size_t i = 0; i < q; i++)
+        omitted[order[i]] = true;
+    for(size_t i = 0; i < m; i++)
+        omitted[order[kept[i]]] = false;
+
+    std::vector<double> inv_kept, xk(m, 0), rk(m, 0);
+    if(rhs != NULL)
+        for(size_t i = 0; i < m; i++)
+            rk[i] = rhs[order[kept[i]]];
+
+    if(m > 0 && worst < COND_TOL)
+    {
+        std::vector<double> ak(m * m);
+        for(size_t i = 0; i < m; i++)
+            for(size_t j = 0; j < m; j++)
+                ak[i * m + j] = ap[kept[i] * q + kept[j]];
+
+        inv_kept = inverse_by_qr(ak, m);
+        for(size_t i = 0; i < m; i++)
+            for(size_t j = 0; j < m; j++)
+                xk[i] += inv_kept[i * m + j] * rk[j];
+    } else if(m > 0)
+    {
+        inv_kept = cholesky_inverse(l, m);
+        xk = back_solve(l, m, forward_solve(l, m, rk));
+    }
+
+    x.assign(q, 0);
+    inv.assign(q * q, 0);
+    for(size_t i = 0; i < m; i++)
+    {
+        x[order[kept[i]]] = xk[i];
+        for(size_t j = 0; j < m; j++)
+            inv[order[kept[i]] * q + order[kept[j]]] = inv_kept[i * m + j];
+    }
+}
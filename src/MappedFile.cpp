@@ -0,0 +1,104 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+
+#include "MappedFile.hpp"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(std::string path)
+    : buf(NULL), len(0), mapped(false)
+{
+#ifndef _WIN32
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0)
+        throw std::runtime_error("Cannot open file " + path);
+
+    struct stat st;
+    if(fstat(fd, &st) != 0)
+    {
+        close(fd);
+        throw std::runtime_error("Cannot stat file " + path);
+    }
+
+    len = (size_t) st.st_size;
+    if(len > 0)
+    {
+        void *p = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(p == MAP_FAILED)
+        {
+            close(fd);
+            throw std::runtime_error("Cannot map file " + path);
+        }
+
+        buf = (const char *) p;
+        mapped = true;
+    }
+
+    // the mapping stays valid after the descriptor is closed
+    close(fd);
+#else
+    FILE *fp = fopen(path.c_str(), "rb");
+    if(fp == NULL)
+        throw std::runtime_error("Cannot open file " + path);
+
+    fseek(fp, 0, SEEK_END);
+    long sz = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    if(sz > 0)
+    {
+        char *p = (char *) malloc((size_t) sz);
+        if(p == NULL || fread(p, 1, (size_t) sz, fp) != (size_t) sz)
+        {
+            free(p);
+            fclose(fp);
+            throw std::runtime_error("Cannot read file " + path);
+        }
+
+        buf = p;
+        len = (size_t) sz;
+    }
+
+    fclose(fp);
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+    if(buf == NULL)
+        return;
+
+#ifndef _WIN32
+    if(mapped)
+        munmap((void *) buf, len);
+#else
+    free((void *) buf);
+#endif
+}
+
+void
+MappedFile::willneed(size_t offset, size_t n) const
+{
+#if !defined(_WIN32) && defined(MADV_WILLNEED)
+    if(!mapped || offset >= len)
+        return;
+
+    // madvise wants a page-aligned start address
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t start = offset - (offset % page);
+    size_t end = std::min(offset + n, len);
+
+    madvise((void *) (buf + start), end - start, MADV_WILLNEED);
+#else
+    (void) offset;
+    (void) n;
+#endif
+}
@@ -0,0 +1,1000 @@
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <Rcpp.h>
+#include "CrossProducts.hpp"
+#include "LinearAlgebra.hpp"
+#include "NumericColumns.hpp"
+#include "Parallel.hpp"
+
+/*
+ * Maximum likelihood by Newton-Raphson, for the estimators that don't fit
+ * in the IRLS framework of Glm.cpp: nbreg, gnbreg and ologit. A model is a
+ * list of equations, each a linear combination of its own variables and
+ * maybe a constant, and a Kernel, which gives one row's log likelihood and
+ * its first and second derivatives in the equations' linear predictors,
+ * as Stata's lf2 evaluators do; adding an estimator means writing a
+ * Kernel and a line in make_kernel().
+ *
+ * Each evaluation is one parallel pass over the rows: every thread takes
+ * a chunk of rows at a time, calls the kernel on each, and adds the
+ * gradient and, a pair of equations at a time, the Hessian (and, when
+ * they're wanted, the outer products of the scores) to its own
+ * accumulators with cross_add() (see CrossProducts.hpp). The accumulators
+ * are added up in order, so the result doesn't depend on the number of
+ * threads.
+ *
+ * The step is solved for by solve_in_order() (see LinearAlgebra.hpp) with
+ * the negative Hessian, or, where that isn't positive definite ("not
+ * concave"), with the outer product of the gradients, as BHHH does; the
+ * bhhh and bfgs techniques use that, or the BFGS update of it, at every
+ * step. A step that doesn't raise the log likelihood is halved ("backed
+ * up"). The iterations stop, as Stata's ml does, when the scaled gradient
+ * g'(-H)^-1 g is within nrtolerance and either the coefficients or the
+ * log likelihood have stopped changing, relative to tolerance and
+ * ltolerance.
+ */
+
+namespace {
+
+// Each thread should get at least this many rows
+const R_xlen_t MIN_ROWS_PER_THREAD = 1 << 14;
+
+// Rows gathered into a buffer at a time
+const size_t CHUNK_ROWS = 256;
+
+// The threads' accumulators together hold at most this many doubles
+const size_t MAX_ACCUMULATED = (size_t) 1 << 24;
+
+// A variable is collinear with the ones before it in its equation if less
+// than this fraction of its sum of squares is left after taking them out,
+// and the Hessian is not concave if less than this fraction of some
+// diagonal is left in its Cholesky factor
+const double COLLINEAR_TOL = 1e-13;
+
+// How many times a step that doesn't raise the log likelihood is halved
+const int MAX_HALVINGS = 20;
+
+// What the iteration log notes about an iteration
+const int NOT_CONCAVE = 1;
+const int BACKED_UP = 2;
+
+// The digamma and trigamma functions, by recurrence up to where their
+// asymptotic series are accurate; the kernels are evaluated inside
+// parallel regions, where R's can't be called
+double
+digamma(double x)
+{
+    double ret = 0;
+    for(; x < 6; x++)
+        ret -= 1 / x;
+
+    double f = 1 / (x * x);
+    return ret + std::log(x) - 0.5 / x -
+           f * (1.0 / 12 - f * (1.0 / 120 - f * (1.0 / 252 - f * (1.0 / 240 - f / 132))));
+}
+
+double
+trigamma(double x)
+{
+    double ret = 0;
+    for(; x < 6; x++)
+        ret += 1 / (x * x);
+
+    double f = 1 / (x * x);
+    return ret + 1 / x + f / 2 + f / x * (1.0 / 6 - f * (1.0 / 30 - f * (1.0 / 42 - f / 30)));
+}
+
+// lgamma(m + y) - lgamma(m), and the same differences of the digamma and
+// trigamma functions. They're summed term by term where y is a small
+// whole number, as counts usually are, which keeps them accurate for the
+// large m of a nearly Poisson negative binomial.
+struct GammaDifferences
+{
+    double lg, dg, tg;
+
+    GammaDifferences(double m, double y) : lg(0), dg(0), tg(0)
+    {
+        if(y == std::floor(y) && y < 1000)
+        {
+            for(double j = 0; j < y; j++)
+            {
+                lg += std::log(m + j);
+                dg += 1 / (m + j);
+                tg -= 1 / ((m + j) * (m + j));
+            }
+        } else
+        {
+            lg = std::lgamma(m + y) - std::lgamma(m);
+            dg = digamma(m + y) - digamma(m);
+            tg = trigamma(m + y) - trigamma(m);
+        }
+    }
+};
+
+inline double
+logistic(double x)
+{
+    return 1 / (1 + std::exp(-x));
+}
+
+//
+// Kernels
+//
+
+// One row's contribution to the log likelihood, as a function of the
+// linear predictors eta of the model's equations: evaluate() returns it,
+// for the response y, and if g isn't NULL puts its gradient in eta in g
+// and its Hessian, e x e and row-major for e equations, in h
+class Kernel
+{
+public:
+    virtual ~Kernel() {}
+
+    // Can y be the response?
+    virtual bool valid(double) const { return true; }
+
+    // Are the variables of equation e collinear with a constant, though
+    // it has none? They are for the first equation of an ordered model,
+    // whose cutpoints take the constant's place.
+    virtual bool implied_constant(size_t) const { return false; }
+
+    virtual double evaluate(double y, const double *eta, double *g, double *h) const = 0;
+};
+
+// The negative binomial, with the mean exp(eta[0]) and the log of the
+// dispersion, ln alpha, as eta[1], so the variance is mu + alpha mu^2
+// (Stata's dispersion(mean)). nbreg has only a constant for ln alpha, and
+// gnbreg a linear combination of variables.
+class NegativeBinomialKernel : public Kernel
+{
+public:
+    bool valid(double y) const { return y >= 0; }
+
+    double
+    evaluate(double y, const double *eta, double *g, double *h) const
+    {
+        double mu = std::exp(eta[0]), alpha = std::exp(eta[1]), m = 1 / alpha;
+        double denom = 1 + alpha * mu, l1p = std::log1p(alpha * mu);
+        GammaDifferences gd(m, y);
+
+        double ll = gd.lg - std::lgamma(y + 1) - (m + y) * l1p + y * (eta[0] + eta[1]);
+        if(g == NULL)
+            return ll;
+
+        // With t = m (ln(1 + alpha mu) - (digamma(m + y) - digamma(m))),
+        // d ll / d ln alpha = t + (y - mu) / (1 + alpha mu)
+        double r = (y - mu) / denom, t = m * (l1p - gd.dg);
+        g[0] = r;
+        g[1] = t + r;
+
+        h[0] = -mu * (1 + alpha * y) / (denom * denom);
+        h[1] = h[2] = -r * alpha * mu / denom;
+        h[3] = -t + m * m * gd.tg + mu / denom + h[1];
+
+        return ll;
+    }
+};
+
+// The ordered logit: eta[0] is x'b, and eta[1] to eta[k - 1] the cutpoints
+// between the k outcomes, which are given in order. The probability of the
+// j-th outcome is F(cut_j+1 - x'b) - F(cut_j - x'b), for F the logistic
+// distribution function, with cut_0 = -Inf and cut_k = Inf.
+class OrderedLogitKernel : public Kernel
+{
+public:
+    explicit OrderedLogitKernel(const std::vector<double> &outcomes)
+        : outcomes(outcomes) {}
+
+    bool
+    valid(double y) const
+    {
+        return std::binary_search(outcomes.begin(), outcomes.end(), y);
+    }
+
+    bool implied_constant(size_t e) const { return e == 0; }
+
+    double
+    evaluate(double y, const double *eta, double *g, double *h) const
+    {
+        size_t e = outcomes.size(), j = outcome_of(y);
+        bool has_hi = j + 1 < e, has_lo = j > 0;
+        double hi = has_hi ? eta[j + 1] - eta[0] : INFINITY;
+        double lo = has_lo ? eta[j] - eta[0] : -INFINITY;
+
+        // The difference of the upper tails where it's the smaller, so the
+        // probability of a high outcome doesn't lose its digits
+        double p = lo > 0 ? logistic(-lo) - logistic(-hi) : logistic(hi) - logistic(lo);
+        if(!(p > 0))
+            return -INFINITY;
+        if(g == NULL)
+            return std::log(p);
+
+        // The densities at the two ends, and their derivatives
+        double fa = has_hi ? logistic(hi) * logistic(-hi) : 0;
+        double fb = has_lo ? logistic(lo) * logistic(-lo) : 0;
+        double da = has_hi ? fa * (logistic(-hi) - logistic(hi)) : 0;
+        double db = has_lo ? fb * (logistic(-lo) - logistic(lo)) : 0;
+
+        // Derivatives of ln p in hi and lo; x'b moves both the other way
+        double ga = fa / p, gb = -fb / p;
+        double gaa = da / p - ga * ga, gbb = -db / p - gb * gb, gab = -ga * gb;
+
+        std::fill(g, g + e, 0.0);
+        std::fill(h, h + e * e, 0.0);
+        g[0] = -(ga + gb);
+        h[0] = gaa + 2 * gab + gbb;
+        if(has_hi)
+        {
+            g[j + 1] = ga;
+            h[(j + 1) * e + j + 1] = gaa;
+            h[j + 1] = h[(j + 1) * e] = -(gaa + gab);
+        }
+        if(has_lo)
+        {
+            g[j] = gb;
+            h[j * e + j] = gbb;
+            h[j] = h[j * e] = -(gab + gbb);
+        }
+        if(has_hi && has_lo)
+            h[(j + 1) * e + j] = h[j * e + j + 1] = gab;
+
+        return std::log(p);
+    }
+
+private:
+    std::vector<double> outcomes;
+
+    size_t
+    outcome_of(double y) const
+    {
+        return std::lower_bound(outcomes.begin(), outcomes.end(), y) - outcomes.begin();
+    }
+};
+
+std::unique_ptr<Kernel>
+make_kernel(const std::string &name, const std::vector<double> &outcomes, size_t neq)
+{
+    std::unique_ptr<Kernel> ret;
+
+    if(name == "nbreg" && neq == 2)
+        ret.reset(new NegativeBinomialKernel());
+    else if(name == "ologit" && neq == outcomes.size() && neq >= 2)
+        ret.reset(new OrderedLogitKernel(outcomes));
+    else
+        Rcpp::stop("Unknown model or wrong number of equations: " + name);
+
+    return ret;
+}
+
+//
+// Evaluation
+//
+
+// An equation's variables, and whether it has a constant, which comes
+// after them; its coefficients start at first
+struct Equation
+{
+    std::vector<NumericColumn> xs;
+    bool constant;
+    size_t first;
+
+    size_t size() const { return xs.size() + (constant ? 1 : 0); }
+};
+
+// What one pass over the rows adds up: the log likelihood, and if asked
+// for, its gradient and Hessian and the sums of the outer products of the
+// scores, weighted as BHHH needs them (opg) and for the robust variance
+// (meat), all p x p
+struct Evaluation
+{
+    double obs, sum_w, loglik;
+    std::vector<double> gradient, hessian, opg, meat;
+};
+
+class Ml
+{
+public:
+    Ml(const std::vector<Equation> &eqs, NumericColumn y, const NumericColumn *offset,
+       const int *mp, const double *wp, R_xlen_t n, const Kernel &kernel,
+       bool frequency)
+        : eqs(eqs), y(y), offset(offset), mp(mp), wp(wp), n(n), kernel(kernel),
+          frequency(frequency), neq(eqs.size()), p(0)
+    {
+        for(size_t e = 0; e < neq; e++)
+            p += eqs[e].size();
+
+        // Where each pair of equations' block of the Hessian is kept
+        nblock = 0;
+        block_at.assign(neq * neq, 0);
+        for(size_t e = 0; e < neq; e++)
+            for(size_t f = e; f < neq; f++)
+            {
+                block_at[e * neq + f] = nblock;
+                nblock += eqs[e].size() * eqs[f].size();
+            }
+
+        nthreads = std::min(ado_threads_for(n, MIN_ROWS_PER_THREAD),
+                            (int) std::max(MAX_ACCUMULATED / (3 * p * p + 1), (size_t) 1));
+    }
+
+    size_t params() const { return p; }
+
+    // The cross products of each equation's variables, with a constant
+    // first, over the rows the fit uses, for finding which are collinear
+    std::vector< std::vector<double> >
+    cross_products() const
+    {
+        std::vector< std::vector<double> > ret(neq);
+        std::vector<double> obs(nthreads, 0), tw(nthreads, 0);
+        std::vector< std::vector<double> > acc(neq);
+        for(size_t e = 0; e < neq; e++)
+        {
+            size_t k = eqs[e].xs.size() + 1;
+            acc[e].assign(nthreads * k * k, 0);
+        }
+
+        #pragma omp parallel for schedule(static, 1) num_threads(nthreads)
+        for(int t = 0; t < nthreads; t++)
+        {
+            R_xlen_t lo = n * t / nthreads, hi = n * (t + 1) / nthreads;
+            size_t ld = CHUNK_ROWS;
+            std::vector<R_xlen_t> rows;
+            std::vector<double> wts, cols, wcols;
+
+            for(R_xlen_t c = lo; c < hi; c += CHUNK_ROWS)
+            {
+                usable_rows(c, std::min(c + (R_xlen_t) CHUNK_ROWS, hi), rows, wts);
+                size_t nr = rows.size();
+                if(nr == 0)
+                    continue;
+
+                for(size_t e = 0; e < neq; e++)
+                {
+                    size_t k = eqs[e].xs.size() + 1;
+                    cols.resize(k * ld);
+                    wcols.resize(k * ld);
+                    for(size_t r = 0; r < nr; r++)
+                    {
+                        cols[r] = 1;
+                        for(size_t j = 1; j < k; j++)
+                            cols[j * ld + r] = eqs[e].xs[j - 1].value(rows[r]);
+                        for(size_t j = 0; j < k; j++)
+                            wcols[j * ld + r] = wts[r] * cols[j * ld + r];
+                    }
+                    cross_add(&wcols[0], k, &cols[0], k, ld, nr, &acc[e][t * k * k], true);
+                }
+            }
+        }
+
+        for(size_t e = 0; e < neq; e++)
+        {
+            size_t k = eqs[e].xs.size() + 1;
+            ret[e] = add_up(acc[e], k);
+        }
+
+        return ret;
+    }
+
+    // One pass at the coefficients b: the log likelihood and, with
+    // derivatives, its gradient and Hessian, and with opg and meat those
+    // sums of the outer products of the scores (which need the others)
+    Evaluation
+    evaluate(const std::vector<double> &b, bool derivatives, bool opg, bool meat) const
+    {
+        size_t pp = p * p, ee = neq * neq;
+        derivatives = derivatives || opg || meat;
+        std::vector<double> obs(nthreads, 0), tw(nthreads, 0), ll(nthreads, 0);
+        std::vector<double> grad(derivatives ? nthreads * p : 0, 0);
+        std::vector<double> blocks(derivatives ? nthreads * nblock : 0, 0);
+        std::vector<double> op(opg ? nthreads * pp : 0, 0);
+        std::vector<double> mt(meat ? nthreads * pp : 0, 0);
+
+        #pragma omp parallel for schedule(static, 1) num_threads(nthreads)
+        for(int t = 0; t < nthreads; t++)
+        {
+            R_xlen_t lo = n * t / nthreads, hi = n * (t + 1) / nthreads;
+            size_t ld = CHUNK_ROWS;
+            std::vector<R_xlen_t> rows;
+            std::vector<double> wts, eta(neq), g(neq), h(ee);
+
+            // The chunk's design, a column per coefficient; its scores;
+            // the weighted second derivatives of each pair of equations;
+            // and a buffer for weighted columns
+            std::vector<double> cols(derivatives ? p * ld : 0), scores(derivatives ? p * ld : 0);
+            std::vector<double> hs(derivatives ? ee * ld : 0), wcols(derivatives ? p * ld : 0);
+            std::vector<bool> nonzero(ee);
+
+            for(R_xlen_t c = lo; c < hi; c += CHUNK_ROWS)
+            {
+                usable_rows(c, std::min(c + (R_xlen_t) CHUNK_ROWS, hi), rows, wts);
+                size_t nr = rows.size();
+                if(nr == 0)
+                    continue;
+                std::fill(nonzero.begin(), nonzero.end(), false);
+
+                for(size_t r = 0; r < nr; r++)
+                {
+                    R_xlen_t i = rows[r];
+                    double w = wts[r];
+
+                    for(size_t e = 0; e < neq; e++)
+                    {
+                        const Equation &eq = eqs[e];
+                        size_t k = eq.xs.size();
+
+                        eta[e] = e == 0 && offset != NULL ? offset->value(i) : 0;
+                        for(size_t j = 0; j < k; j++)
+                        {
+                            double v = eq.xs[j].value(i);
+                            eta[e] += b[eq.first + j] * v;
+                            if(derivatives)
+                                cols[(eq.first + j) * ld + r] = v;
+                        }
+                        if(eq.constant)
+                        {
+                            eta[e] += b[eq.first + k];
+                            if(derivatives)
+                                cols[(eq.first + k) * ld + r] = 1;
+                        }
+                    }
+
+                    obs[t]++;
+                    tw[t] += w;
+                    ll[t] += w * kernel.evaluate(y.value(i), &eta[0],
+                                                 derivatives ? &g[0] : NULL, &h[0]);
+                    if(!derivatives)
+                        continue;
+
+                    for(size_t e = 0; e < neq; e++)
+                    {
+                        for(size_t j = eqs[e].first; j < eqs[e].first + eqs[e].size(); j++)
+                        {
+                            scores[j * ld + r] = g[e] * cols[j * ld + r];
+                            grad[t * p + j] += w * scores[j * ld + r];
+                        }
+                        for(size_t f = e; f < neq; f++)
+                        {
+                            hs[(e * neq + f) * ld + r] = w * h[e * neq + f];
+                            if(h[e * neq + f] != 0)
+                                nonzero[e * neq + f] = true;
+                        }
+                    }
+                }
+
+                if(!derivatives)
+                    continue;
+
+                // The Hessian a block at a time: X_e' diag(w h_ef) X_f
+                for(size_t e = 0; e < neq; e++)
+                {
+                    size_t pe = eqs[e].size();
+                    const double *xe = &cols[eqs[e].first * ld];
+
+                    for(size_t f = e; f < neq; f++)
+                    {
+                        size_t pf = eqs[f].size();
+                        if(!nonzero[e * neq + f] || pe == 0 || pf == 0)
+                            continue;
+
+                        const double *he = &hs[(e * neq + f) * ld];
+                        for(size_t j = 0; j < pe; j++)
+                            for(size_t r = 0; r < nr; r++)
+                                wcols[j * ld + r] = he[r] * xe[j * ld + r];
+
+                        cross_add(&wcols[0], pe, &cols[eqs[f].first * ld], pf, ld, nr,
+                                  &blocks[t * nblock + block_at[e * neq + f]], e == f);
+                    }
+                }
+
+                if(opg)
+                {
+                    for(size_t j = 0; j < p; j++)
+                        for(size_t r = 0; r < nr; r++)
+                            wcols[j * ld + r] = wts[r] * scores[j * ld + r];
+                    cross_add(&wcols[0], p, &scores[0], p, ld, nr, &op[t * pp], true);
+                }
+                if(meat)
+                {
+                    for(size_t j = 0; j < p; j++)
+                        for(size_t r = 0; r < nr; r++)
+                            wcols[j * ld + r] = (frequency ? 1 : wts[r]) * wts[r] *
+                                                scores[j * ld + r];
+                    cross_add(&wcols[0], p, &scores[0], p, ld, nr, &mt[t * pp], true);
+                }
+            }
+        }
+
+        Evaluation ev = Evaluation();
+        for(int t = 0; t < nthreads; t++)
+        {
+            ev.obs += obs[t];
+            ev.sum_w += tw[t];
+            ev.loglik += ll[t];
+        }
+        if(derivatives)
+        {
+            ev.gradient.assign(p, 0);
+            for(int t = 0; t < nthreads; t++)
+                for(size_t j = 0; j < p; j++)
+                    ev.gradient[j] += grad[t * p + j];
+            ev.hessian = assemble(blocks);
+        }
+        if(opg)
+            ev.opg = add_up(op, p);
+        if(meat)
+            ev.meat = add_up(mt, p);
+
+        return ev;
+    }
+
+private:
+    const std::vector<Equation> &eqs;
+    NumericColumn y;
+    const NumericColumn *offset;
+    const int *mp;
+    const double *wp;
+    R_xlen_t n;
+    const Kernel &kernel;
+    bool frequency;
+    size_t neq, p, nblock;
+    std::vector<size_t> block_at;
+    int nthreads;
+
+    // The rows of [lo, hi) the fit uses, and their weights
+    void
+    usable_rows(R_xlen_t lo, R_xlen_t hi, std::vector<R_xlen_t> &rows,
+                std::vector<double> &wts) const
+    {
+        rows.clear();
+        wts.clear();
+
+        for(R_xlen_t i = lo; i < hi; i++)
+        {
+            double wt = weight_of(wp, i), yi = y.value(i);
+            if(!selected(mp, i) || wt == 0 || std::isnan(yi) || !kernel.valid(yi))
+                continue;
+            if(offset != NULL && std::isnan(offset->value(i)))
+                continue;
+
+            bool complete = true;
+            for(size_t e = 0; e < neq && complete; e++)
+                for(size_t j = 0; j < eqs[e].xs.size() && complete; j++)
+                    complete = !std::isnan(eqs[e].xs[j].value(i));
+
+            if(complete)
+            {
+                rows.push_back(i);
+                wts.push_back(wt);
+            }
+        }
+    }
+
+    // The threads' p x p accumulators added up in order, and made symmetric
+    std::vector<double>
+    add_up(const std::vector<double> &acc, size_t k) const
+    {
+        std::vector<double> ret(k * k, 0);
+        for(int t = 0; t < nthreads; t++)
+            for(size_t h = 0; h < k * k; h++)
+                ret[h] += acc[t * k * k + h];
+        if(k > 0)
+            symmetrize(&ret[0], k);
+
+        return ret;
+    }
+
+    // The threads' blocks of the Hessian added up and put together
+    std::vector<double>
+    assemble(const std::vector<double> &blocks) const
+    {
+        std::vector<double> sum(nblock, 0), ret(p * p, 0);
+        for(int t = 0; t < nthreads; t++)
+            for(size_t h = 0; h < nblock; h++)
+                sum[h] += blocks[t * nblock + h];
+
+        for(size_t e = 0; e < neq; e++)
+        {
+            size_t pe = eqs[e].size();
+            for(size_t f = e; f < neq; f++)
+            {
+                size_t pf = eqs[f].size();
+                double *blk = &sum[block_at[e * neq + f]];
+                if(e == f && pe > 0)
+                    symmetrize(blk, pe);
+
+                for(size_t i = 0; i < pe; i++)
+                    for(size_t j = 0; j < pf; j++)
+                    {
+                        size_t row = eqs[e].first + i, col = eqs[f].first + j;
+                        ret[row * p + col] = ret[col * p + row] = blk[i * pf + j];
+                    }
+            }
+        }
+
+        return ret;
+    }
+};
+
+//
+// Maximization
+//
+
+struct Control
+{
+    int maxiter;
+    double tol, ltol, nrtol;
+    std::string technique;
+};
+
+// Where the maximization ended up, and how it got there
+struct Fit
+{
+    std::vector<double> b;
+    Evaluation at;
+    std::vector<double> log;
+    std::vector<int> notes;
+    int iterations;
+    bool converged;
+};
+
+// The direction to step in from ev, by solving a x = g for the matrix a
+// the technique calls for, and the scaled gradient g'x. For nr, a is the
+// negative Hessian, or the outer product of the gradients if that's not
+// positive definite, which is noted; for bfgs, a is the BFGS update kept
+// in approx, started at the same. omitted is left as it is.
+std::vector<double>
+direction(const Ml &ml, const std::vector<double> &b, Evaluation &ev,
+          const std::vector<bool> &omitted, const Control &ctl,
+          std::vector<double> &approx, int &note, double &scaled)
+{
+    size_t p = b.size();
+    std::vector<size_t> order(p);
+    for(size_t j = 0; j < p; j++)
+        order[j] = j;
+
+    std::vector<double> a, x, inv;
+    if(ctl.technique == "bfgs" && !approx.empty())
+        a = approx;
+    else if(ctl.technique == "nr" || ctl.technique == "bfgs")
+    {
+        a.resize(p * p);
+        for(size_t h = 0; h < p * p; h++)
+            a[h] = -ev.hessian[h];
+    }
+
+    std::vector<bool> om = omitted;
+    if(!a.empty())
+    {
+        solve_in_order(&a[0], p, &ev.gradient[0], order, COLLINEAR_TOL, om, x, inv);
+        if(om != omitted)
+            note |= NOT_CONCAVE;
+    }
+
+    if(a.empty() || om != omitted)
+    {
+        if(ev.opg.empty())
+            ev.opg = ml.evaluate(b, false, true, false).opg;
+        a = ev.opg;
+        om = omitted;
+        solve_in_order(&a[0], p, &ev.gradient[0], order, COLLINEAR_TOL, om, x, inv);
+    }
+
+    if(ctl.technique == "bfgs")
+        approx = a;
+
+    scaled = 0;
+    for(size_t j = 0; j < p; j++)
+        scaled += ev.gradient[j] * x[j];
+
+    return x;
+}
+
+// Maximize the log likelihood from b, holding the coefficients omitted
+// says at 0
+Fit
+maximize(const Ml &ml, std::vector<double> b, const std::vector<bool> &omitted,
+         const Control &ctl)
+{
+    size_t p = b.size();
+    for(size_t j = 0; j < p; j++)
+        if(omitted[j])
+            b[j] = 0;
+
+    Fit fit;
+    fit.iterations = 0;
+    fit.converged = false;
+
+    Evaluation ev = ml.evaluate(b, true, ctl.technique != "nr", false);
+    if(!std::isfinite(ev.loglik))
+        Rcpp::stop("Initial values not feasible");
+
+    std::vector<double> prev, approx;
+    double prev_ll = NAN;
+    int backed = 0;
+
+    while(true)
+    {
+        int note = backed;
+        double scaled;
+        std::vector<double> d = direction(ml, b, ev, omitted, ctl, approx, note, scaled);
+        fit.log.push_back(ev.loglik);
+        fit.notes.push_back(note);
+
+        if(!prev.empty())
+        {
+            double bdif = 0;
+            for(size_t j = 0; j < p; j++)
+                bdif = std::max(bdif, reldif(b[j], prev[j]));
+
+            if(std::fabs(scaled) < ctl.nrtol &&
+               (bdif < ctl.tol || reldif(ev.loglik, prev_ll) < ctl.ltol))
+            {
+                fit.converged = true;
+                break;
+            }
+        }
+        if(fit.iterations >= ctl.maxiter)
+            break;
+
+        // The step is halved until the log likelihood doesn't fall, but
+        // for rounding error near the maximum
+        double slack = 1e-12 * (std::fabs(ev.loglik) + 1), step = 1;
+        std::vector<double> trial(p);
+        Evaluation next;
+        int halvings = 0;
+        for(; halvings <= MAX_HALVINGS; halvings++, step /= 2)
+        {
+            for(size_t j = 0; j < p; j++)
+                trial[j] = b[j] + step * d[j];
+            next = ml.evaluate(trial, true, ctl.technique != "nr", false);
+            if(std::isfinite(next.loglik) && next.loglik >= ev.loglik - slack)
+                break;
+        }
+        if(halvings > MAX_HALVINGS)
+            break;
+        backed = halvings > 0 ? BACKED_UP : 0;
+
+        // The BFGS update of the approximation a to the negative Hessian,
+        // from the step s and the change y in the gradient, kept positive
+        // definite by skipping it where s'y isn't positive
+        if(ctl.technique == "bfgs")
+        {
+            std::vector<double> s(p), yv(p), as(p, 0);
+            double sy = 0, sas = 0;
+            for(size_t j = 0; j < p; j++)
+            {
+                s[j] = trial[j] - b[j];
+                yv[j] = ev.gradient[j] - next.gradient[j];
+                sy += s[j] * yv[j];
+            }
+            for(size_t i = 0; i < p; i++)
+            {
+                for(size_t j = 0; j < p; j++)
+                    as[i] += approx[i * p + j] * s[j];
+                sas += s[i] * as[i];
+            }
+
+            if(sy > 0 && sas > 0)
+                for(size_t i = 0; i < p; i++)
+                    for(size_t j = 0; j < p; j++)
+                        approx[i * p + j] += yv[i] * yv[j] / sy - as[i] * as[j] / sas;
+        }
+
+        prev = b;
+        prev_ll = ev.loglik;
+        b = trial;
+        ev = next;
+        fit.iterations++;
+    }
+
+    fit.b = b;
+    fit.at = ev;
+    return fit;
+}
+
+// The inverse of a, p x p, leaving out the coefficients omitted says
+std::vector<double>
+inverse_of(const std::vector<double> &a, std::vector<bool> omitted)
+{
+    size_t p = omitted.size();
+    std::vector<size_t> order(p);
+    for(size_t j = 0; j < p; j++)
+        order[j] = j;
+
+    std::vector<double> x, inv;
+    solve_in_order(&a[0], p, NULL, order, COLLINEAR_TOL, omitted, x, inv);
+    return inv;
+}
+
+// Which coefficients are left out for collinearity, from the cross
+// products cross of each equation's variables with a constant first: the
+// constant is kept if the equation has one, or, to be left out of the
+// variables, if the kernel implies one
+std::vector<bool>
+collinear(const std::vector<Equation> &eqs, const Kernel &kernel,
+          const std::vector< std::vector<double> > &cross, size_t p)
+{
+    std::vector<bool> ret(p, false);
+
+    for(size_t e = 0; e < eqs.size(); e++)
+    {
+        size_t k = eqs[e].xs.size() + 1;
+        if(k == 1)
+            continue;
+
+        std::vector<size_t> order(k);
+        for(size_t j = 0; j < k; j++)
+            order[j] = j;
+
+        std::vector<bool> om(k, false);
+        om[0] = !eqs[e].constant && !kernel.implied_constant(e);
+        std::vector<double> x, inv;
+        solve_in_order(&cross[e][0], k, NULL, order, COLLINEAR_TOL, om, x, inv);
+
+        for(size_t j = 1; j < k; j++)
+            ret[eqs[e].first + j - 1] = om[j];
+    }
+
+    return ret;
+}
+
+} // namespace
+
+// Fit the model named by model ("nbreg" or "ologit") to the numeric vector
+// y by maximum likelihood, over the rows mask selects (every row if it's
+// NULL) with no missing values and nonzero weights, weighted by weights
+// (if not NULL). equations is a list of the model's equations, each a list
+// of x, its numeric columns, and constant, whether it has one; offset, if
+// not NULL, is added to the first one's linear predictor. For ologit,
+// there's an equation (with only a constant) for each cutpoint after the
+// first, and outcomes has y's values in order. start has the coefficients
+// to start from, an equation's constant after its variables; control has
+// iterate, tolerance, ltolerance, nrtolerance and technique ("nr", "bhhh"
+// or "bfgs"), as for Stata's ml, and vce, which is "oim", "opg" or
+// "robust", and frequency, whether the weights are fweights.
+//
+// Returns a list: b, the coefficients, 0 for the ones omitted, which
+// omitted says; inv, the inverse of the negative Hessian (or with vce opg,
+// of the outer product of the gradients) and robust, with vce robust, the
+// sandwich made with that inverse; obs, sum_w, loglik, the log likelihood
+// at each iteration and notes on each (1 if the Hessian wasn't concave, 2
+// if the step was backed up), iterations, converged, rank, and with
+// null_model, loglik_0, the log likelihood with the first equation's
+// variables left out, over the same rows.
+// [[Rcpp::export]]
+Rcpp::List
+ml_fit(Rcpp::List equations, SEXP y, SEXP mask, SEXP weights, SEXP offset,
+       std::string model, Rcpp::NumericVector outcomes, Rcpp::NumericVector start,
+       bool null_model, Rcpp::List control)
+{
+    R_xlen_t n = Rf_xlength(y);
+    size_t neq = (size_t) equations.size(), p = 0;
+
+    std::vector<Equation> eqs(neq);
+    for(size_t e = 0; e < neq; e++)
+    {
+        Rcpp::List eq = equations[e];
+        Rcpp::List x = eq["x"];
+
+        eqs[e].xs.resize(x.size());
+        for(size_t j = 0; j < eqs[e].xs.size(); j++)
+            eqs[e].xs[j] = numeric_column(x[j], n, "An independent variable");
+        eqs[e].constant = Rcpp::as<bool>(eq["constant"]);
+        eqs[e].first = p;
+        p += eqs[e].size();
+    }
+    NumericColumn yc = numeric_column(y, n, "The dependent variable");
+    NumericColumn oc = NumericColumn();
+    if(!Rf_isNull(offset))
+        oc = numeric_column(offset, n, "The offset");
+
+    if(!Rf_isNull(mask) && (TYPEOF(mask) != LGLSXP || Rf_xlength(mask) != n))
+        Rcpp::stop("Mask must be a logical vector with one element per row");
+    if(!Rf_isNull(weights) && (TYPEOF(weights) != REALSXP || Rf_xlength(weights) != n))
+        Rcpp::stop("Weights must be a double vector with one element per row");
+    if(start.size() != 0 && (size_t) start.size() != p)
+        Rcpp::stop("Starting values must have one element per coefficient");
+
+    Control ctl;
+    ctl.maxiter = Rcpp::as<int>(control["iterate"]);
+    ctl.tol = Rcpp::as<double>(control["tolerance"]);
+    ctl.ltol = Rcpp::as<double>(control["ltolerance"]);
+    ctl.nrtol = Rcpp::as<double>(control["nrtolerance"]);
+    ctl.technique = Rcpp::as<std::string>(control["technique"]);
+    std::string vce = Rcpp::as<std::string>(control["vce"]);
+    bool frequency = Rcpp::as<bool>(control["frequency"]);
+    if(ctl.technique != "nr" && ctl.technique != "bhhh" && ctl.technique != "bfgs")
+        Rcpp::stop("Unknown technique: " + ctl.technique);
+
+    std::vector<double> levels(outcomes.begin(), outcomes.end());
+    std::unique_ptr<Kernel> kernel = make_kernel(model, levels, neq);
+
+    const int *mp = Rf_isNull(mask) ? NULL : LOGICAL(mask);
+    const double *wp = Rf_isNull(weights) ? NULL : REAL(weights);
+    Ml ml(eqs, yc, Rf_isNull(offset) ? NULL : &oc, mp, wp, n, *kernel, frequency);
+
+    std::vector< std::vector<double> > cross = ml.cross_products();
+    if(cross[0][0] == 0)
+        Rcpp::stop("No observations");
+    std::vector<bool> omitted = collinear(eqs, *kernel, cross, p);
+
+    std::vector<double> b(start.begin(), start.end());
+    if(b.empty())
+        b.assign(p, 0);
+    Fit fit = maximize(ml, b, omitted, ctl);
+
+    // The variance at the estimates, from a final pass for the counts and
+    // the outer products of the scores
+    Evaluation counts = ml.evaluate(fit.b, false, vce == "opg", vce == "robust");
+    std::vector<double> info(p * p), robust;
+    if(vce == "opg")
+        info = counts.opg;
+    else
+        for(size_t h = 0; h < p * p; h++)
+            info[h] = -fit.at.hessian[h];
+    std::vector<double> inv = inverse_of(info, omitted);
+
+    if(vce == "robust")
+    {
+        // inv meat inv
+        std::vector<double> left(p * p, 0);
+        robust.assign(p * p, 0);
+        for(size_t i = 0; i < p; i++)
+            for(size_t j = 0; j < p; j++)
+                for(size_t h = 0; h < p; h++)
+                    left[i * p + j] += inv[i * p + h] * counts.meat[h * p + j];
+        for(size_t i = 0; i < p; i++)
+            for(size_t j = 0; j < p; j++)
+                for(size_t h = 0; h < p; h++)
+                    robust[i * p + j] += left[i * p + h] * inv[h * p + j];
+    }
+
+    size_t rank = 0;
+    for(size_t j = 0; j < p; j++)
+        if(!omitted[j])
+            rank++;
+
+    Rcpp::NumericMatrix invm(p, p);
+    for(size_t i = 0; i < p; i++)
+        for(size_t j = 0; j < p; j++)
+            invm(i, j) = inv[i * p + j];
+
+    Rcpp::List ret = Rcpp::List::create(
+        Rcpp::Named("b") = Rcpp::NumericVector(fit.b.begin(), fit.b.end()),
+        Rcpp::Named("omitted") = Rcpp::LogicalVector(omitted.begin(), omitted.end()),
+        Rcpp::Named("inv") = invm,
+        Rcpp::Named("obs") = counts.obs,
+        Rcpp::Named("sum_w") = counts.sum_w,
+        Rcpp::Named("loglik") = fit.at.loglik,
+        Rcpp::Named("log_loglik") = Rcpp::NumericVector(fit.log.begin(), fit.log.end()),
+        Rcpp::Named("log_notes") = Rcpp::IntegerVector(fit.notes.begin(), fit.notes.end()),
+        Rcpp::Named("iterations") = fit.iterations,
+        Rcpp::Named("converged") = fit.converged,
+        Rcpp::Named("rank") = (double) rank);
+
+    if(vce == "robust")
+    {
+        Rcpp::NumericMatrix sandwich(p, p);
+        for(size_t i = 0; i < p; i++)
+            for(size_t j = 0; j < p; j++)
+                sandwich(i, j) = robust[i * p + j];
+        ret["robust"] = sandwich;
+    }
+
+    if(null_model)
+    {
+        // The first equation's variables left out, from the same start
+        std::vector<bool> om0 = omitted;
+        for(size_t j = 0; j < eqs[0].xs.size(); j++)
+            om0[eqs[0].first + j] = true;
+
+        Fit fit0 = maximize(ml, b, om0, ctl);
+        ret["loglik_0"] = fit0.at.loglik;
+    }
+
+    return ret;
+}
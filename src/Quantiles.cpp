@@ -0,0 +1,70 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <Rcpp.h>
+#include "Parallel.hpp"
+
+/*
+ * Assigning values to the bins between cutpoints, for xtile and egen cut.
+ * The cutpoints themselves are percentiles from column_percentiles (see
+ * Summarize.cpp and include/Statistics.hpp) or given by the user; here
+ * each value is located among them by binary search, in parallel over
+ * rows, so n values and k cutpoints take O(n log k).
+ */
+
+namespace {
+
+// Each thread should get at least this many rows
+const R_xlen_t MIN_ROWS_PER_THREAD = 1 << 14;
+
+} // namespace
+
+// For each element of the numeric vector x, how many of the cutpoints
+// cuts (which must be sorted and not missing) are below it, or with
+// closed = false, at or below it; NA for missing values. The bins are
+// thus closed on the right, as xtile's are, or on the left, as egen
+// cut's are.
+// [[Rcpp::export]]
+Rcpp::IntegerVector
+bin_values(SEXP x, Rcpp::NumericVector cuts, bool closed)
+{
+    R_xlen_t n = Rf_xlength(x);
+    if(TYPEOF(x) != INTSXP && TYPEOF(x) != LGLSXP && TYPEOF(x) != REALSXP)
+        Rcpp::stop("Bins of a vector that isn't numeric");
+
+    std::vector<double> cp(cuts.begin(), cuts.end());
+    for(size_t k = 0; k < cp.size(); k++)
+        if(std::isnan(cp[k]) || (k > 0 && cp[k] < cp[k - 1]))
+            Rcpp::stop("Cutpoints must be nonmissing and in increasing order");
+
+    Rcpp::IntegerVector ret(n);
+    int *out = INTEGER(ret);
+    const int *ip = TYPEOF(x) == REALSXP ? NULL : INTEGER(x);
+    const double *dp = TYPEOF(x) == REALSXP ? REAL(x) : NULL;
+
+    int nthreads = ado_threads_for(n, MIN_ROWS_PER_THREAD);
+
+    #pragma omp parallel for schedule(static) num_threads(nthreads)
+    for(R_xlen_t i = 0; i < n; i++)
+    {
+        double val;
+        if(ip != NULL)
+            val = ip[i] == NA_INTEGER ? NAN : (double) ip[i];
+        else
+            val = dp[i];
+
+        if(std::isnan(val))
+        {
+            out[i] = NA_INTEGER;
+            continue;
+        }
+
+        std::vector<double>::const_iterator pos = closed
+            ? std::lower_bound(cp.begin(), cp.end(), val)
+            : std::upper_bound(cp.begin(), cp.end(), val);
+        out[i] = (int) (pos - cp.begin());
+    }
+
+    return ret;
+}
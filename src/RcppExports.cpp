@@ -5,17 +5,639 @@
 
 using namespace Rcpp;
 
+// concat_columns
+SEXP concat_columns(Rcpp::List parts, Rcpp::NumericVector lengths, std::string type);
+RcppExport SEXP _ado_concat_columns(SEXP partsSEXP, SEXP lengthsSEXP, SEXP typeSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::List >::type parts(partsSEXP);
+    Rcpp::traits::input_parameter< Rcpp::NumericVector >::type lengths(lengthsSEXP);
+    Rcpp::traits::input_parameter< std::string >::type type(typeSEXP);
+    rcpp_result_gen = Rcpp::wrap(concat_columns(parts, lengths, type));
+    return rcpp_result_gen;
+END_RCPP
+}
+// assign_where
+double assign_where(SEXP x, SEXP values, SEXP mask);
+RcppExport SEXP _ado_assign_where(SEXP xSEXP, SEXP valuesSEXP, SEXP maskSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type x(xSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type values(valuesSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type mask(maskSEXP);
+    rcpp_result_gen = Rcpp::wrap(assign_where(x, values, mask));
+    return rcpp_result_gen;
+END_RCPP
+}
+// fits_integer
+bool fits_integer(Rcpp::NumericVector values, SEXP mask);
+RcppExport SEXP _ado_fits_integer(SEXP valuesSEXP, SEXP maskSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::NumericVector >::type values(valuesSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type mask(maskSEXP);
+    rcpp_result_gen = Rcpp::wrap(fits_integer(values, mask));
+    return rcpp_result_gen;
+END_RCPP
+}
+// group_starts
+SEXP group_starts(Rcpp::List cols);
+RcppExport SEXP _ado_group_starts(SEXP colsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::List >::type cols(colsSEXP);
+    rcpp_result_gen = Rcpp::wrap(group_starts(cols));
+    return rcpp_result_gen;
+END_RCPP
+}
+// collapse_data
+Rcpp::List collapse_data(Rcpp::List by, Rcpp::List vars, Rcpp::IntegerVector sources, Rcpp::CharacterVector stats, Rcpp::NumericVector pcts, SEXP weights, std::string weight_kind);
+RcppExport SEXP _ado_collapse_data(SEXP bySEXP, SEXP varsSEXP, SEXP sourcesSEXP, SEXP statsSEXP, SEXP pctsSEXP, SEXP weightsSEXP, SEXP weight_kindSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::List >::type by(bySEXP);
+    Rcpp::traits::input_parameter< Rcpp::List >::type vars(varsSEXP);
+    Rcpp::traits::input_parameter< Rcpp::IntegerVector >::type sources(sourcesSEXP);
+    Rcpp::traits::input_parameter< Rcpp::CharacterVector >::type stats(statsSEXP);
+    Rcpp::traits::input_parameter< Rcpp::NumericVector >::type pcts(pctsSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type weights(weightsSEXP);
+    Rcpp::traits::input_parameter< std::string >::type weight_kind(weight_kindSEXP);
+    rcpp_result_gen = Rcpp::wrap(collapse_data(by, vars, sources, stats, pcts, weights, weight_kind));
+    return rcpp_result_gen;
+END_RCPP
+}
+// group_stat
+SEXP group_stat(Rcpp::IntegerVector ids, int ngroups, SEXP x, std::string stat, double pct);
+RcppExport SEXP _ado_group_stat(SEXP idsSEXP, SEXP ngroupsSEXP, SEXP xSEXP, SEXP statSEXP, SEXP pctSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::IntegerVector >::type ids(idsSEXP);
+    Rcpp::traits::input_parameter< int >::type ngroups(ngroupsSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type x(xSEXP);
+    Rcpp::traits::input_parameter< std::string >::type stat(statSEXP);
+    Rcpp::traits::input_parameter< double >::type pct(pctSEXP);
+    rcpp_result_gen = Rcpp::wrap(group_stat(ids, ngroups, x, stat, pct));
+    return rcpp_result_gen;
+END_RCPP
+}
+// parse_numbers
+Rcpp::List parse_numbers(Rcpp::CharacterVector x, std::string ignore, bool percent, bool dpcomma);
+RcppExport SEXP _ado_parse_numbers(SEXP xSEXP, SEXP ignoreSEXP, SEXP percentSEXP, SEXP dpcommaSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::CharacterVector >::type x(xSEXP);
+    Rcpp::traits::input_parameter< std::string >::type ignore(ignoreSEXP);
+    Rcpp::traits::input_parameter< bool >::type percent(percentSEXP);
+    Rcpp::traits::input_parameter< bool >::type dpcomma(dpcommaSEXP);
+    rcpp_result_gen = Rcpp::wrap(parse_numbers(x, ignore, percent, dpcomma));
+    return rcpp_result_gen;
+END_RCPP
+}
+// format_numbers
+Rcpp::List format_numbers(Rcpp::NumericVector x, std::string fmt);
+RcppExport SEXP _ado_format_numbers(SEXP xSEXP, SEXP fmtSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::NumericVector >::type x(xSEXP);
+    Rcpp::traits::input_parameter< std::string >::type fmt(fmtSEXP);
+    rcpp_result_gen = Rcpp::wrap(format_numbers(x, fmt));
+    return rcpp_result_gen;
+END_RCPP
+}
+// cross_products
+Rcpp::List cross_products(Rcpp::List cols, SEXP mask, SEXP weights, bool pairwise);
+RcppExport SEXP _ado_cross_products(SEXP colsSEXP, SEXP maskSEXP, SEXP weightsSEXP, SEXP pairwiseSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::List >::type cols(colsSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type mask(maskSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type weights(weightsSEXP);
+    Rcpp::traits::input_parameter< bool >::type pairwise(pairwiseSEXP);
+    rcpp_result_gen = Rcpp::wrap(cross_products(cols, mask, weights, pairwise));
+    return rcpp_result_gen;
+END_RCPP
+}
+// delimited_header
+Rcpp::CharacterVector delimited_header(std::string path, std::string sep, bool header);
+RcppExport SEXP _ado_delimited_header(SEXP pathSEXP, SEXP sepSEXP, SEXP headerSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type path(pathSEXP);
+    Rcpp::traits::input_parameter< std::string >::type sep(sepSEXP);
+    Rcpp::traits::input_parameter< bool >::type header(headerSEXP);
+    rcpp_result_gen = Rcpp::wrap(delimited_header(path, sep, header));
+    return rcpp_result_gen;
+END_RCPP
+}
+// sniff_delimiter
+std::string sniff_delimiter(std::string path, int nlines);
+RcppExport SEXP _ado_sniff_delimiter(SEXP pathSEXP, SEXP nlinesSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type path(pathSEXP);
+    Rcpp::traits::input_parameter< int >::type nlines(nlinesSEXP);
+    rcpp_result_gen = Rcpp::wrap(sniff_delimiter(path, nlines));
+    return rcpp_result_gen;
+END_RCPP
+}
+// read_delimited
+Rcpp::List read_delimited(std::string path, std::string sep, bool header, Rcpp::LogicalVector keep);
+RcppExport SEXP _ado_read_delimited(SEXP pathSEXP, SEXP sepSEXP, SEXP headerSEXP, SEXP keepSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type path(pathSEXP);
+    Rcpp::traits::input_parameter< std::string >::type sep(sepSEXP);
+    Rcpp::traits::input_parameter< bool >::type header(headerSEXP);
+    Rcpp::traits::input_parameter< Rcpp::LogicalVector >::type keep(keepSEXP);
+    rcpp_result_gen = Rcpp::wrap(read_delimited(path, sep, header, keep));
+    return rcpp_result_gen;
+END_RCPP
+}
+// map_dta
+Rcpp::List map_dta(std::string path, Rcpp::CharacterVector select, double first, double last);
+RcppExport SEXP _ado_map_dta(SEXP pathSEXP, SEXP selectSEXP, SEXP firstSEXP, SEXP lastSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type path(pathSEXP);
+    Rcpp::traits::input_parameter< Rcpp::CharacterVector >::type select(selectSEXP);
+    Rcpp::traits::input_parameter< double >::type first(firstSEXP);
+    Rcpp::traits::input_parameter< double >::type last(lastSEXP);
+    rcpp_result_gen = Rcpp::wrap(map_dta(path, select, first, last));
+    return rcpp_result_gen;
+END_RCPP
+}
+// mapped_state
+std::string mapped_state(SEXP x);
+RcppExport SEXP _ado_mapped_state(SEXP xSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type x(xSEXP);
+    rcpp_result_gen = Rcpp::wrap(mapped_state(x));
+    return rcpp_result_gen;
+END_RCPP
+}
+// dta_info
+Rcpp::List dta_info(std::string path);
+RcppExport SEXP _ado_dta_info(SEXP pathSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type path(pathSEXP);
+    rcpp_result_gen = Rcpp::wrap(dta_info(path));
+    return rcpp_result_gen;
+END_RCPP
+}
+// read_dta
+Rcpp::List read_dta(std::string path, Rcpp::CharacterVector select, double first, double last, Rcpp::CharacterVector filter_vars, Rcpp::CharacterVector filter_ops, Rcpp::NumericVector filter_values, bool convert_factors);
+RcppExport SEXP _ado_read_dta(SEXP pathSEXP, SEXP selectSEXP, SEXP firstSEXP, SEXP lastSEXP, SEXP filter_varsSEXP, SEXP filter_opsSEXP, SEXP filter_valuesSEXP, SEXP convert_factorsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type path(pathSEXP);
+    Rcpp::traits::input_parameter< Rcpp::CharacterVector >::type select(selectSEXP);
+    Rcpp::traits::input_parameter< double >::type first(firstSEXP);
+    Rcpp::traits::input_parameter< double >::type last(lastSEXP);
+    Rcpp::traits::input_parameter< Rcpp::CharacterVector >::type filter_vars(filter_varsSEXP);
+    Rcpp::traits::input_parameter< Rcpp::CharacterVector >::type filter_ops(filter_opsSEXP);
+    Rcpp::traits::input_parameter< Rcpp::NumericVector >::type filter_values(filter_valuesSEXP);
+    Rcpp::traits::input_parameter< bool >::type convert_factors(convert_factorsSEXP);
+    rcpp_result_gen = Rcpp::wrap(read_dta(path, select, first, last, filter_vars, filter_ops, filter_values, convert_factors));
+    return rcpp_result_gen;
+END_RCPP
+}
+// write_dta
+void write_dta(std::string path, Rcpp::List data, int release, std::string label, std::string timestamp, Rcpp::CharacterVector varlabels, Rcpp::CharacterVector formats, Rcpp::CharacterVector lblnames, Rcpp::List tables);
+RcppExport SEXP _ado_write_dta(SEXP pathSEXP, SEXP dataSEXP, SEXP releaseSEXP, SEXP labelSEXP, SEXP timestampSEXP, SEXP varlabelsSEXP, SEXP formatsSEXP, SEXP lblnamesSEXP, SEXP tablesSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type path(pathSEXP);
+    Rcpp::traits::input_parameter< Rcpp::List >::type data(dataSEXP);
+    Rcpp::traits::input_parameter< int >::type release(releaseSEXP);
+    Rcpp::traits::input_parameter< std::string >::type label(labelSEXP);
+    Rcpp::traits::input_parameter< std::string >::type timestamp(timestampSEXP);
+    Rcpp::traits::input_parameter< Rcpp::CharacterVector >::type varlabels(varlabelsSEXP);
+    Rcpp::traits::input_parameter< Rcpp::CharacterVector >::type formats(formatsSEXP);
+    Rcpp::traits::input_parameter< Rcpp::CharacterVector >::type lblnames(lblnamesSEXP);
+    Rcpp::traits::input_parameter< Rcpp::List >::type tables(tablesSEXP);
+    write_dta(path, data, release, label, timestamp, varlabels, formats, lblnames, tables);
+    return R_NilValue;
+END_RCPP
+}
+// group_index
+Rcpp::List group_index(Rcpp::List cols);
+RcppExport SEXP _ado_group_index(SEXP colsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::List >::type cols(colsSEXP);
+    rcpp_result_gen = Rcpp::wrap(group_index(cols));
+    return rcpp_result_gen;
+END_RCPP
+}
+// group_rank
+Rcpp::NumericVector group_rank(Rcpp::IntegerVector ids, int ngroups, Rcpp::NumericVector x, std::string method);
+RcppExport SEXP _ado_group_rank(SEXP idsSEXP, SEXP ngroupsSEXP, SEXP xSEXP, SEXP methodSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::IntegerVector >::type ids(idsSEXP);
+    Rcpp::traits::input_parameter< int >::type ngroups(ngroupsSEXP);
+    Rcpp::traits::input_parameter< Rcpp::NumericVector >::type x(xSEXP);
+    Rcpp::traits::input_parameter< std::string >::type method(methodSEXP);
+    rcpp_result_gen = Rcpp::wrap(group_rank(ids, ngroups, x, method));
+    return rcpp_result_gen;
+END_RCPP
+}
+// group_tag
+Rcpp::IntegerVector group_tag(Rcpp::IntegerVector ids, int ngroups);
+RcppExport SEXP _ado_group_tag(SEXP idsSEXP, SEXP ngroupsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::IntegerVector >::type ids(idsSEXP);
+    Rcpp::traits::input_parameter< int >::type ngroups(ngroupsSEXP);
+    rcpp_result_gen = Rcpp::wrap(group_tag(ids, ngroups));
+    return rcpp_result_gen;
+END_RCPP
+}
+// group_seq
+Rcpp::IntegerVector group_seq(Rcpp::IntegerVector ids, int ngroups, int from, int to, int block);
+RcppExport SEXP _ado_group_seq(SEXP idsSEXP, SEXP ngroupsSEXP, SEXP fromSEXP, SEXP toSEXP, SEXP blockSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::IntegerVector >::type ids(idsSEXP);
+    Rcpp::traits::input_parameter< int >::type ngroups(ngroupsSEXP);
+    Rcpp::traits::input_parameter< int >::type from(fromSEXP);
+    Rcpp::traits::input_parameter< int >::type to(toSEXP);
+    Rcpp::traits::input_parameter< int >::type block(blockSEXP);
+    rcpp_result_gen = Rcpp::wrap(group_seq(ids, ngroups, from, to, block));
+    return rcpp_result_gen;
+END_RCPP
+}
+// encode_strings
+Rcpp::List encode_strings(Rcpp::CharacterVector x, Rcpp::CharacterVector levels, SEXP mask);
+RcppExport SEXP _ado_encode_strings(SEXP xSEXP, SEXP levelsSEXP, SEXP maskSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::CharacterVector >::type x(xSEXP);
+    Rcpp::traits::input_parameter< Rcpp::CharacterVector >::type levels(levelsSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type mask(maskSEXP);
+    rcpp_result_gen = Rcpp::wrap(encode_strings(x, levels, mask));
+    return rcpp_result_gen;
+END_RCPP
+}
+// decode_codes
+Rcpp::CharacterVector decode_codes(Rcpp::IntegerVector codes, Rcpp::CharacterVector levels, SEXP mask);
+RcppExport SEXP _ado_decode_codes(SEXP codesSEXP, SEXP levelsSEXP, SEXP maskSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::IntegerVector >::type codes(codesSEXP);
+    Rcpp::traits::input_parameter< Rcpp::CharacterVector >::type levels(levelsSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type mask(maskSEXP);
+    rcpp_result_gen = Rcpp::wrap(decode_codes(codes, levels, mask));
+    return rcpp_result_gen;
+END_RCPP
+}
+// irls_fit
+Rcpp::List irls_fit(Rcpp::List x, SEXP y, SEXP mask, SEXP weights, SEXP trials, SEXP offset, std::string family, std::string link, double family_param, double link_param, Rcpp::NumericVector start, bool constant, bool null_model, Rcpp::List control);
+RcppExport SEXP _ado_irls_fit(SEXP xSEXP, SEXP ySEXP, SEXP maskSEXP, SEXP weightsSEXP, SEXP trialsSEXP, SEXP offsetSEXP, SEXP familySEXP, SEXP linkSEXP, SEXP family_paramSEXP, SEXP link_paramSEXP, SEXP startSEXP, SEXP constantSEXP, SEXP null_modelSEXP, SEXP controlSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::List >::type x(xSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type y(ySEXP);
+    Rcpp::traits::input_parameter< SEXP >::type mask(maskSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type weights(weightsSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type trials(trialsSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type offset(offsetSEXP);
+    Rcpp::traits::input_parameter< std::string >::type family(familySEXP);
+    Rcpp::traits::input_parameter< std::string >::type link(linkSEXP);
+    Rcpp::traits::input_parameter< double >::type family_param(family_paramSEXP);
+    Rcpp::traits::input_parameter< double >::type link_param(link_paramSEXP);
+    Rcpp::traits::input_parameter< Rcpp::NumericVector >::type start(startSEXP);
+    Rcpp::traits::input_parameter< bool >::type constant(constantSEXP);
+    Rcpp::traits::input_parameter< bool >::type null_model(null_modelSEXP);
+    Rcpp::traits::input_parameter< Rcpp::List >::type control(controlSEXP);
+    rcpp_result_gen = Rcpp::wrap(irls_fit(x, y, mask, weights, trials, offset, family, link, family_param, link_param, start, constant, null_model, control));
+    return rcpp_result_gen;
+END_RCPP
+}
+// join_rows
+Rcpp::List join_rows(Rcpp::List master, Rcpp::List using_keys);
+RcppExport SEXP _ado_join_rows(SEXP masterSEXP, SEXP using_keysSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::List >::type master(masterSEXP);
+    Rcpp::traits::input_parameter< Rcpp::List >::type using_keys(using_keysSEXP);
+    rcpp_result_gen = Rcpp::wrap(join_rows(master, using_keys));
+    return rcpp_result_gen;
+END_RCPP
+}
+// ml_fit
+Rcpp::List ml_fit(Rcpp::List equations, SEXP y, SEXP mask, SEXP weights, SEXP offset, std::string model, Rcpp::NumericVector outcomes, Rcpp::NumericVector start, bool null_model, Rcpp::List control);
+RcppExport SEXP _ado_ml_fit(SEXP equationsSEXP, SEXP ySEXP, SEXP maskSEXP, SEXP weightsSEXP, SEXP offsetSEXP, SEXP modelSEXP, SEXP outcomesSEXP, SEXP startSEXP, SEXP null_modelSEXP, SEXP controlSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::List >::type equations(equationsSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type y(ySEXP);
+    Rcpp::traits::input_parameter< SEXP >::type mask(maskSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type weights(weightsSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type offset(offsetSEXP);
+    Rcpp::traits::input_parameter< std::string >::type model(modelSEXP);
+    Rcpp::traits::input_parameter< Rcpp::NumericVector >::type outcomes(outcomesSEXP);
+    Rcpp::traits::input_parameter< Rcpp::NumericVector >::type start(startSEXP);
+    Rcpp::traits::input_parameter< bool >::type null_model(null_modelSEXP);
+    Rcpp::traits::input_parameter< Rcpp::List >::type control(controlSEXP);
+    rcpp_result_gen = Rcpp::wrap(ml_fit(equations, y, mask, weights, offset, model, outcomes, start, null_model, control));
+    return rcpp_result_gen;
+END_RCPP
+}
+// bin_values
+Rcpp::IntegerVector bin_values(SEXP x, Rcpp::NumericVector cuts, bool closed);
+RcppExport SEXP _ado_bin_values(SEXP xSEXP, SEXP cutsSEXP, SEXP closedSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type x(xSEXP);
+    Rcpp::traits::input_parameter< Rcpp::NumericVector >::type cuts(cutsSEXP);
+    Rcpp::traits::input_parameter< bool >::type closed(closedSEXP);
+    rcpp_result_gen = Rcpp::wrap(bin_values(x, cuts, closed));
+    return rcpp_result_gen;
+END_RCPP
+}
+// ols_fit
+Rcpp::List ols_fit(Rcpp::List x, SEXP y, SEXP mask, SEXP weights, bool constant, bool robust, bool frequency);
+RcppExport SEXP _ado_ols_fit(SEXP xSEXP, SEXP ySEXP, SEXP maskSEXP, SEXP weightsSEXP, SEXP constantSEXP, SEXP robustSEXP, SEXP frequencySEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::List >::type x(xSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type y(ySEXP);
+    Rcpp::traits::input_parameter< SEXP >::type mask(maskSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type weights(weightsSEXP);
+    Rcpp::traits::input_parameter< bool >::type constant(constantSEXP);
+    Rcpp::traits::input_parameter< bool >::type robust(robustSEXP);
+    Rcpp::traits::input_parameter< bool >::type frequency(frequencySEXP);
+    rcpp_result_gen = Rcpp::wrap(ols_fit(x, y, mask, weights, constant, robust, frequency));
+    return rcpp_result_gen;
+END_RCPP
+}
+// expand_rows
+Rcpp::List expand_rows(Rcpp::List cols, Rcpp::NumericVector counts);
+RcppExport SEXP _ado_expand_rows(SEXP colsSEXP, SEXP countsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::List >::type cols(colsSEXP);
+    Rcpp::traits::input_parameter< Rcpp::NumericVector >::type counts(countsSEXP);
+    rcpp_result_gen = Rcpp::wrap(expand_rows(cols, counts));
+    return rcpp_result_gen;
+END_RCPP
+}
+// tile_rows
+Rcpp::List tile_rows(Rcpp::List cols, double each, double nout);
+RcppExport SEXP _ado_tile_rows(SEXP colsSEXP, SEXP eachSEXP, SEXP noutSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::List >::type cols(colsSEXP);
+    Rcpp::traits::input_parameter< double >::type each(eachSEXP);
+    Rcpp::traits::input_parameter< double >::type nout(noutSEXP);
+    rcpp_result_gen = Rcpp::wrap(tile_rows(cols, each, nout));
+    return rcpp_result_gen;
+END_RCPP
+}
+// gather_rows
+Rcpp::List gather_rows(Rcpp::List cols, Rcpp::IntegerVector rows);
+RcppExport SEXP _ado_gather_rows(SEXP colsSEXP, SEXP rowsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::List >::type cols(colsSEXP);
+    Rcpp::traits::input_parameter< Rcpp::IntegerVector >::type rows(rowsSEXP);
+    rcpp_result_gen = Rcpp::wrap(gather_rows(cols, rows));
+    return rcpp_result_gen;
+END_RCPP
+}
+// fillin_rows
+Rcpp::List fillin_rows(Rcpp::List codes, Rcpp::List values);
+RcppExport SEXP _ado_fillin_rows(SEXP codesSEXP, SEXP valuesSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::List >::type codes(codesSEXP);
+    Rcpp::traits::input_parameter< Rcpp::List >::type values(valuesSEXP);
+    rcpp_result_gen = Rcpp::wrap(fillin_rows(codes, values));
+    return rcpp_result_gen;
+END_RCPP
+}
+// reshape_wide_index
+Rcpp::List reshape_wide_index(Rcpp::List i_cols, Rcpp::List j_col, Rcpp::List constant);
+RcppExport SEXP _ado_reshape_wide_index(SEXP i_colsSEXP, SEXP j_colSEXP, SEXP constantSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::List >::type i_cols(i_colsSEXP);
+    Rcpp::traits::input_parameter< Rcpp::List >::type j_col(j_colSEXP);
+    Rcpp::traits::input_parameter< Rcpp::List >::type constant(constantSEXP);
+    rcpp_result_gen = Rcpp::wrap(reshape_wide_index(i_cols, j_col, constant));
+    return rcpp_result_gen;
+END_RCPP
+}
+// reshape_gather
+Rcpp::List reshape_gather(Rcpp::List cols, Rcpp::IntegerVector cell, Rcpp::IntegerVector i_order, Rcpp::IntegerVector j_order);
+RcppExport SEXP _ado_reshape_gather(SEXP colsSEXP, SEXP cellSEXP, SEXP i_orderSEXP, SEXP j_orderSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::List >::type cols(colsSEXP);
+    Rcpp::traits::input_parameter< Rcpp::IntegerVector >::type cell(cellSEXP);
+    Rcpp::traits::input_parameter< Rcpp::IntegerVector >::type i_order(i_orderSEXP);
+    Rcpp::traits::input_parameter< Rcpp::IntegerVector >::type j_order(j_orderSEXP);
+    rcpp_result_gen = Rcpp::wrap(reshape_gather(cols, cell, i_order, j_order));
+    return rcpp_result_gen;
+END_RCPP
+}
+// reshape_interleave
+Rcpp::List reshape_interleave(Rcpp::List parts, double n);
+RcppExport SEXP _ado_reshape_interleave(SEXP partsSEXP, SEXP nSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::List >::type parts(partsSEXP);
+    Rcpp::traits::input_parameter< double >::type n(nSEXP);
+    rcpp_result_gen = Rcpp::wrap(reshape_interleave(parts, n));
+    return rcpp_result_gen;
+END_RCPP
+}
+// sample_mask
+Rcpp::LogicalVector sample_mask(SEXP ids, int ngroups, SEXP mask, double size, bool count, Rcpp::IntegerVector seed, R_xlen_t nrow);
+RcppExport SEXP _ado_sample_mask(SEXP idsSEXP, SEXP ngroupsSEXP, SEXP maskSEXP, SEXP sizeSEXP, SEXP countSEXP, SEXP seedSEXP, SEXP nrowSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type ids(idsSEXP);
+    Rcpp::traits::input_parameter< int >::type ngroups(ngroupsSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type mask(maskSEXP);
+    Rcpp::traits::input_parameter< double >::type size(sizeSEXP);
+    Rcpp::traits::input_parameter< bool >::type count(countSEXP);
+    Rcpp::traits::input_parameter< Rcpp::IntegerVector >::type seed(seedSEXP);
+    Rcpp::traits::input_parameter< R_xlen_t >::type nrow(nrowSEXP);
+    rcpp_result_gen = Rcpp::wrap(sample_mask(ids, ngroups, mask, size, count, seed, nrow));
+    return rcpp_result_gen;
+END_RCPP
+}
+// split_strings
+Rcpp::List split_strings(Rcpp::CharacterVector x, std::vector<std::string> parse, int limit, bool trim, SEXP mask, bool destring, std::string ignore, bool percent, bool force);
+RcppExport SEXP _ado_split_strings(SEXP xSEXP, SEXP parseSEXP, SEXP limitSEXP, SEXP trimSEXP, SEXP maskSEXP, SEXP destringSEXP, SEXP ignoreSEXP, SEXP percentSEXP, SEXP forceSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::CharacterVector >::type x(xSEXP);
+    Rcpp::traits::input_parameter< std::vector<std::string> >::type parse(parseSEXP);
+    Rcpp::traits::input_parameter< int >::type limit(limitSEXP);
+    Rcpp::traits::input_parameter< bool >::type trim(trimSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type mask(maskSEXP);
+    Rcpp::traits::input_parameter< bool >::type destring(destringSEXP);
+    Rcpp::traits::input_parameter< std::string >::type ignore(ignoreSEXP);
+    Rcpp::traits::input_parameter< bool >::type percent(percentSEXP);
+    Rcpp::traits::input_parameter< bool >::type force(forceSEXP);
+    rcpp_result_gen = Rcpp::wrap(split_strings(x, parse, limit, trim, mask, destring, ignore, percent, force));
+    return rcpp_result_gen;
+END_RCPP
+}
+// summarize_columns
+Rcpp::List summarize_columns(Rcpp::List cols, SEXP mask, SEXP weights, bool distinct);
+RcppExport SEXP _ado_summarize_columns(SEXP colsSEXP, SEXP maskSEXP, SEXP weightsSEXP, SEXP distinctSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::List >::type cols(colsSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type mask(maskSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type weights(weightsSEXP);
+    Rcpp::traits::input_parameter< bool >::type distinct(distinctSEXP);
+    rcpp_result_gen = Rcpp::wrap(summarize_columns(cols, mask, weights, distinct));
+    return rcpp_result_gen;
+END_RCPP
+}
+// column_percentiles
+Rcpp::List column_percentiles(SEXP x, SEXP mask, SEXP weights, Rcpp::NumericVector p, int nextreme, bool altdef);
+RcppExport SEXP _ado_column_percentiles(SEXP xSEXP, SEXP maskSEXP, SEXP weightsSEXP, SEXP pSEXP, SEXP nextremeSEXP, SEXP altdefSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type x(xSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type mask(maskSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type weights(weightsSEXP);
+    Rcpp::traits::input_parameter< Rcpp::NumericVector >::type p(pSEXP);
+    Rcpp::traits::input_parameter< int >::type nextreme(nextremeSEXP);
+    Rcpp::traits::input_parameter< bool >::type altdef(altdefSEXP);
+    rcpp_result_gen = Rcpp::wrap(column_percentiles(x, mask, weights, p, nextreme, altdef));
+    return rcpp_result_gen;
+END_RCPP
+}
+// tabulate_cells
+Rcpp::List tabulate_cells(Rcpp::List keys, SEXP mask, SEXP weights, Rcpp::List values, Rcpp::NumericVector p, bool missing, R_xlen_t nrow);
+RcppExport SEXP _ado_tabulate_cells(SEXP keysSEXP, SEXP maskSEXP, SEXP weightsSEXP, SEXP valuesSEXP, SEXP pSEXP, SEXP missingSEXP, SEXP nrowSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::List >::type keys(keysSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type mask(maskSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type weights(weightsSEXP);
+    Rcpp::traits::input_parameter< Rcpp::List >::type values(valuesSEXP);
+    Rcpp::traits::input_parameter< Rcpp::NumericVector >::type p(pSEXP);
+    Rcpp::traits::input_parameter< bool >::type missing(missingSEXP);
+    Rcpp::traits::input_parameter< R_xlen_t >::type nrow(nrowSEXP);
+    rcpp_result_gen = Rcpp::wrap(tabulate_cells(keys, mask, weights, values, p, missing, nrow));
+    return rcpp_result_gen;
+END_RCPP
+}
+// key_status
+std::string key_status(Rcpp::List cols, bool missok);
+RcppExport SEXP _ado_key_status(SEXP colsSEXP, SEXP missokSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::List >::type cols(colsSEXP);
+    Rcpp::traits::input_parameter< bool >::type missok(missokSEXP);
+    rcpp_result_gen = Rcpp::wrap(key_status(cols, missok));
+    return rcpp_result_gen;
+END_RCPP
+}
 
 RcppExport SEXP run_testthat_tests();
 RcppExport SEXP _rcpp_module_boot_class_ParseDriver();
 
 static const R_CallMethodDef CallEntries[] = {
+    {"_ado_concat_columns", (DL_FUNC) &_ado_concat_columns, 3},
+    {"_ado_assign_where", (DL_FUNC) &_ado_assign_where, 3},
+    {"_ado_fits_integer", (DL_FUNC) &_ado_fits_integer, 2},
+    {"_ado_group_starts", (DL_FUNC) &_ado_group_starts, 1},
+    {"_ado_collapse_data", (DL_FUNC) &_ado_collapse_data, 7},
+    {"_ado_group_stat", (DL_FUNC) &_ado_group_stat, 5},
+    {"_ado_parse_numbers", (DL_FUNC) &_ado_parse_numbers, 4},
+    {"_ado_format_numbers", (DL_FUNC) &_ado_format_numbers, 2},
+    {"_ado_cross_products", (DL_FUNC) &_ado_cross_products, 4},
+    {"_ado_delimited_header", (DL_FUNC) &_ado_delimited_header, 3},
+    {"_ado_sniff_delimiter", (DL_FUNC) &_ado_sniff_delimiter, 2},
+    {"_ado_read_delimited", (DL_FUNC) &_ado_read_delimited, 4},
+    {"_ado_map_dta", (DL_FUNC) &_ado_map_dta, 4},
+    {"_ado_mapped_state", (DL_FUNC) &_ado_mapped_state, 1},
+    {"_ado_dta_info", (DL_FUNC) &_ado_dta_info, 1},
+    {"_ado_read_dta", (DL_FUNC) &_ado_read_dta, 8},
+    {"_ado_write_dta", (DL_FUNC) &_ado_write_dta, 9},
+    {"_ado_group_index", (DL_FUNC) &_ado_group_index, 1},
+    {"_ado_group_rank", (DL_FUNC) &_ado_group_rank, 4},
+    {"_ado_group_tag", (DL_FUNC) &_ado_group_tag, 2},
+    {"_ado_group_seq", (DL_FUNC) &_ado_group_seq, 5},
+    {"_ado_encode_strings", (DL_FUNC) &_ado_encode_strings, 3},
+    {"_ado_decode_codes", (DL_FUNC) &_ado_decode_codes, 3},
+    {"_ado_irls_fit", (DL_FUNC) &_ado_irls_fit, 14},
+    {"_ado_join_rows", (DL_FUNC) &_ado_join_rows, 2},
+    {"_ado_ml_fit", (DL_FUNC) &_ado_ml_fit, 10},
+    {"_ado_bin_values", (DL_FUNC) &_ado_bin_values, 3},
+    {"_ado_ols_fit", (DL_FUNC) &_ado_ols_fit, 7},
+    {"_ado_expand_rows", (DL_FUNC) &_ado_expand_rows, 2},
+    {"_ado_tile_rows", (DL_FUNC) &_ado_tile_rows, 3},
+    {"_ado_gather_rows", (DL_FUNC) &_ado_gather_rows, 2},
+    {"_ado_fillin_rows", (DL_FUNC) &_ado_fillin_rows, 2},
+    {"_ado_reshape_wide_index", (DL_FUNC) &_ado_reshape_wide_index, 3},
+    {"_ado_reshape_gather", (DL_FUNC) &_ado_reshape_gather, 4},
+    {"_ado_reshape_interleave", (DL_FUNC) &_ado_reshape_interleave, 2},
+    {"_ado_sample_mask", (DL_FUNC) &_ado_sample_mask, 7},
+    {"_ado_split_strings", (DL_FUNC) &_ado_split_strings, 9},
+    {"_ado_summarize_columns", (DL_FUNC) &_ado_summarize_columns, 4},
+    {"_ado_column_percentiles", (DL_FUNC) &_ado_column_percentiles, 6},
+    {"_ado_tabulate_cells", (DL_FUNC) &_ado_tabulate_cells, 7},
+    {"_ado_key_status", (DL_FUNC) &_ado_key_status, 2},
     {"_rcpp_module_boot_class_ParseDriver", (DL_FUNC) &_rcpp_module_boot_class_ParseDriver, 0},
     {"run_testthat_tests", (DL_FUNC) &run_testthat_tests, 0},
     {NULL, NULL, 0}
 };
 
+void init_dta_mapped(DllInfo* dll);
 RcppExport void R_init_ado(DllInfo *dll) {
     R_registerRoutines(dll, NULL, CallEntries, NULL, NULL);
     R_useDynamicSymbols(dll, FALSE);
+    init_dta_mapped(dll);
 }
@@ -0,0 +1,390 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <Rcpp.h>
+#include "CrossProducts.hpp"
+#include "LinearAlgebra.hpp"
+#include "NumericColumns.hpp"
+#include "Parallel.hpp"
+
+/*
+ * Ordinary (weighted) least squares for regress, streamed from the
+ * dataset's columns without building a design matrix. The rows used are
+ * the ones selected with a nonzero weight and no missing values, and the
+ * fit takes up to three parallel passes over them, each thread keeping its
+ * own sums over its range of rows, which are added up in order:
+ *
+ *     o) the count, total weight and weighted means of the variables;
+ *     o) the cross products of the variables' deviations from their means
+ *        (or, without a constant, of the variables themselves), gathered a
+ *        chunk of rows at a time and added up in tiles by cross_add() (see
+ *        CrossProducts.hpp), which gives X'X and X'y;
+ *     o) with robust, the "meat" of the sandwich estimator, from the
+ *        residuals of the fit.
+ *
+ * Centering keeps the cross products well conditioned when a variable's
+ * mean is large next to its spread. The normal equations are solved by a
+ * Cholesky factorization that takes the variables in order and pivots any
+ * that are collinear with the ones before it (that add almost nothing to
+ * the diagonal) out of the model, as Stata does; if what's left is still
+ * badly conditioned, it's solved with a Householder QR instead.
+ */
+
+namespace {
+
+// Each thread should get at least this many rows
+const R_xlen_t MIN_ROWS_PER_THREAD = 1 << 14;
+
+// Rows gathered into a buffer at a time
+const size_t CHUNK_ROWS = 256;
+
+// The threads' accumulators together hold at most this many doubles
+const size_t MAX_ACCUMULATED = (size_t) 1 << 24;
+
+// A variable is collinear with the ones before it if less than this
+// fraction of its (uncentered) sum of squares is left after taking them
+// out, and the system is badly conditioned, so that QR is used, if any
+// variable has less than COND_TOL left
+const double COLLINEAR_TOL = 1e-13;
+const double COND_TOL = 1e-8;
+
+// The rows of [lo, hi) the fit uses, and their weights
+void
+usable_rows(const std::vector<NumericColumn> &cols, const int *mp, const double *wp,
+            R_xlen_t lo, R_xlen_t hi, std::vector<R_xlen_t> &rows,
+            std::vector<double> &wts)
+{
+    rows.clear();
+    wts.clear();
+
+    for(R_xlen_t i = lo; i < hi; i++)
+    {
+        double wt = weight_of(wp, i);
+        if(!selected(mp, i) || wt == 0)
+            continue;
+
+        bool complete = true;
+        for(size_t j = 0; j < cols.size() && complete; j++)
+            complete = !std::isnan(cols[j].value(i));
+
+        if(complete)
+        {
+            rows.push_back(i);
+            wts.push_back(wt);
+        }
+    }
+}
+
+} // namespace
+
+// Regress the numeric vector y on the numeric columns x, over the rows mask
+// selects (every row if it's NULL) with no missing values and nonzero
+// weights, weighted by weights (if not NULL), with a constant term unless
+// constant is false. Returns a list: b, the coefficients of x (0 for the
+// ones omitted, which omitted says); cons, the constant's; inv, the
+// inverse of X'WX with the constant last (if any), rows and columns of
+// zeros for the omitted variables; robust, if asked for, the robust variance
+// (that inverse on either side of the sum of the squared weighted
+// residuals times x'x, or with frequency, of the weights times the squared
+// residuals, as each row stands for that many); obs, sum_w, rss, the residual sum of squares, tss,
+// the total (about the mean with a constant); rank, and method, the
+// factorization used ("cholesky" or "qr").
+// [[Rcpp::export]]
+Rcpp::List
+ols_fit(Rcpp::List x, SEXP y, SEXP mask, SEXP weights, bool constant, bool robust,
+        bool frequency)
+{
+    size_t k = (size_t) x.size(), p = k + 1;
+    R_xlen_t n = Rf_xlength(y);
+
+    std::vector<NumericColumn> cs(p);
+    for(size_t j = 0; j < k; j++)
+        cs[j] = numeric_column(x[j], n, "An independent variable");
+    cs[k] = numeric_column(y, n, "The dependent variable");
+
+    if(!Rf_isNull(mask) && (TYPEOF(mask) != LGLSXP || Rf_xlength(mask) != n))
+        Rcpp::stop("Mask must be a logical vector with one element per row");
+    if(!Rf_isNull(weights) && (TYPEOF(weights) != REALSXP || Rf_xlength(weights) != n))
+        Rcpp::stop("Weights must be a double vector with one element per row");
+
+    const int *mp = Rf_isNull(mask) ? NULL : LOGICAL(mask);
+    const double *wp = Rf_isNull(weights) ? NULL : REAL(weights);
+
+    size_t pp = p * p;
+    int nthreads = std::min(ado_threads_for(n, MIN_ROWS_PER_THREAD),
+                            (int) std::max(MAX_ACCUMULATED / pp, (size_t) 1));
+
+    // The count, weight and weighted sums of the variables
+    std::vector<double> obs(nthreads, 0), tw(nthreads, 0), sums(nthreads * p, 0);
+
+    #pragma omp parallel for schedule(static, 1) num_threads(nthreads)
+    for(int t = 0; t < nthreads; t++)
+    {
+        R_xlen_t lo = n * t / nthreads, hi = n * (t + 1) / nthreads;
+        std::vector<R_xlen_t> rows;
+        std::vector<double> wts;
+
+        for(R_xlen_t c = lo; c < hi; c += CHUNK_ROWS)
+        {
+            usable_rows(cs, mp, wp, c, std::min(c + (R_xlen_t) CHUNK_ROWS, hi), rows, wts);
+
+            for(size_t r = 0; r < rows.size(); r++)
+            {
+                obs[t]++;
+                tw[t] += wts[r];
+                for(size_t j = 0; j < p; j++)
+                    sums[t * p + j] += wts[r] * cs[j].value(rows[r]);
+            }
+        }
+    }
+
+    double N = 0, W = 0;
+    std::vector<double> mean(p, 0);
+    for(int t = 0; t < nthreads; t++)
+    {
+        N += obs[t];
+        W += tw[t];
+        for(size_t j = 0; j < p; j++)
+            mean[j] += sums[t * p + j];
+    }
+    for(size_t j = 0; j < p; j++)
+        mean[j] = constant && W != 0 ? mean[j] / W : 0;
+
+    if(N == 0)
+        Rcpp::stop("No observations");
+
+    // The cross products of the deviations, weighted on one side
+    std::vector<double> cross(nthreads * pp, 0);
+
+    #pragma omp parallel for schedule(static, 1) num_threads(nthreads)
+    for(int t = 0; t < nthreads; t++)
+    {
+        R_xlen_t lo = n * t / nthreads, hi = n * (t + 1) / nthreads;
+        size_t ld = CHUNK_ROWS;
+        std::vector<R_xlen_t> rows;
+        std::vector<double> wts, dev(p * ld), wdev(p * ld);
+
+        for(R_xlen_t c = lo; c < hi; c += CHUNK_ROWS)
+        {
+            usable_rows(cs, mp, wp, c, std::min(c + (R_xlen_t) CHUNK_ROWS, hi), rows, wts);
+            size_t nr = rows.size();
+            if(nr == 0)
+                continue;
+
+            for(size_t j = 0; j < p; j++)
+            {
+                for(size_t r = 0; r < nr; r++)
+                {
+                    double d = cs[j].value(rows[r]) - mean[j];
+                    dev[j * ld + r] = d;
+                    wdev[j * ld + r] = wts[r] * d;
+                }
+            }
+
+            cross_add(&wdev[0], p, &dev[0], p, ld, nr, &cross[t * pp], true);
+        }
+    }
+
+    std::vector<double> a(pp, 0);
+    for(int t = 0; t < nthreads; t++)
+        for(size_t h = 0; h < pp; h++)
+            a[h] += cross[t * pp + h];
+    symmetrize(&a[0], p);
+
+    // Cholesky, taking the variables in order and leaving out the ones
+    // collinear with those already in, relative to their uncentered sums
+    // of squares
+    std::vector<double> scale(k);
+    for(size_t j = 0; j < k; j++)
+        scale[j] = a[j * p + j] + W * mean[j] * mean[j];
+
+    std::vector<size_t> kept;
+    std::vector<double> l;
+    double worst = cholesky_in_order(&a[0], p, k, k > 0 ? &scale[0] : NULL,
+                                     COLLINEAR_TOL, kept, l);
+
+    std::vector<bool> omitted(k, true);
+    for(size_t i = 0; i < kept.size(); i++)
+        omitted[kept[i]] = false;
+
+    // The kept part of X'X, in a dense m x m matrix, and its inverse
+    size_t m = kept.size();
+    std::vector<double> inv_kept;
+    bool use_qr = worst < COND_TOL;
+
+    if(m > 0)
+    {
+        if(use_qr)
+        {
+            std::vector<double> ak(m * m);
+            for(size_t i = 0; i < m; i++)
+                for(size_t j = 0; j < m; j++)
+                    ak[i * m + j] = a[kept[i] * p + kept[j]];
+
+            inv_kept = inverse_by_qr(ak, m);
+        } else
+            inv_kept = cholesky_inverse(l, m);
+    }
+
+    // The coefficients: by forward and back substitution with the
+    // Cholesky factor, which also gives the residual sum of squares as
+    // what is left of y'y, or from the inverse when that came by QR
+    std::vector<double> b(k, 0), xy(m);
+    double cons = mean[k], rss = a[k * p + k];
+    for(size_t i = 0; i < m; i++)
+        xy[i] = a[kept[i] * p + k];
+
+    if(use_qr)
+    {
+        for(size_t i = 0; i < m; i++)
+        {
+            double s = 0;
+            for(size_t j = 0; j < m; j++)
+                s += inv_kept[i * m + j] * xy[j];
+            b[kept[i]] = s;
+            rss -= s * xy[i];
+        }
+    } else
+    {
+        std::vector<double> z = forward_solve(l, m, xy);
+        for(size_t i = 0; i < m; i++)
+            rss -= z[i] * z[i];
+
+        std::vector<double> bk = back_solve(l, m, z);
+        for(size_t i = 0; i < m; i++)
+            b[kept[i]] = bk[i];
+    }
+
+    for(size_t j = 0; j < k; j++)
+        cons -= mean[j] * b[j];
+    rss = std::max(rss, 0.0);
+
+    // The inverse of X'WX in terms of the uncentered variables: the
+    // constant adds 1 / W, and covariances of -inv * mean with the slopes
+    size_t q = k + (constant ? 1 : 0);
+    Rcpp::NumericMatrix inv(q, q);
+    for(size_t i = 0; i < m; i++)
+        for(size_t j = 0; j < m; j++)
+            inv(kept[i], kept[j]) = inv_kept[i * m + j];
+
+    if(constant)
+    {
+        double vc = 1 / W;
+        for(size_t i = 0; i < k; i++)
+        {
+            double s = 0;
+            for(size_t j = 0; j < k; j++)
+                s += inv(i, j) * mean[j];
+
+            inv(i, k) = inv(k, i) = -s;
+            vc += s * mean[i];
+        }
+        inv(k, k) = vc;
+    }
+
+    Rcpp::List ret = Rcpp::List::create(
+        Rcpp::Named("b") = Rcpp::NumericVector(b.begin(), b.end()),
+        Rcpp::Named("cons") = constant ? cons : NA_REAL,
+        Rcpp::Named("omitted") = Rcpp::LogicalVector(omitted.begin(), omitted.end()),
+        Rcpp::Named("inv") = inv,
+        Rcpp::Named("obs") = N,
+        Rcpp::Named("sum_w") = W,
+        Rcpp::Named("rss") = rss,
+        Rcpp::Named("tss") = a[k * p + k],
+        Rcpp::Named("rank") = (double) (m + (constant ? 1 : 0)),
+        Rcpp::Named("method") = use_qr ? "qr" : "cholesky");
+
+    if(!robust)
+        return ret;
+
+    // The meat: the sum over rows of (w e)^2 x'x (w e^2 x'x for frequency
+    // weights), in terms of the
+    // deviations and a constant, and then the sandwich in those terms,
+    // brought back to the uncentered variables as inv was
+    std::vector<double> meat(nthreads * q * q, 0);
+
+    #pragma omp parallel for schedule(static, 1) num_threads(nthreads)
+    for(int t = 0; t < nthreads; t++)
+    {
+        R_xlen_t lo = n * t / nthreads, hi = n * (t + 1) / nthreads;
+        size_t ld = CHUNK_ROWS;
+        std::vector<R_xlen_t> rows;
+        std::vector<double> wts, dev(q * ld), udev(q * ld);
+
+        for(R_xlen_t c = lo; c < hi; c += CHUNK_ROWS)
+        {
+            usable_rows(cs, mp, wp, c, std::min(c + (R_xlen_t) CHUNK_ROWS, hi), rows, wts);
+            size_t nr = rows.size();
+            if(nr == 0)
+                continue;
+
+            for(size_t r = 0; r < nr; r++)
+            {
+                double e = cs[k].value(rows[r]) - mean[k];
+                for(size_t j = 0; j < k; j++)
+                {
+                    dev[j * ld + r] = cs[j].value(rows[r]) - mean[j];
+                    e -= b[j] * dev[j * ld + r];
+                }
+                if(constant)
+                    dev[k * ld + r] = 1;
+
+                double u2 = (frequency ? 1 : wts[r]) * wts[r] * e * e;
+                for(size_t j = 0; j < q; j++)
+                    udev[j * ld + r] = u2 * dev[j * ld + r];
+            }
+
+            cross_add(&udev[0], q, &dev[0], q, ld, nr, &meat[t * q * q], true);
+        }
+    }
+
+    std::vector<double> mt(q * q, 0);
+    for(int t = 0; t < nthreads; t++)
+        for(size_t h = 0; h < q * q; h++)
+            mt[h] += meat[t * q * q + h];
+    symmetrize(&mt[0], q);
+
+    // The bread in the centered terms is the inverse of the deviations'
+    // X'WX, with 1 / W for the constant and nothing between them
+    std::vector<double> bread(q * q, 0), jac(q * q, 0);
+    for(size_t i = 0; i < m; i++)
+        for(size_t j = 0; j < m; j++)
+            bread[kept[i] * q + kept[j]] = inv_kept[i * m + j];
+    if(constant)
+        bread[k * q + k] = 1 / W;
+
+    // The centered slopes are the same, and the constant is the centered
+    // one less mean'b
+    for(size_t i = 0; i < q; i++)
+        jac[i * q + i] = 1;
+    if(constant)
+        for(size_t j = 0; j < k; j++)
+            jac[k * q + j] = -mean[j];
+
+    // jac bread meat bread jac'
+    std::vector<double> jb(q * q, 0), left(q * q, 0);
+    for(size_t i = 0; i < q; i++)
+        for(size_t j = 0; j < q; j++)
+            for(size_t h = 0; h < q; h++)
+                jb[i * q + j] += jac[i * q + h] * bread[h * q + j];
+    for(size_t i = 0; i < q; i++)
+        for(size_t j = 0; j < q; j++)
+            for(size_t h = 0; h < q; h++)
+                left[i * q + j] += jb[i * q + h] * mt[h * q + j];
+
+    Rcpp::NumericMatrix sandwich(q, q);
+    for(size_t i = 0; i < q; i++)
+    {
+        for(size_t j = 0; j < q; j++)
+        {
+            double s = 0;
+            for(size_t h = 0; h < q; h++)
+                s += left[i * q + h] * jb[j * q + h];
+            sandwich(i, j) = s;
+        }
+    }
+
+    ret["robust"] = sandwich;
+    return ret;
+}
@@ -0,0 +1,352 @@
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <Rcpp.h>
+#include "Parallel.hpp"
+
+/*
+ * Row replication for the commands that make a dataset bigger: expand,
+ * fillin, cross and joinby. Each of them first works out the size of the
+ * result and which input row every output row comes from, as a "layout",
+ * and then every column is copied into one new vector of that size with a
+ * parallel gather. No command grows a column more than once or builds a
+ * column's values piecemeal in R.
+ *
+ * There are three layouts:
+ *
+ *     o) Expand: row i appears count[i] times, the first copy in place and
+ *        the others after all the original rows. The output positions come
+ *        from a prefix sum over the counts.
+ *     o) Tile: the n input rows each repeated "each" times, and the whole
+ *        sequence repeated until the output is full. This is one side of a
+ *        cartesian product, or one key column of a full grid.
+ *     o) Index: an explicit source row for every output row, or NA for a
+ *        missing value, as the pairs from a join give.
+ */
+
+namespace {
+
+// Each thread should get at least this many rows
+const R_xlen_t MIN_ROWS_PER_THREAD = 1 << 16;
+
+class ExpandLayout
+{
+public:
+    // The counts must already be whole numbers of at least 1
+    explicit ExpandLayout(const std::vector<R_xlen_t> &counts)
+        : n((R_xlen_t) counts.size()), off(counts.size() + 1)
+    {
+        off[0] = n;
+        for(R_xlen_t i = 0; i < n; i++)
+            off[i + 1] = off[i] + counts[i] - 1;
+    }
+
+    R_xlen_t size() const { return off[n]; }
+
+    template <class T>
+    void
+    fill(const T *x, T *out, T, int nthreads) const
+    {
+        #pragma omp parallel for num_threads(nthreads)
+        for(R_xlen_t i = 0; i < n; i++)
+        {
+            out[i] = x[i];
+            std::fill(out + off[i], out + off[i + 1], x[i]);
+        }
+    }
+
+    void
+    fill_strings(SEXP x, SEXP out) const
+    {
+        for(R_xlen_t i = 0; i < n; i++)
+        {
+            SEXP s = STRING_ELT(x, i);
+
+            SET_STRING_ELT(out, i, s);
+            for(R_xlen_t r = off[i]; r < off[i + 1]; r++)
+                SET_STRING_ELT(out, r, s);
+        }
+    }
+
+private:
+    R_xlen_t n;
+    std::vector<R_xlen_t> off;
+};
+
+class TileLayout
+{
+public:
+    TileLayout(R_xlen_t n, R_xlen_t each, R_xlen_t nout)
+        : n(n), each(each), nout(nout)
+    { }
+
+    R_xlen_t size() const { return nout; }
+    R_xlen_t source(R_xlen_t r) const { return (r / each) % n; }
+
+    template <class T>
+    void
+    fill(const T *x, T *out, T, int nthreads) const
+    {
+        #pragma omp parallel for num_threads(nthreads)
+        for(R_xlen_t r = 0; r < nout; r++)
+            out[r] = x[source(r)];
+    }
+
+    void
+    fill_strings(SEXP x, SEXP out) const
+    {
+        for(R_xlen_t r = 0; r < nout; r++)
+            SET_STRING_ELT(out, r, STRING_ELT(x, source(r)));
+    }
+
+private:
+    R_xlen_t n, each, nout;
+};
+
+class IndexLayout
+{
+public:
+    // Row numbers from 1, or NA, as R has them
+    IndexLayout(const int *rows, R_xlen_t nout)
+        : rows(rows), nout(nout)
+    { }
+
+    R_xlen_t size() const { return nout; }
+
+    template <class T>
+    void
+    fill(const T *x, T *out, T na, int nthreads) const
+    {
+        #pragma omp parallel for num_threads(nthreads)
+        for(R_xlen_t r = 0; r < nout; r++)
+            out[r] = rows[r] == NA_INTEGER ? na : x[rows[r] - 1];
+    }
+
+    void
+    fill_strings(SEXP x, SEXP out) const
+    {
+        for(R_xlen_t r = 0; r < nout; r++)
+            SET_STRING_ELT(out, r, rows[r] == NA_INTEGER ? NA_STRING
+                                                         : STRING_ELT(x, rows[r] - 1));
+    }
+
+private:
+    const int *rows;
+    R_xlen_t nout;
+};
+
+bool
+gatherable(SEXP x)
+{
+    switch(TYPEOF(x))
+    {
+        case INTSXP:
+        case LGLSXP:
+        case REALSXP:
+        case STRSXP:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+// One column laid out as layout says, keeping its attributes (a factor's
+// levels, say)
+template <class Layout>
+SEXP
+gather_column(SEXP x, const Layout &layout)
+{
+    R_xlen_t nout = layout.size();
+    int nthreads = ado_threads_for(nout, MIN_ROWS_PER_THREAD);
+
+    SEXPTYPE type = (SEXPTYPE) TYPEOF(x);
+    SEXP out = PROTECT(Rf_allocVector(type, nout));
+
+    if(type == INTSXP)
+        layout.fill(INTEGER(x), INTEGER(out), NA_INTEGER, nthreads);
+    else if(type == LGLSXP)
+        layout.fill(LOGICAL(x), LOGICAL(out), NA_LOGICAL, nthreads);
+    else if(type == REALSXP)
+        layout.fill(REAL(x), REAL(out), NA_REAL, nthreads);
+    else
+        layout.fill_strings(x, out);
+
+    Rf_copyMostAttrib(x, out);
+
+    UNPROTECT(1);
+    return out;
+}
+
+template <class Layout>
+Rcpp::List
+gather_columns(Rcpp::List cols, const Layout &layout)
+{
+    for(R_xlen_t j = 0; j < cols.size(); j++)
+        if(!gatherable(cols[j]))
+            Rcpp::stop("Cannot replicate a column of this type");
+
+    Rcpp::List ret(cols.size());
+    for(R_xlen_t j = 0; j < cols.size(); j++)
+        ret[j] = gather_column(cols[j], layout);
+
+    ret.names() = cols.names();
+    return ret;
+}
+
+// All the columns must have nrow elements
+void
+check_lengths(Rcpp::List cols, R_xlen_t nrow)
+{
+    for(R_xlen_t j = 0; j < cols.size(); j++)
+        if(Rf_xlength(cols[j]) != nrow)
+            Rcpp::stop("Columns differ in length");
+}
+
+} // namespace
+
+// The columns in cols with row i repeated counts[i] times: each original
+// row stays where it is, and its copies follow all the original rows, in
+// order. A missing count or one less than 1 counts as 1, and fractions are
+// dropped.
+// [[Rcpp::export]]
+Rcpp::List
+expand_rows(Rcpp::List cols, Rcpp::NumericVector counts)
+{
+    R_xlen_t n = counts.size();
+    check_lengths(cols, n);
+
+    std::vector<R_xlen_t> reps(n);
+    double total = 0;
+    for(R_xlen_t i = 0; i < n; i++)
+    {
+        double c = counts[i];
+        reps[i] = std::isnan(c) || c < 1 ? 1
+                  : (R_xlen_t) std::floor(std::min(c, (double) R_XLEN_T_MAX));
+        total += (double) reps[i];
+    }
+
+    if(total > (double) R_XLEN_T_MAX)
+        Rcpp::stop("Too many rows to expand to");
+
+    return gather_columns(cols, ExpandLayout(reps));
+}
+
+// The columns in cols, of n rows, with each row repeated each times in
+// turn, and that repeated until there are nout rows. Both sides of a
+// cartesian product are tiles of their datasets: the first with each set
+// to the size of the second, and the second with each set to 1.
+// [[Rcpp::export]]
+Rcpp::List
+tile_rows(Rcpp::List cols, double each, double nout)
+{
+    if(cols.size() == 0)
+        return cols;
+
+    R_xlen_t n = Rf_xlength(cols[0]);
+    check_lengths(cols, n);
+
+    if(nout > (double) R_XLEN_T_MAX)
+        Rcpp::stop("Too many rows");
+    if(nout > 0 && (n == 0 || each < 1))
+        Rcpp::stop("Nothing to tile");
+
+    return gather_columns(cols, TileLayout(n, (R_xlen_t) each, (R_xlen_t) nout));
+}
+
+// The columns in cols taken at the row numbers in rows (from 1), with NA
+// giving a missing value
+// [[Rcpp::export]]
+Rcpp::List
+gather_rows(Rcpp::List cols, Rcpp::IntegerVector rows)
+{
+    if(cols.size() == 0)
+        return cols;
+
+    R_xlen_t n = Rf_xlength(cols[0]);
+    check_lengths(cols, n);
+
+    const int *rp = INTEGER(rows);
+    for(R_xlen_t r = 0; r < rows.size(); r++)
+        if(rp[r] != NA_INTEGER && (rp[r] < 1 || rp[r] > n))
+            Rcpp::stop("Row number out of range");
+
+    return gather_columns(cols, IndexLayout(rp, rows.size()));
+}
+
+// Lay out the full grid of every combination of the key values for
+// fillin. codes holds, for each key, every row's value as a position (from
+// 1) in that key's sorted distinct values, which are in values. The output
+// has each combination in order, the first key varying slowest, with the
+// rows that have it, or one new row if none do. Returns a list: src, the
+// input row (from 1) of each output row, NA for the new ones, and keys, the
+// key columns of the output.
+// [[Rcpp::export]]
+Rcpp::List
+fillin_rows(Rcpp::List codes, Rcpp::List values)
+{
+    R_xlen_t nkeys = codes.size();
+    if(nkeys == 0 || values.size() != nkeys)
+        Rcpp::stop("Key codes and values don't correspond");
+
+    R_xlen_t n = Rf_xlength(codes[0]);
+    check_lengths(codes, n);
+
+    // The cell of a combination is its position in the grid, from 0
+    std::vector<R_xlen_t> stride(nkeys), size(nkeys);
+    double ncells = 1;
+    for(R_xlen_t j = nkeys - 1; j >= 0; j--)
+    {
+        size[j] = Rf_xlength(values[j]);
+        stride[j] = (R_xlen_t) ncells;
+        ncells *= size[j];
+    }
+
+    if(ncells > INT_MAX)
+        Rcpp::stop("Too many combinations of the key values");
+
+    std::vector<int> cell(n), count((size_t) ncells, 0);
+    for(R_xlen_t j = 0; j < nkeys; j++)
+    {
+        const int *cp = INTEGER(codes[j]);
+
+        for(R_xlen_t i = 0; i < n; i++)
+            cell[i] += (cp[i] - 1) * (int) stride[j];
+    }
+    for(R_xlen_t i = 0; i < n; i++)
+        count[cell[i]]++;
+
+    // Each cell gets max(1, its count) rows; fill them in row order
+    std::vector<R_xlen_t> off((size_t) ncells + 1, 0);
+    for(size_t c = 0; c < (size_t) ncells; c++)
+        off[c + 1] = off[c] + (count[c] > 0 ? count[c] : 1);
+
+    R_xlen_t nout = off[(size_t) ncells];
+    Rcpp::IntegerVector src(nout, NA_INTEGER);
+    std::vector<int> cell_of(nout);
+
+    for(size_t c = 0; c < (size_t) ncells; c++)
+        for(R_xlen_t r = off[c]; r < off[c + 1]; r++)
+            cell_of[r] = (int) c;
+    for(R_xlen_t i = 0; i < n; i++)
+        src[off[cell[i]]++] = (int) i + 1;
+
+    // Each key column's value positions, from the cells
+    Rcpp::List keys(nkeys);
+    for(R_xlen_t j = 0; j < nkeys; j++)
+    {
+        Rcpp::IntegerVector pos(Rcpp::no_init(nout));
+        for(R_xlen_t r = 0; r < nout; r++)
+            pos[r] = (int) ((cell_of[r] / stride[j]) % size[j]) + 1;
+
+        Rcpp::List one = gather_columns(Rcpp::List::create(values[j]),
+                                        IndexLayout(INTEGER(pos), nout));
+        keys[j] = one[0];
+    }
+
+    return Rcpp::List::create(Rcpp::Named("src") = src,
+                              Rcpp::Named("keys") = keys);
+}
@@ -0,0 +1,342 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include <Rcpp.h>
+#include "Columns.hpp"
+#include "Grouping.hpp"
+#include "Parallel.hpp"
+
+/*
+ * The data movement behind reshape. Going wide, the i and j keys are each
+ * numbered by group in one scan, and a dense i-by-j table of row numbers
+ * (the cell index) says where each wide value comes from; a second (i, j)
+ * landing in an occupied cell is a duplicate. The wide columns are then
+ * gathered from the cell index, all stubs at once. Going long, the wide
+ * columns of each stub are interleaved into one long column.
+ */
+
+namespace {
+
+// Each thread should get at least this many values to move
+const size_t MIN_PER_THREAD = 1 << 16;
+
+// At most this many duplicate rows are reported
+const size_t MAX_DUPLICATES = 20;
+
+// Raw access to a column being gathered from or interleaved, set up on
+// the main thread
+struct Column
+{
+    SEXPTYPE type;
+    const int *itg;
+    const double *dbl;
+};
+
+Column
+column_of(SEXP x)
+{
+    Column c = { (SEXPTYPE) TYPEOF(x), NULL, NULL };
+
+    switch(c.type)
+    {
+        case LGLSXP: c.itg = LOGICAL(x); break;
+        case INTSXP: c.itg = INTEGER(x); break;
+        case REALSXP: c.dbl = REAL(x); break;
+        case STRSXP: break;
+        default: Rcpp::stop("Cannot reshape a column of this type");
+    }
+
+    return c;
+}
+
+// An output column of length n, and raw pointers to it
+struct Output
+{
+    SEXP vec;
+    int *itg;
+    double *dbl;
+};
+
+Output
+make_output(SEXPTYPE type, R_xlen_t n)
+{
+    Output o = { Rf_allocVector(type, n), NULL, NULL };
+
+    if(type == LGLSXP)
+        o.itg = LOGICAL(o.vec);
+    else if(type == INTSXP)
+        o.itg = INTEGER(o.vec);
+    else if(type == REALSXP)
+        o.dbl = REAL(o.vec);
+
+    return o;
+}
+
+} // namespace
+
+// Index long data for reshape wide. The i groups are the distinct values
+// of the columns in i_cols and the j groups those of j_col, both numbered
+// in order of first appearance. Returns a list:
+//     o) i_rows, j_rows: the first row (from 1) of each i and j group;
+//     o) cell: for i group g and j group k, element k * ni + g is the row
+//        holding that combination, or NA;
+//     o) duplicates: rows whose (i, j) combination occurs more than once
+//        (some of them, if there are many);
+//     o) varying: for each column in constant, whether it takes more than
+//        one value within some i group.
+// [[Rcpp::export]]
+Rcpp::List
+reshape_wide_index(Rcpp::List i_cols, Rcpp::List j_col, Rcpp::List constant)
+{
+    KeyColumns ik(i_cols), jk(j_col);
+    size_t n = ik.nrow();
+
+    if(jk.nrow() != n)
+        Rcpp::stop("i and j variables differ in length");
+
+    int nthreads = ado_threads_for(n, MIN_PER_THREAD);
+    Groups gi = find_groups(ik, nthreads), gj = find_groups(jk, nthreads);
+    size_t ni = gi.count(), nj = gj.count();
+
+    if(nj > 0 && ni > (size_t) R_XLEN_T_MAX / nj)
+        Rcpp::stop("Too many i and j combinations");
+
+    // Claim each row's cell; losing the race for one means a duplicate
+    std::vector<std::atomic<int> > cell(ni * nj);
+
+    #pragma omp parallel for num_threads(nthreads)
+    for(R_xlen_t c = 0; c < (R_xlen_t) (ni * nj); c++)
+        cell[c].store(-1, std::memory_order_relaxed);
+
+    std::vector<int> dups;
+
+    #pragma omp parallel num_threads(nthreads)
+    {
+        std::vector<int> mine;
+
+        #pragma omp for
+        for(R_xlen_t r = 0; r < (R_xlen_t) n; r++)
+        {
+            int expected = -1;
+            size_t c = (size_t) gj.id[r] * ni + gi.id[r];
+
+            if(!cell[c].compare_exchange_strong(expected, (int) r) &&
+               mine.size() < MAX_DUPLICATES)
+            {
+                mine.push_back((int) r);
+                mine.push_back(expected);
+            }
+        }
+
+        #pragma omp critical
+        dups.insert(dups.end(), mine.begin(), mine.end());
+    }
+
+    // Other variables must be constant within i
+    Rcpp::LogicalVector varying(constant.size());
+    for(R_xlen_t v = 0; v < constant.size(); v++)
+    {
+        KeyColumns kc(Rcpp::List::create(constant[v]));
+        std::atomic<bool> differs(false);
+
+        #pragma omp parallel for num_threads(nthreads)
+        for(R_xlen_t r = 0; r < (R_xlen_t) n; r++)
+            if(!kc.equal(r, gi.first[gi.id[r]]))
+                differs.store(true, std::memory_order_relaxed);
+
+        varying[v] = (bool) differs;
+    }
+
+    Rcpp::IntegerVector i_rows(ni), j_rows(nj);
+    for(size_t g = 0; g < ni; g++)
+        i_rows[g] = (int) gi.first[g] + 1;
+    for(size_t k = 0; k < nj; k++)
+        j_rows[k] = (int) gj.first[k] + 1;
+
+    Rcpp::IntegerVector cells(Rcpp::no_init(ni * nj));
+    int *cp = INTEGER(cells);
+
+    #pragma omp parallel for num_threads(nthreads)
+    for(R_xlen_t c = 0; c < (R_xlen_t) (ni * nj); c++)
+    {
+        int r = cell[c].load(std::memory_order_relaxed);
+        cp[c] = r < 0 ? NA_INTEGER : r + 1;
+    }
+
+    std::sort(dups.begin(), dups.end());
+    dups.erase(std::unique(dups.begin(), dups.end()), dups.end());
+    for(size_t k = 0; k < dups.size(); k++)
+        dups[k]++;
+
+    return Rcpp::List::create(Rcpp::Named("i_rows") = i_rows,
+                              Rcpp::Named("j_rows") = j_rows,
+                              Rcpp::Named("cell") = cells,
+                              Rcpp::Named("duplicates") = Rcpp::wrap(dups),
+                              Rcpp::Named("varying") = varying);
+}
+
+// Build the wide columns from the cell index of reshape_wide_index, for
+// every column in cols at once. Output column k of a stub holds the
+// values for j group j_order[k], and its rows follow the i groups in
+// i_order (both counting from 1). Returns a list with, for each column in
+// cols, a list of its wide columns.
+// [[Rcpp::export]]
+Rcpp::List
+reshape_gather(Rcpp::List cols, Rcpp::IntegerVector cell,
+               Rcpp::IntegerVector i_order, Rcpp::IntegerVector j_order)
+{
+    R_xlen_t ni = i_order.size(), nj = j_order.size();
+    if(cell.size() != ni * nj)
+        Rcpp::stop("Cell index doesn't match the i and j groups");
+
+    const int *cp = INTEGER(cell), *io = INTEGER(i_order), *jo = INTEGER(j_order);
+    Rcpp::List ret(cols.size());
+
+    // Allocate everything up front, here on the main thread
+    std::vector<Column> src;
+    std::vector<Output> out;
+
+    for(R_xlen_t s = 0; s < cols.size(); s++)
+    {
+        Column c = column_of(cols[s]);
+        Rcpp::List wide(nj);
+
+        for(R_xlen_t k = 0; k < nj; k++)
+        {
+            Output o = make_output(c.type, ni);
+            wide[k] = o.vec;
+
+            src.push_back(c);
+            out.push_back(o);
+        }
+
+        ret[s] = wide;
+    }
+
+    // Strings have to be set through the R API, so serially
+    for(size_t c = 0; c < out.size(); c++)
+    {
+        if(src[c].type != STRSXP)
+            continue;
+
+        SEXP x = cols[c / nj];
+        const int *from = cp + (size_t) (jo[c % nj] - 1) * ni;
+
+        for(R_xlen_t g = 0; g < ni; g++)
+        {
+            int r = from[io[g] - 1];
+            SET_STRING_ELT(out[c].vec, g, r == NA_INTEGER ? NA_STRING : STRING_ELT(x, r - 1));
+        }
+    }
+
+    int nthreads = ado_threads_for(out.size() * ni, MIN_PER_THREAD);
+
+    #pragma omp parallel for collapse(2) schedule(static) num_threads(nthreads)
+    for(R_xlen_t c = 0; c < (R_xlen_t) out.size(); c++)
+    {
+        for(R_xlen_t g = 0; g < ni; g++)
+        {
+            const Column &s = src[c];
+            if(s.type == STRSXP)
+                continue;
+
+            int r = cp[(size_t) (jo[c % nj] - 1) * ni + io[g] - 1];
+
+            if(s.dbl)
+                out[c].dbl[g] = r == NA_INTEGER ? NA_REAL : s.dbl[r - 1];
+            else
+                out[c].itg[g] = r == NA_INTEGER ? NA_INTEGER : s.itg[r - 1];
+        }
+    }
+
+    return ret;
+}
+
+// Interleave wide columns into long ones for reshape long. parts has one
+// element per stub, a list of nj columns of length n (NULL for a j value
+// the stub lacks), all of one type. Row r's value for the k-th j value
+// goes to element r * nj + k of the stub's long column.
+// [[Rcpp::export]]
+Rcpp::List
+reshape_interleave(Rcpp::List parts, double n)
+{
+    R_xlen_t nrow = (R_xlen_t) n;
+    Rcpp::List ret(parts.size());
+
+    std::vector<std::vector<Column> > src(parts.size());
+    std::vector<Output> out;
+
+    for(R_xlen_t s = 0; s < parts.size(); s++)
+    {
+        Rcpp::List wide = parts[s];
+        R_xlen_t nj = wide.size();
+
+        SEXPTYPE type = NILSXP;
+        for(R_xlen_t k = 0; k < nj; k++)
+        {
+            SEXP x = wide[k];
+            if(Rf_isNull(x))
+            {
+                Column none = { NILSXP, NULL, NULL };
+                src[s].push_back(none);
+                continue;
+            }
+
+            if(Rf_xlength(x) != nrow)
+                Rcpp::stop("Wide columns differ in length");
+            if(type != NILSXP && (SEXPTYPE) TYPEOF(x) != type)
+                Rcpp::stop("Wide columns of a stub differ in type");
+
+            type = (SEXPTYPE) TYPEOF(x);
+            src[s].push_back(column_of(x));
+        }
+
+        if(type == NILSXP)
+            Rcpp::stop("Stub has no columns");
+
+        Output o = make_output(type, nrow * nj);
+        ret[s] = o.vec;
+        out.push_back(o);
+
+        if(type == STRSXP)
+        {
+            for(R_xlen_t r = 0; r < nrow; r++)
+            {
+                for(R_xlen_t k = 0; k < nj; k++)
+                {
+                    SEXP x = wide[k];
+                    SET_STRING_ELT(o.vec, r * nj + k,
+                                   Rf_isNull(x) ? NA_STRING : STRING_ELT(x, r));
+                }
+            }
+        }
+    }
+
+    int nthreads = ado_threads_for(nrow, MIN_PER_THREAD);
+
+    for(size_t s = 0; s < out.size(); s++)
+    {
+        const std::vector<Column> &cs = src[s];
+        R_xlen_t nj = cs.size();
+        const Output &o = out[s];
+
+        if(!o.itg && !o.dbl)
+            continue;
+
+        #pragma omp parallel for num_threads(nthreads)
+        for(R_xlen_t r = 0; r < nrow; r++)
+        {
+            for(R_xlen_t k = 0; k < nj; k++)
+            {
+                if(o.dbl)
+                    o.dbl[r * nj + k] = cs[k].type == NILSXP ? NA_REAL : cs[k].dbl[r];
+                else
+                    o.itg[r * nj + k] = cs[k].type == NILSXP ? NA_INTEGER : cs[k].itg[r];
+            }
+        }
+    }
+
+    return ret;
+}
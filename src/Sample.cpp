@@ -0,0 +1,140 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <Rcpp.h>
+
+/*
+ * Sampling rows without replacement for the sample command, in one pass
+ * over the data with no index vectors. Each stratum (by group) is sampled
+ * with Knuth's selection sampling (Algorithm S): a stratum's eligible rows
+ * are visited in order, and a row is taken with probability needed / left,
+ * where needed is how many more rows the stratum must supply and left how
+ * many of its eligible rows remain. This draws exactly the requested count
+ * from every stratum, each subset of that size equally likely, and all the
+ * state kept is two counters per stratum. The result is the mask of rows
+ * to keep, which goes straight to the compaction step.
+ *
+ * The random numbers come from xoshiro256**, seeded from R's generator by
+ * the caller, so that "set seed" makes a sample reproducible.
+ */
+
+namespace {
+
+class Xoshiro256
+{
+public:
+    explicit Xoshiro256(uint64_t seed)
+    {
+        // Fill the state with splitmix64, as the generator's authors advise
+        for(int k = 0; k < 4; k++)
+        {
+            seed += 0x9e3779b97f4a7c15ULL;
+
+            uint64_t z = seed;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            s[k] = z ^ (z >> 31);
+        }
+    }
+
+    uint64_t
+    next()
+    {
+        uint64_t result = rotl(s[1] * 5, 7) * 9;
+        uint64_t t = s[1] << 17;
+
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = rotl(s[3], 45);
+
+        return result;
+    }
+
+    // Uniform on [0, 1), from the top 53 bits
+    double
+    uniform()
+    {
+        return (next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+private:
+    uint64_t s[4];
+
+    static uint64_t
+    rotl(uint64_t x, int k)
+    {
+        return (x << k) | (x >> (64 - k));
+    }
+};
+
+// The stratum of row i, or 0 if it isn't eligible or isn't in any group
+inline int
+stratum_of(R_xlen_t i, const int *id, int ngroups, const int *mask)
+{
+    if(mask != NULL && (mask[i] == NA_LOGICAL || !mask[i]))
+        return 0;
+
+    int g = id == NULL ? 1 : id[i];
+    return g == NA_INTEGER || g < 1 || g > ngroups ? 0 : g;
+}
+
+} // namespace
+
+// Which rows to keep after sampling: rows not eligible (mask FALSE or NA)
+// are always kept, and of each stratum's eligible rows, size are kept if
+// count is true, or else size percent of them, rounded. ids numbers each
+// row's stratum from 1 to ngroups, as group_index does, with NA for rows
+// in none; if ids is NULL, all rows form one stratum. seed is two integers
+// from R's generator.
+// [[Rcpp::export]]
+Rcpp::LogicalVector
+sample_mask(SEXP ids, int ngroups, SEXP mask, double size, bool count,
+            Rcpp::IntegerVector seed, R_xlen_t nrow)
+{
+    if(!Rf_isNull(ids) && (TYPEOF(ids) != INTSXP || Rf_xlength(ids) != nrow))
+        Rcpp::stop("Group numbers must be an integer vector with one element per row");
+    if(!Rf_isNull(mask) && (TYPEOF(mask) != LGLSXP || Rf_xlength(mask) != nrow))
+        Rcpp::stop("Mask must be a logical vector with one element per row");
+    if(seed.size() != 2)
+        Rcpp::stop("Seed must have two elements");
+
+    const int *id = Rf_isNull(ids) ? NULL : INTEGER(ids);
+    const int *mp = Rf_isNull(mask) ? NULL : LOGICAL(mask);
+
+    // Stratum 0 holds the rows that are always kept
+    std::vector<double> left(ngroups + 1, 0), needed(ngroups + 1, 0);
+    for(R_xlen_t i = 0; i < nrow; i++)
+        left[stratum_of(i, id, ngroups, mp)]++;
+
+    for(int g = 1; g <= ngroups; g++)
+        needed[g] = count ? std::min(size, left[g])
+                          : std::floor(size / 100 * left[g] + 0.5);
+
+    uint64_t s = ((uint64_t) (uint32_t) seed[0] << 32) | (uint32_t) seed[1];
+    Xoshiro256 rng(s);
+
+    Rcpp::LogicalVector ret(Rcpp::no_init(nrow));
+    int *keep = LOGICAL(ret);
+
+    for(R_xlen_t i = 0; i < nrow; i++)
+    {
+        int g = stratum_of(i, id, ngroups, mp);
+        if(g == 0)
+        {
+            keep[i] = TRUE;
+            continue;
+        }
+
+        keep[i] = needed[g] > 0 && rng.uniform() * left[g] < needed[g];
+        if(keep[i])
+            needed[g]--;
+        left[g]--;
+    }
+
+    return ret;
+}
@@ -0,0 +1,249 @@
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <Rcpp.h>
+#include "Parallel.hpp"
+#include "TextParse.hpp"
+
+/*
+ * The splitter behind split. The string pointers are collected on the main
+ * thread, and then, in parallel:
+ *
+ *     o) a counting pass finds how many pieces each string has (up to the
+ *        limit), which gives the number of new columns and, by a prefix
+ *        sum, where each row's pieces go in one flat array of spans;
+ *     o) a second pass fills in the spans, and with destring, parses
+ *        each new column's pieces straight from the spans into a double
+ *        vector, counting the ones that aren't numbers.
+ *
+ * Only the columns that end up as strings get their CHARSXPs made, from
+ * the spans, back on the main thread. A single one-byte delimiter is found
+ * with memchr and two with SSE2 (see TextParse.hpp); longer or more
+ * delimiters are compared byte by byte.
+ */
+
+namespace {
+
+// Each thread should get at least this many rows
+const R_xlen_t MIN_ROWS_PER_THREAD = 1 << 14;
+
+struct Span
+{
+    const char *p;
+    size_t len;
+};
+
+class Splitter
+{
+public:
+    // Splitting on blanks treats a run of them as one delimiter
+    explicit Splitter(const std::vector<std::string> &delims)
+        : delims(delims), blanks(delims.size() == 1 && delims[0] == " ")
+    { }
+
+    // The pieces of [p, p + len), at most limit of them if limit > 0
+    template <class F>
+    size_t
+    each_piece(const char *p, size_t len, size_t limit, F f) const
+    {
+        const char *end = p + len;
+        size_t npieces = 0;
+
+        if(blanks)
+        {
+            while(p < end && *p == ' ')
+                p++;
+            if(p == end)
+                return 0;
+        }
+
+        while(limit == 0 || npieces < limit)
+        {
+            size_t dlen;
+            const char *d = next_delim(p, end, &dlen);
+
+            f(npieces++, p, (size_t) (d - p));
+            if(d == end)
+                break;
+
+            p = d + dlen;
+            if(blanks)
+            {
+                while(p < end && *p == ' ')
+                    p++;
+                if(p == end)
+                    break;
+            }
+        }
+
+        return npieces;
+    }
+
+private:
+    std::vector<std::string> delims;
+    bool blanks;
+
+    // The first delimiter in [p, end), or end
+    const char *
+    next_delim(const char *p, const char *end, size_t *dlen) const
+    {
+        *dlen = 1;
+
+        if(delims.size() == 1 && delims[0].size() == 1)
+            return find_byte(p, end, delims[0][0]);
+        if(delims.size() == 2 && delims[0].size() == 1 && delims[1].size() == 1)
+            return find_any2(p, end, delims[0][0], delims[1][0]);
+
+        for(; p < end; p++)
+        {
+            for(size_t k = 0; k < delims.size(); k++)
+            {
+                const std::string &d = delims[k];
+                if(d.size() <= (size_t) (end - p) && memcmp(p, d.data(), d.size()) == 0)
+                {
+                    *dlen = d.size();
+                    return p;
+                }
+            }
+        }
+
+        return end;
+    }
+};
+
+} // namespace
+
+// Split each string in x at any of the delimiters in parse into pieces,
+// at most limit of them if limit > 0, trimming blanks from the ends of
+// the strings first if trim is true. Rows mask leaves out (if it isn't
+// NULL) have no pieces. Returns a list of columns, one per piece position:
+// strings, with "" where a row has no such piece, or with destring,
+// numbers for any column whose pieces all are (or that force makes so),
+// parsed as destring's ignore() and percent say.
+// [[Rcpp::export]]
+Rcpp::List
+split_strings(Rcpp::CharacterVector x, std::vector<std::string> parse, int limit,
+              bool trim, SEXP mask, bool destring, std::string ignore,
+              bool percent, bool force)
+{
+    R_xlen_t n = x.size();
+    if(!Rf_isNull(mask) && (TYPEOF(mask) != LGLSXP || Rf_xlength(mask) != n))
+        Rcpp::stop("Mask must be a logical vector with one element per row");
+    const int *mp = Rf_isNull(mask) ? NULL : LOGICAL(mask);
+
+    for(size_t k = 0; k < parse.size(); k++)
+        if(parse[k].empty())
+            Rcpp::stop("Empty parse string");
+    if(parse.empty())
+        Rcpp::stop("No parse strings");
+
+    Splitter splitter(parse);
+    size_t lim = limit > 0 ? (size_t) limit : 0;
+
+    std::vector<Span> cells(n);
+    std::vector<cetype_t> enc(n);
+    for(R_xlen_t i = 0; i < n; i++)
+    {
+        SEXP s = STRING_ELT(x, i);
+        enc[i] = Rf_getCharCE(s);
+        bool skip = s == NA_STRING || (mp != NULL && (mp[i] == NA_LOGICAL || !mp[i]));
+
+        cells[i].p = skip ? NULL : CHAR(s);
+        cells[i].len = skip ? 0 : (size_t) LENGTH(s);
+
+        if(!skip && trim)
+            trim_span(cells[i].p, cells[i].len);
+    }
+
+    int nthreads = ado_threads_for(n, MIN_ROWS_PER_THREAD);
+
+    // Count the pieces
+    std::vector<size_t> off(n + 1, 0);
+    size_t ncols = 0;
+
+    #pragma omp parallel for num_threads(nthreads) reduction(max:ncols)
+    for(R_xlen_t i = 0; i < n; i++)
+    {
+        size_t k = 0;
+        if(cells[i].p != NULL)
+            k = splitter.each_piece(cells[i].p, cells[i].len, lim,
+                                    [](size_t, const char *, size_t) { });
+
+        off[i + 1] = k;
+        ncols = std::max(ncols, k);
+    }
+
+    for(R_xlen_t i = 0; i < n; i++)
+        off[i + 1] += off[i];
+
+    // Find them
+    std::vector<Span> pieces(off[n]);
+
+    #pragma omp parallel for num_threads(nthreads)
+    for(R_xlen_t i = 0; i < n; i++)
+    {
+        if(cells[i].p == NULL)
+            continue;
+
+        Span *row = &pieces[off[i]];
+        splitter.each_piece(cells[i].p, cells[i].len, lim,
+                            [row](size_t k, const char *p, size_t len)
+                            { row[k].p = p; row[k].len = len; });
+    }
+
+    Rcpp::List ret(ncols);
+    NumberSyntax syntax(ignore, percent, false);
+
+    for(size_t j = 0; j < ncols; j++)
+    {
+        if(destring)
+        {
+            Rcpp::NumericVector values(Rcpp::no_init(n));
+            double *out = REAL(values);
+            size_t bad = 0;
+
+            #pragma omp parallel num_threads(nthreads) reduction(+:bad)
+            {
+                std::string scratch;
+
+                #pragma omp for schedule(static)
+                for(R_xlen_t i = 0; i < n; i++)
+                {
+                    NumberSyntax::Cell c = NumberSyntax::CELL_MISSING;
+                    if(off[i] + j < off[i + 1])
+                    {
+                        const Span &s = pieces[off[i] + j];
+                        c = syntax.parse(s.p, s.len, scratch, &out[i]);
+                    }
+
+                    if(c != NumberSyntax::CELL_NUMBER)
+                        out[i] = NA_REAL;
+                    if(c == NumberSyntax::CELL_BAD)
+                        bad++;
+                }
+            }
+
+            if(bad == 0 || force)
+            {
+                ret[j] = values;
+                continue;
+            }
+        }
+
+        Rcpp::CharacterVector strings(n);
+        for(R_xlen_t i = 0; i < n; i++)
+        {
+            if(off[i] + j >= off[i + 1])
+                continue;
+
+            const Span &s = pieces[off[i] + j];
+            SET_STRING_ELT(strings, i, Rf_mkCharLenCE(s.p, (int) s.len, enc[i]));
+        }
+
+        ret[j] = strings;
+    }
+
+    return ret;
+}
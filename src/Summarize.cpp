@@ -0,0 +1,449 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include <Rcpp.h>
+#include "Hashing.hpp"
+#include "NumericColumns.hpp"
+#include "Parallel.hpp"
+#include "Statistics.hpp"
+
+/*
+ * The column scan behind summarize, codebook and describe. Every statistic
+ * they show comes from one pass over each column: the count of nonmissing
+ * and missing values, the sum of the weights, the mean and the second to
+ * fourth central moments (updated as each value arrives, in the manner of
+ * Welford, so no second pass over the data is needed for the variance,
+ * skewness or kurtosis), the minimum and maximum, the longest string and
+ * an estimate of the number of distinct values.
+ *
+ * The work is cut into (column, chunk) pieces: with many columns each
+ * column is one piece, and with few, each column is split into chunks so
+ * that all the threads have something to do, either way in one parallel
+ * loop. The pieces of a column are then merged in order with the pairwise
+ * update formulas for the moments (Chan et al., Pebay), which give the same
+ * result as a single pass up to rounding.
+ *
+ * The distinct values are counted with a HyperLogLog sketch, 4096 one-byte
+ * registers per piece, merged by taking the maximum of each register. Its
+ * error is under about 2% and it is exact in practice for the small counts
+ * codebook usually sees.
+ *
+ * The percentiles summarize shows with detail are order statistics, found
+ * by selection (see select_ranks() in Statistics.hpp) rather than by
+ * sorting the column.
+ */
+
+namespace {
+
+// Each thread should get at least this many rows
+const R_xlen_t MIN_ROWS_PER_THREAD = 1 << 15;
+
+// log2 of the number of HyperLogLog registers
+const int HLL_BITS = 12;
+const size_t HLL_SIZE = (size_t) 1 << HLL_BITS;
+
+class Sketch
+{
+public:
+    void enable() { reg.assign(HLL_SIZE, 0); }
+    bool enabled() const { return !reg.empty(); }
+
+    void
+    add(uint64_t h)
+    {
+        size_t i = (size_t) (h >> (64 - HLL_BITS));
+        uint64_t rest = (h << HLL_BITS) | ((uint64_t) 1 << (HLL_BITS - 1));
+        uint8_t rank = (uint8_t) (__builtin_clzll(rest) + 1);
+
+        if(rank > reg[i])
+            reg[i] = rank;
+    }
+
+    void
+    merge(const Sketch &b)
+    {
+        for(size_t i = 0; i < reg.size(); i++)
+            reg[i] = std::max(reg[i], b.reg[i]);
+    }
+
+    // The estimated number of distinct values added, with linear counting
+    // for small numbers
+    double
+    estimate() const
+    {
+        double m = (double) HLL_SIZE, sum = 0, zeros = 0;
+        for(size_t i = 0; i < reg.size(); i++)
+        {
+            sum += std::ldexp(1.0, -reg[i]);
+            if(reg[i] == 0)
+                zeros++;
+        }
+
+        double e = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+        if(e <= 2.5 * m && zeros > 0)
+            e = m * std::log(m / zeros);
+
+        return std::floor(e + 0.5);
+    }
+
+private:
+    std::vector<uint8_t> reg;
+};
+
+// Everything found for one piece of a column
+struct Scan
+{
+    Moments mom;
+    double obs, nmiss, min, max, maxlen;
+    Sketch distinct;
+
+    Scan() : obs(0), nmiss(0), min(R_PosInf), max(R_NegInf), maxlen(0) { }
+
+    void
+    merge(const Scan &b)
+    {
+        mom.merge(b.mom);
+        obs += b.obs;
+        nmiss += b.nmiss;
+        min = std::min(min, b.min);
+        max = std::max(max, b.max);
+        maxlen = std::max(maxlen, b.maxlen);
+
+        if(distinct.enabled())
+            distinct.merge(b.distinct);
+    }
+};
+
+// A column as the scan sees it: the data pointers are taken on the main
+// thread, and strings as their CHARSXPs, whose addresses identify them
+struct Column
+{
+    enum Kind { INT, REAL, STR, OTHER } kind;
+    const int *ip;
+    const double *dp;
+    std::vector<SEXP> strs;
+    std::vector<int> lens;
+};
+
+inline uint64_t
+hash_double(double x)
+{
+    uint64_t bits;
+
+    x = x == 0 ? 0 : x; // -0 and 0 are the same value
+    std::memcpy(&bits, &x, sizeof(bits));
+
+    return hash_mix(bits);
+}
+
+void
+scan_piece(const Column &c, R_xlen_t begin, R_xlen_t end, const int *mp,
+           const double *wp, Scan &s)
+{
+    for(R_xlen_t i = begin; i < end; i++)
+    {
+        if(!selected(mp, i))
+            continue;
+
+        double wt = weight_of(wp, i);
+        if(wt == 0)
+            continue;
+
+        if(c.kind == Column::STR)
+        {
+            SEXP str = c.strs[i];
+            if(str == NA_STRING || c.lens[i] == 0)
+            {
+                s.nmiss++;
+                continue;
+            }
+
+            s.obs++;
+            s.mom.w += wt;
+            s.maxlen = std::max(s.maxlen, (double) c.lens[i]);
+            if(s.distinct.enabled())
+                s.distinct.add(hash_mix((uint64_t) (uintptr_t) str));
+
+            continue;
+        }
+
+        double x;
+        if(c.kind == Column::INT)
+            x = c.ip[i] == NA_INTEGER ? NA_REAL : (double) c.ip[i];
+        else
+            x = c.dp[i];
+
+        if(std::isnan(x))
+        {
+            s.nmiss++;
+            continue;
+        }
+
+        s.obs++;
+        s.mom.add(x, wt);
+        s.min = std::min(s.min, x);
+        s.max = std::max(s.max, x);
+        if(s.distinct.enabled())
+            s.distinct.add(hash_double(x));
+    }
+}
+
+Column
+column_of(SEXP x)
+{
+    Column c;
+    c.ip = NULL;
+    c.dp = NULL;
+
+    switch(TYPEOF(x))
+    {
+        case INTSXP:
+        case LGLSXP:
+            c.kind = Column::INT;
+            c.ip = TYPEOF(x) == INTSXP ? INTEGER(x) : LOGICAL(x);
+            break;
+
+        case REALSXP:
+            c.kind = Column::REAL;
+            c.dp = REAL(x);
+            break;
+
+        case STRSXP:
+        {
+            R_xlen_t n = Rf_xlength(x);
+
+            c.kind = Column::STR;
+            c.strs.resize(n);
+            c.lens.resize(n);
+            for(R_xlen_t i = 0; i < n; i++)
+            {
+                SEXP s = STRING_ELT(x, i);
+
+                c.strs[i] = s;
+                c.lens[i] = s == NA_STRING ? 0 : LENGTH(s);
+            }
+            break;
+        }
+
+        default:
+            c.kind = Column::OTHER;
+    }
+
+    return c;
+}
+
+} // namespace
+
+// Scan the columns in cols, all of one length, using only the rows mask
+// selects (if it isn't NULL) and weighting each by weights (if that isn't
+// NULL; rows with a missing or zero weight are left out). Factors count as
+// their codes and logicals as 0 and 1; strings are missing if empty, and
+// have only counts, lengths and distinct values. With distinct, the number
+// of distinct nonmissing values is estimated. Returns a list of vectors
+// with an element per column: obs and nmiss, the numbers of nonmissing and
+// missing values, sum_w, mean, and m2, m3 and m4, the weighted sums of the
+// squared, cubed and fourth-power deviations from the mean, min, max,
+// maxlen, the length in bytes of the longest string, and distinct (NA
+// without distinct).
+// [[Rcpp::export]]
+Rcpp::List
+summarize_columns(Rcpp::List cols, SEXP mask, SEXP weights, bool distinct)
+{
+    R_xlen_t ncols = cols.size();
+    R_xlen_t n = ncols > 0 ? Rf_xlength(cols[0]) : 0;
+
+    std::vector<Column> columns(ncols);
+    for(R_xlen_t j = 0; j < ncols; j++)
+    {
+        if(Rf_xlength(cols[j]) != n)
+            Rcpp::stop("Columns differ in length");
+        columns[j] = column_of(cols[j]);
+    }
+
+    if(!Rf_isNull(mask) && (TYPEOF(mask) != LGLSXP || Rf_xlength(mask) != n))
+        Rcpp::stop("Mask must be a logical vector with one element per row");
+    if(!Rf_isNull(weights) && (TYPEOF(weights) != REALSXP || Rf_xlength(weights) != n))
+        Rcpp::stop("Weights must be a double vector with one element per row");
+
+    const int *mp = Rf_isNull(mask) ? NULL : LOGICAL(mask);
+    const double *wp = Rf_isNull(weights) ? NULL : REAL(weights);
+
+    // Enough pieces to keep every thread busy, none smaller than the
+    // minimum a thread should get
+    int nthreads = ado_threads_for(n * std::max(ncols, (R_xlen_t) 1), MIN_ROWS_PER_THREAD);
+    R_xlen_t nchunks = 1;
+    if(ncols > 0 && ncols < nthreads)
+    {
+        nchunks = (nthreads + ncols - 1) / ncols;
+        nchunks = std::max((R_xlen_t) 1, std::min(nchunks, n / MIN_ROWS_PER_THREAD));
+    }
+
+    R_xlen_t npieces = ncols * nchunks;
+    std::vector<Scan> pieces(npieces);
+    if(distinct)
+    {
+        for(R_xlen_t p = 0; p < npieces; p++)
+            pieces[p].distinct.enable();
+    }
+
+    #pragma omp parallel for schedule(dynamic) num_threads(nthreads)
+    for(R_xlen_t p = 0; p < npieces; p++)
+    {
+        R_xlen_t j = p / nchunks, k = p % nchunks;
+        if(columns[j].kind == Column::OTHER)
+            continue;
+
+        scan_piece(columns[j], n * k / nchunks, n * (k + 1) / nchunks, mp, wp,
+                   pieces[p]);
+    }
+
+    Rcpp::NumericVector obs(ncols), nmiss(ncols), sum_w(ncols), mean(ncols),
+                        m2(ncols), m3(ncols), m4(ncols), min(ncols), max(ncols),
+                        maxlen(ncols), ndistinct(ncols);
+
+    for(R_xlen_t j = 0; j < ncols; j++)
+    {
+        Scan &s = pieces[j * nchunks];
+        for(R_xlen_t k = 1; k < nchunks; k++)
+            s.merge(pieces[j * nchunks + k]);
+
+        bool numeric = columns[j].kind == Column::INT || columns[j].kind == Column::REAL;
+        bool any = s.obs > 0;
+
+        obs[j] = s.obs;
+        nmiss[j] = s.nmiss;
+        sum_w[j] = s.mom.w;
+        mean[j] = numeric && any ? s.mom.mean : NA_REAL;
+        m2[j] = numeric && any ? s.mom.m2 : NA_REAL;
+        m3[j] = numeric && any ? s.mom.m3 : NA_REAL;
+        m4[j] = numeric && any ? s.mom.m4 : NA_REAL;
+        min[j] = numeric && any ? s.min : NA_REAL;
+        max[j] = numeric && any ? s.max : NA_REAL;
+        maxlen[j] = columns[j].kind == Column::STR ? s.maxlen : NA_REAL;
+        ndistinct[j] = !distinct ? NA_REAL : (any ? s.distinct.estimate() : 0);
+    }
+
+    return Rcpp::List::create(Rcpp::Named("obs") = obs,
+                              Rcpp::Named("nmiss") = nmiss,
+                              Rcpp::Named("sum_w") = sum_w,
+                              Rcpp::Named("mean") = mean,
+                              Rcpp::Named("m2") = m2,
+                              Rcpp::Named("m3") = m3,
+                              Rcpp::Named("m4") = m4,
+                              Rcpp::Named("min") = min,
+                              Rcpp::Named("max") = max,
+                              Rcpp::Named("maxlen") = maxlen,
+                              Rcpp::Named("distinct") = ndistinct);
+}
+
+// The percentiles p (in percent) of the nonmissing values of the numeric
+// vector x in the rows mask selects (if it isn't NULL), with Stata's
+// definition: the value at the position p/100 of the way through the
+// cumulative weights (every weight 1 if weights is NULL), or the average
+// of the two values either side if that falls exactly between them. Also
+// the nextreme smallest and largest values. Without weights these are
+// all found by selection; with them the values are sorted. With altdef,
+// the percentiles use Stata's alternative definition instead, which
+// interpolates and can't be weighted. Returns a list: pctiles, smallest
+// and largest (in increasing and decreasing order).
+// [[Rcpp::export]]
+Rcpp::List
+column_percentiles(SEXP x, SEXP mask, SEXP weights, Rcpp::NumericVector p,
+                   int nextreme, bool altdef)
+{
+    R_xlen_t n = Rf_xlength(x);
+    if(TYPEOF(x) != INTSXP && TYPEOF(x) != LGLSXP && TYPEOF(x) != REALSXP)
+        Rcpp::stop("Percentiles of a column that isn't numeric");
+    if(!Rf_isNull(mask) && (TYPEOF(mask) != LGLSXP || Rf_xlength(mask) != n))
+        Rcpp::stop("Mask must be a logical vector with one element per row");
+    if(!Rf_isNull(weights) && (TYPEOF(weights) != REALSXP || Rf_xlength(weights) != n))
+        Rcpp::stop("Weights must be a double vector with one element per row");
+    if(altdef && !Rf_isNull(weights))
+        Rcpp::stop("Percentiles by the alternative definition can't be weighted");
+
+    const int *mp = Rf_isNull(mask) ? NULL : LOGICAL(mask);
+    const double *wp = Rf_isNull(weights) ? NULL : REAL(weights);
+    Column c = column_of(x);
+
+    std::vector<double> v;
+    std::vector<std::pair<double, double> > vw;
+    for(R_xlen_t i = 0; i < n; i++)
+    {
+        double wt = weight_of(wp, i);
+        if(!selected(mp, i) || wt == 0)
+            continue;
+
+        double val = c.kind == Column::INT
+                   ? (c.ip[i] == NA_INTEGER ? NA_REAL : (double) c.ip[i])
+                   : c.dp[i];
+        if(std::isnan(val))
+            continue;
+
+        if(wp == NULL)
+            v.push_back(val);
+        else
+            vw.push_back(std::make_pair(val, wt));
+    }
+
+    R_xlen_t m = wp == NULL ? (R_xlen_t) v.size() : (R_xlen_t) vw.size();
+    R_xlen_t next = std::min((R_xlen_t) std::max(nextreme, 0), m);
+    Rcpp::NumericVector pctiles(p.size(), NA_REAL), smallest(next), largest(next);
+
+    if(m == 0)
+    {
+        return Rcpp::List::create(Rcpp::Named("pctiles") = pctiles,
+                                  Rcpp::Named("smallest") = smallest,
+                                  Rcpp::Named("largest") = largest);
+    }
+
+    if(wp == NULL)
+    {
+        // Every rank any answer needs, so one round of selection finds them
+        std::vector<size_t> ranks;
+        for(R_xlen_t k = 0; k < p.size(); k++)
+        {
+            if(altdef)
+                altdef_ranks(v.size(), p[k], ranks);
+            else
+                percentile_ranks(v.size(), p[k], ranks);
+        }
+        for(R_xlen_t k = 0; k < next; k++)
+        {
+            ranks.push_back(k);
+            ranks.push_back(m - 1 - k);
+        }
+
+        select_ranks(v, ranks);
+
+        for(R_xlen_t k = 0; k < p.size(); k++)
+            pctiles[k] = altdef ? altdef_percentile(v, p[k]) : selected_percentile(v, p[k]);
+        for(R_xlen_t k = 0; k < next; k++)
+        {
+            smallest[k] = v[k];
+            largest[k] = v[m - 1 - k];
+        }
+    } else
+    {
+        std::sort(vw.begin(), vw.end());
+
+        double W = 0;
+        for(R_xlen_t i = 0; i < m; i++)
+            W += vw[i].second;
+
+        for(R_xlen_t k = 0; k < p.size(); k++)
+            pctiles[k] = weighted_percentile(vw, W, p[k]);
+        for(R_xlen_t k = 0; k < next; k++)
+        {
+            smallest[k] = vw[k].first;
+            largest[k] = vw[m - 1 - k].first;
+        }
+    }
+
+    return Rcpp::List::create(Rcpp::Named("pctiles") = pctiles,
+                              Rcpp::Named("smallest") = smallest,
+                              Rcpp::Named("largest") = largest);
+}
@@ -0,0 +1,474 @@
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <Rcpp.h>
+#include "Columns.hpp"
+#include "Grouping.hpp"
+#include "Parallel.hpp"
+#include "Statistics.hpp"
+
+/*
+ * The frequency engine behind tabulate, tab1, tab2, table and tabstat. A
+ * table is a set of cells, one per distinct combination of the key
+ * columns' values, each with its count, its sum of weights and, for
+ * tabstat and table, the moments, extremes and percentiles of some value
+ * columns over its rows, all accumulated in the same pass.
+ *
+ * Rows get their cell numbers in one of two ways, by the type of the keys:
+ *
+ *     o) if every key is an integer (factors and logicals included) and the
+ *        product of their ranges is small, a row's cell is just its
+ *        position in that grid, computed directly from the values, with
+ *        no hashing at all;
+ *     o) otherwise the rows are grouped with the parallel hash grouping of
+ *        Grouping.hpp, which handles any mix of key types and costs memory
+ *        in proportion to the rows, not to the ranges of the values.
+ *
+ * The cells are then accumulated either with a private set of counters
+ * per thread, each thread taking a contiguous chunk of rows, merged in
+ * order afterward (when there are few cells), or else by laying the rows
+ * of each cell out together and handing whole cells to threads (when there
+ * are many, or percentiles are wanted, which need a cell's values
+ * together). Either way a million distinct values cost a few arrays the
+ * size of the data, not a copy per thread.
+ *
+ * Empty cells are dropped, and the rest come back in Stata's sort order of
+ * their keys.
+ */
+
+namespace {
+
+// Each thread should get at least this many rows
+const R_xlen_t MIN_ROWS_PER_THREAD = 1 << 15;
+
+// The most cells a grid of integer keys may have: no more than this, nor
+// than the rows (but always at least this many are allowed)
+const double DIRECT_CELLS = 1 << 16;
+const double DIRECT_CELLS_MAX = 1 << 24;
+
+// The most cell accumulators all the threads together may keep privately
+const double LOCAL_CELLS = 1 << 20;
+
+struct Cell
+{
+    double obs, freq;
+    size_t first;
+
+    Cell() : obs(0), freq(0), first(SIZE_MAX) { }
+
+    void
+    merge(const Cell &b)
+    {
+        obs += b.obs;
+        freq += b.freq;
+        first = std::min(first, b.first);
+    }
+};
+
+// One value column in one cell
+struct CellStat
+{
+    Moments mom;
+    double n, min, max;
+
+    CellStat() : n(0), min(R_PosInf), max(R_NegInf) { }
+
+    void
+    add(double x, double wt)
+    {
+        n++;
+        mom.add(x, wt);
+        min = std::min(min, x);
+        max = std::max(max, x);
+    }
+
+    void
+    merge(const CellStat &b)
+    {
+        n += b.n;
+        mom.merge(b.mom);
+        min = std::min(min, b.min);
+        max = std::max(max, b.max);
+    }
+};
+
+// The cell of every row, with a row that's left out in cell ncells
+struct CellIndex
+{
+    std::vector<int> cell;
+    size_t ncells;
+};
+
+// Cells as positions in the grid of the integer keys' ranges, or false if
+// the keys aren't all integers or the grid would be too big
+bool
+direct_cells(const KeyColumns &keys, size_t n, const std::vector<char> &use,
+             int nthreads, CellIndex &index)
+{
+    size_t nkeys = keys.ncol();
+    std::vector<int> lo(nkeys), size(nkeys);
+    std::vector<size_t> stride(nkeys);
+
+    double ncells = 1;
+    for(size_t j = 0; j < nkeys; j++)
+    {
+        if(keys.column(j).kind != KEY_INT)
+            return false;
+
+        const int *x = keys.column(j).itg;
+        int mn = INT_MAX, mx = INT_MIN;
+
+        #pragma omp parallel for num_threads(nthreads) reduction(min:mn) reduction(max:mx)
+        for(R_xlen_t i = 0; i < (R_xlen_t) n; i++)
+        {
+            if(x[i] == NA_INTEGER)
+                continue;
+
+            mn = std::min(mn, x[i]);
+            mx = std::max(mx, x[i]);
+        }
+
+        // Position 0 is the missing value
+        lo[j] = mn;
+        size[j] = mn > mx ? 1 : (int) std::min((double) mx - mn + 2, (double) INT_MAX);
+        ncells *= size[j];
+    }
+
+    if(ncells > std::max(DIRECT_CELLS, (double) n) || ncells > DIRECT_CELLS_MAX)
+        return false;
+
+    for(size_t j = nkeys; j-- > 0; )
+        stride[j] = j + 1 < nkeys ? stride[j + 1] * size[j + 1] : 1;
+
+    index.ncells = (size_t) ncells;
+    index.cell.resize(n);
+
+    #pragma omp parallel for num_threads(nthreads)
+    for(R_xlen_t i = 0; i < (R_xlen_t) n; i++)
+    {
+        size_t c = 0;
+        for(size_t j = 0; j < nkeys; j++)
+        {
+            int v = keys.column(j).itg[i];
+            c += (v == NA_INTEGER ? 0 : (size_t) (v - lo[j]) + 1) * stride[j];
+        }
+
+        index.cell[i] = use[i] ? (int) c : (int) index.ncells;
+    }
+
+    return true;
+}
+
+void
+hashed_cells(const KeyColumns &keys, size_t n, const std::vector<char> &use,
+             int nthreads, CellIndex &index)
+{
+    Groups groups = find_groups(keys, nthreads);
+
+    index.ncells = groups.count();
+    index.cell.swap(groups.id);
+
+    #pragma omp parallel for num_threads(nthreads)
+    for(R_xlen_t i = 0; i < (R_xlen_t) n; i++)
+        if(!use[i])
+            index.cell[i] = (int) index.ncells;
+}
+
+// The weight of row i, which must be one that counts
+inline double
+weight_of(const double *wp, size_t i)
+{
+    return wp == NULL ? 1 : wp[i];
+}
+
+// One key column taken at the given rows, keeping its attributes
+SEXP
+gather_key(SEXP x, const std::vector<size_t> &rows)
+{
+    R_xlen_t nout = (R_xlen_t) rows.size();
+    SEXP out = PROTECT(Rf_allocVector(TYPEOF(x), nout));
+
+    switch(TYPEOF(x))
+    {
+        case INTSXP:
+            for(R_xlen_t r = 0; r < nout; r++)
+                INTEGER(out)[r] = INTEGER(x)[rows[r]];
+            break;
+
+        case LGLSXP:
+            for(R_xlen_t r = 0; r < nout; r++)
+                LOGICAL(out)[r] = LOGICAL(x)[rows[r]];
+            break;
+
+        case REALSXP:
+            for(R_xlen_t r = 0; r < nout; r++)
+                REAL(out)[r] = REAL(x)[rows[r]];
+            break;
+
+        default:
+            for(R_xlen_t r = 0; r < nout; r++)
+                SET_STRING_ELT(out, r, STRING_ELT(x, rows[r]));
+    }
+
+    Rf_copyMostAttrib(x, out);
+
+    UNPROTECT(1);
+    return out;
+}
+
+} // namespace
+
+// Tabulate the nrow rows of the key columns in keys (any number of them,
+// zero giving one cell of every row), using only the rows mask selects (if
+// it isn't NULL) and weighting them by weights (if that isn't NULL; rows
+// with a missing or zero weight are left out). Rows with a missing key are
+// left out too, unless missing is true, when missing values form cells
+// like any other. For each numeric column in values, each cell also gets
+// the moments, extremes and (if p isn't empty) the percentiles p of that
+// column's nonmissing values in it. Returns a list: keys, the key values
+// of the nonempty cells in sorted order; obs and freq, each cell's count
+// of rows and sum of weights; and stats, a list with an element for each
+// column of values holding n, its number of nonmissing values in each
+// cell, and sum_w, mean, m2, m3, m4, min, max (as summarize_columns gives
+// them) and pctiles, a matrix with a row per cell and a column per p.
+// [[Rcpp::export]]
+Rcpp::List
+tabulate_cells(Rcpp::List keys, SEXP mask, SEXP weights, Rcpp::List values,
+               Rcpp::NumericVector p, bool missing, R_xlen_t nrow)
+{
+    size_t n = (size_t) nrow;
+    KeyColumns kc(keys), vc(values);
+
+    if(kc.ncol() > 0 && kc.nrow() != n)
+        Rcpp::stop("Key columns must have one element per row");
+    if(vc.ncol() > 0 && vc.nrow() != n)
+        Rcpp::stop("Value columns must have one element per row");
+    for(size_t j = 0; j < vc.ncol(); j++)
+        if(vc.column(j).kind == KEY_STR)
+            Rcpp::stop("Cannot compute statistics of a string column");
+    if(!Rf_isNull(mask) && (TYPEOF(mask) != LGLSXP || (size_t) Rf_xlength(mask) != n))
+        Rcpp::stop("Mask must be a logical vector with one element per row");
+    if(!Rf_isNull(weights) && (TYPEOF(weights) != REALSXP || (size_t) Rf_xlength(weights) != n))
+        Rcpp::stop("Weights must be a double vector with one element per row");
+
+    const int *mp = Rf_isNull(mask) ? NULL : LOGICAL(mask);
+    const double *wp = Rf_isNull(weights) ? NULL : REAL(weights);
+    size_t nvals = vc.ncol(), np = (size_t) p.size();
+
+    int nthreads = ado_threads_for(n, MIN_ROWS_PER_THREAD);
+
+    // Which rows count
+    std::vector<char> use(n);
+
+    #pragma omp parallel for num_threads(nthreads)
+    for(R_xlen_t i = 0; i < (R_xlen_t) n; i++)
+    {
+        bool u = mp == NULL || (mp[i] != NA_LOGICAL && mp[i]);
+
+        if(wp != NULL && (std::isnan(wp[i]) || wp[i] == 0))
+            u = false;
+        if(!missing && kc.ncol() > 0 && kc.any_missing(i))
+            u = false;
+
+        use[i] = u;
+    }
+
+    CellIndex index;
+    if(!direct_cells(kc, n, use, nthreads, index))
+        hashed_cells(kc, n, use, nthreads, index);
+
+    size_t ncells = index.ncells;
+    const std::vector<int> &cell = index.cell;
+
+    std::vector<Cell> cells(ncells);
+    std::vector<CellStat> stats(ncells * nvals);
+    std::vector<double> pct(ncells * nvals * np, NA_REAL);
+
+    if(np == 0 && (double) ncells * (nvals + 1) * nthreads <= LOCAL_CELLS)
+    {
+        // Few cells: every thread counts a chunk of rows into its own
+        // cells, and the chunks are merged in order
+        std::vector<std::vector<Cell> > tcells(nthreads);
+        std::vector<std::vector<CellStat> > tstats(nthreads);
+
+        #pragma omp parallel for schedule(static, 1) num_threads(nthreads)
+        for(int t = 0; t < nthreads; t++)
+        {
+            std::vector<Cell> &mc = tcells[t];
+            std::vector<CellStat> &ms = tstats[t];
+            mc.resize(ncells);
+            ms.resize(ncells * nvals);
+
+            for(size_t i = n * t / nthreads; i < n * (t + 1) / nthreads; i++)
+            {
+                size_t c = (size_t) cell[i];
+                if(c == ncells)
+                    continue;
+
+                double wt = weight_of(wp, i);
+                mc[c].obs++;
+                mc[c].freq += wt;
+                mc[c].first = std::min(mc[c].first, i);
+
+                for(size_t j = 0; j < nvals; j++)
+                {
+                    double x = vc.number(j, i);
+                    if(!std::isnan(x))
+                        ms[c * nvals + j].add(x, wt);
+                }
+            }
+        }
+
+        for(int t = 0; t < nthreads; t++)
+        {
+            for(size_t c = 0; c < ncells; c++)
+                cells[c].merge(tcells[t][c]);
+            for(size_t k = 0; k < ncells * nvals; k++)
+                stats[k].merge(tstats[t][k]);
+        }
+    } else
+    {
+        // Many cells: lay each one's rows out together and give whole
+        // cells to threads
+        Groups groups;
+        groups.id = cell;
+        groups.first.resize(ncells + 1);
+        GroupRuns runs = group_runs(groups);
+
+        #pragma omp parallel num_threads(nthreads)
+        {
+            std::vector<double> v;
+            std::vector<std::pair<double, double> > vw;
+            std::vector<size_t> ranks;
+
+            #pragma omp for schedule(dynamic, 64)
+            for(R_xlen_t cc = 0; cc < (R_xlen_t) ncells; cc++)
+            {
+                size_t c = (size_t) cc, begin = runs.starts[c], end = runs.starts[c + 1];
+                if(begin == end)
+                    continue;
+
+                Cell &mc = cells[c];
+                mc.first = runs.rows[begin];
+                for(size_t k = begin; k < end; k++)
+                {
+                    mc.obs++;
+                    mc.freq += weight_of(wp, runs.rows[k]);
+                }
+
+                for(size_t j = 0; j < nvals; j++)
+                {
+                    CellStat &ms = stats[c * nvals + j];
+                    v.clear();
+                    vw.clear();
+
+                    for(size_t k = begin; k < end; k++)
+                    {
+                        size_t i = runs.rows[k];
+                        double x = vc.number(j, i);
+                        if(std::isnan(x))
+                            continue;
+
+                        ms.add(x, weight_of(wp, i));
+                        if(np == 0)
+                            continue;
+
+                        if(wp == NULL)
+                            v.push_back(x);
+                        else
+                            vw.push_back(std::make_pair(x, wp[i]));
+                    }
+
+                    if(np == 0 || ms.n == 0)
+                        continue;
+
+                    double *out = &pct[(c * nvals + j) * np];
+                    if(wp == NULL)
+                    {
+                        ranks.clear();
+                        for(size_t k = 0; k < np; k++)
+                            percentile_ranks(v.size(), p[k], ranks);
+
+                        select_ranks(v, ranks);
+                        for(size_t k = 0; k < np; k++)
+                            out[k] = selected_percentile(v, p[k]);
+                    } else
+                    {
+                        std::sort(vw.begin(), vw.end());
+                        for(size_t k = 0; k < np; k++)
+                            out[k] = weighted_percentile(vw, ms.mom.w, p[k]);
+                    }
+                }
+            }
+        }
+    }
+
+    // The nonempty cells, in order of their keys
+    std::vector<size_t> order;
+    for(size_t c = 0; c < ncells; c++)
+        if(cells[c].obs > 0)
+            order.push_back(c);
+
+    std::sort(order.begin(), order.end(), [&cells, &kc](size_t a, size_t b)
+              { return kc.compare(cells[a].first, kc, cells[b].first) < 0; });
+
+    size_t nout = order.size();
+    std::vector<size_t> first(nout);
+    Rcpp::NumericVector obs(nout), freq(nout);
+    for(size_t r = 0; r < nout; r++)
+    {
+        first[r] = cells[order[r]].first;
+        obs[r] = cells[order[r]].obs;
+        freq[r] = cells[order[r]].freq;
+    }
+
+    Rcpp::List key_values(keys.size());
+    for(R_xlen_t j = 0; j < keys.size(); j++)
+        key_values[j] = gather_key(keys[j], first);
+    key_values.names() = keys.names();
+
+    Rcpp::List stat_values(nvals);
+    for(size_t j = 0; j < nvals; j++)
+    {
+        Rcpp::NumericVector cn(nout), sum_w(nout), mean(nout), m2(nout), m3(nout),
+                            m4(nout), min(nout), max(nout);
+        Rcpp::NumericMatrix pctiles(nout, np);
+
+        for(size_t r = 0; r < nout; r++)
+        {
+            const CellStat &s = stats[order[r] * nvals + j];
+            bool any = s.n > 0;
+
+            cn[r] = s.n;
+            sum_w[r] = s.mom.w;
+            mean[r] = any ? s.mom.mean : NA_REAL;
+            m2[r] = any ? s.mom.m2 : NA_REAL;
+            m3[r] = any ? s.mom.m3 : NA_REAL;
+            m4[r] = any ? s.mom.m4 : NA_REAL;
+            min[r] = any ? s.min : NA_REAL;
+            max[r] = any ? s.max : NA_REAL;
+
+            for(size_t k = 0; k < np; k++)
+                pctiles(r, k) = pct[(order[r] * nvals + j) * np + k];
+        }
+
+        stat_values[j] = Rcpp::List::create(Rcpp::Named("n") = cn,
+                                            Rcpp::Named("sum_w") = sum_w,
+                                            Rcpp::Named("mean") = mean,
+                                            Rcpp::Named("m2") = m2,
+                                            Rcpp::Named("m3") = m3,
+                                            Rcpp::Named("m4") = m4,
+                                            Rcpp::Named("min") = min,
+                                            Rcpp::Named("max") = max,
+                                            Rcpp::Named("pctiles") = pctiles);
+    }
+    stat_values.names() = values.names();
+
+    return Rcpp::List::create(Rcpp::Named("keys") = key_values,
+                              Rcpp::Named("obs") = obs,
+                              Rcpp::Named("freq") = freq,
+                              Rcpp::Named("stats") = stat_values);
+}
@@ -0,0 +1,136 @@
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include <Rcpp.h>
+#include "Columns.hpp"
+#include "Grouping.hpp"
+#include "Hashing.hpp"
+#include "Parallel.hpp"
+
+/*
+ * The uniqueness check behind isid: do the key columns take a distinct
+ * value in every row? Rows go into a hash table one at a time and the
+ * first collision ends the search, so data with an early duplicate costs
+ * next to nothing. Very large inputs are instead split by hash into one
+ * partition per thread, and the partitions are checked in parallel; a
+ * duplicate in any of them stops the others.
+ */
+
+namespace {
+
+enum KeyStatus
+{
+    KEY_UNIQUE = 0,
+    KEY_DUPLICATES = 1,
+    KEY_MISSING = 2
+};
+
+// Below this many rows, partitioning costs more than it saves
+const size_t PARALLEL_MIN_ROWS = 1 << 20;
+
+KeyStatus
+check_serial(const KeyColumns &keys, bool missok)
+{
+    size_t n = keys.nrow();
+
+    // Missing values are reported ahead of duplicates wherever they are
+    if(!missok)
+        for(size_t i = 0; i < n; i++)
+            if(keys.any_missing(i))
+                return KEY_MISSING;
+
+    RowTable table(n);
+
+    for(size_t i = 0; i < n; i++)
+    {
+        bool inserted;
+        table.insert((int64_t) i, keys.hash(i),
+                     [&keys](int64_t a, int64_t b) { return keys.equal(a, b); },
+                     &inserted);
+
+        if(!inserted)
+            return KEY_DUPLICATES;
+    }
+
+    return KEY_UNIQUE;
+}
+
+KeyStatus
+check_parallel(const KeyColumns &keys, bool missok, int nthreads)
+{
+    size_t n = keys.nrow();
+
+    if(!missok)
+    {
+        std::atomic<bool> missing(false);
+
+        #pragma omp parallel for num_threads(nthreads)
+        for(R_xlen_t i = 0; i < (R_xlen_t) n; i++)
+            if(keys.any_missing(i))
+                missing.store(true, std::memory_order_relaxed);
+
+        if(missing)
+            return KEY_MISSING;
+    }
+
+    std::vector<uint64_t> hashes = hash_rows(keys, nthreads);
+    HashPartitions parts = partition_by_hash(hashes, nthreads);
+
+    std::atomic<bool> dup(false);
+
+    #pragma omp parallel for schedule(dynamic) num_threads(nthreads)
+    for(int p = 0; p < parts.count(); p++)
+    {
+        RowTable table(parts.starts[p + 1] - parts.starts[p]);
+
+        for(size_t k = parts.starts[p]; k < parts.starts[p + 1]; k++)
+        {
+            if((k & 4095) == 0 && dup.load(std::memory_order_relaxed))
+                break;
+
+            size_t i = parts.rows[k];
+
+            bool inserted;
+            table.insert((int64_t) i, hashes[i],
+                         [&keys](int64_t a, int64_t b) { return keys.equal(a, b); },
+                         &inserted);
+
+            if(!inserted)
+            {
+                dup.store(true, std::memory_order_relaxed);
+                break;
+            }
+        }
+    }
+
+    return dup ? KEY_DUPLICATES : KEY_UNIQUE;
+}
+
+} // namespace
+
+// Check whether the vectors in cols jointly identify rows. Returns
+// "unique", "duplicates", or, if missok is false and some key value is
+// missing, "missing".
+// [[Rcpp::export]]
+std::string
+key_status(Rcpp::List cols, bool missok)
+{
+    KeyColumns keys(cols);
+    size_t n = keys.nrow();
+
+    int nthreads = ado_threads_for(n, PARALLEL_MIN_ROWS / 4);
+
+    KeyStatus status;
+    if(n < PARALLEL_MIN_ROWS || nthreads == 1 || n > UINT32_MAX)
+        status = check_serial(keys, missok);
+    else
+        status = check_parallel(keys, missok, nthreads);
+
+    if(status == KEY_MISSING)
+        return "missing";
+    if(status == KEY_DUPLICATES)
+        return "duplicates";
+
+    return "unique";
+}
@@ -0,0 +1,233 @@
+#ifndef ADO_COLUMNS_H
+#define ADO_COLUMNS_H
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include <Rcpp.h>
+#include <Rversion.h>
+#include "Hashing.hpp"
+
+/*
+ * A read-only view of a set of R vectors used together as a key: the
+ * by-variables of a by prefix, the id variables of isid, the match
+ * variables of merge. The constructor pulls out raw data pointers on the
+ * main thread; everything after that is plain memory access and can be
+ * called from worker threads.
+ *
+ * Numbers compare by value whatever their storage (so an integer key can
+ * match a double one), and all missing values compare equal to each
+ * other. Strings are compared by CHARSXP, which R caches globally, so
+ * equal strings are the same pointer and hashing one is hashing an
+ * address. Factors are keyed by their codes.
+ */
+
+enum KeyKind
+{
+    KEY_INT = 0,
+    KEY_REAL = 1,
+    KEY_STR = 2
+};
+
+struct KeyColumn
+{
+    KeyKind kind;
+    const int *itg;
+    const double *dbl;
+    const SEXP *str;
+};
+
+class KeyColumns
+{
+    public:
+        KeyColumns(Rcpp::List cols)
+            : n(0), blank(R_BlankString), na_string(NA_STRING)
+        {
+            for(R_xlen_t j = 0; j < cols.size(); j++)
+            {
+                SEXP x = cols[j];
+                KeyColumn c = { KEY_INT, NULL, NULL, NULL };
+
+                switch(TYPEOF(x))
+                {
+                    case INTSXP:
+                        c.itg = INTEGER(x);
+                        break;
+
+                    case LGLSXP:
+                        c.itg = LOGICAL(x);
+                        break;
+
+                    case REALSXP:
+                        c.kind = KEY_REAL;
+                        c.dbl = REAL(x);
+                        break;
+
+                    case STRSXP:
+                        c.kind = KEY_STR;
+#if R_VERSION >= R_Version(3, 5, 0)
+                        c.str = STRING_PTR_RO(x);
+#else
+                        c.str = STRING_PTR(x);
+#endif
+                        break;
+
+                    default:
+                        throw std::runtime_error("Unsupported key column type");
+                }
+
+                if(j == 0)
+                    n = (size_t) Rf_xlength(x);
+                else if((size_t) Rf_xlength(x) != n)
+                    throw std::runtime_error("Key columns differ in length");
+
+                keys.push_back(c);
+            }
+        }
+
+        size_t nrow() const { return n; }
+        size_t ncol() const { return keys.size(); }
+        const KeyColumn &column(size_t j) const { return keys[j]; }
+
+        // Numeric keys as doubles, with missing values as NaN
+        double
+        number(size_t j, size_t i) const
+        {
+            const KeyColumn &c = keys[j];
+
+            if(c.kind == KEY_INT)
+                return c.itg[i] == NA_INTEGER ? NAN : (double) c.itg[i];
+            return c.dbl[i];
+        }
+
+        bool
+        missing(size_t j, size_t i) const
+        {
+            const KeyColumn &c = keys[j];
+
+            if(c.kind == KEY_STR)
+                return c.str[i] == na_string || c.str[i] == blank;
+            return std::isnan(number(j, i));
+        }
+
+        bool
+        any_missing(size_t i) const
+        {
+            for(size_t j = 0; j < keys.size(); j++)
+                if(missing(j, i))
+                    return true;
+
+            return false;
+        }
+
+        uint64_t
+        hash(size_t i) const
+        {
+            uint64_t h = 0;
+
+            for(size_t j = 0; j < keys.size(); j++)
+            {
+                uint64_t v;
+
+                if(keys[j].kind == KEY_STR)
+                {
+                    SEXP s = keys[j].str[i];
+                    v = (uint64_t) (uintptr_t) (s == blank ? na_string : s);
+                } else
+                {
+                    // Normalize -0 to 0 and every NaN to one pattern so
+                    // that equal values hash equally
+                    double d = number(j, i);
+                    if(d == 0)
+                        d = 0;
+                    if(std::isnan(d))
+                        d = NAN;
+
+                    memcpy(&v, &d, sizeof(double));
+                }
+
+                h = hash_combine(h, v);
+            }
+
+            return h;
+        }
+
+        // Do row i of this key and row k of other (of the same shape) hold
+        // equal keys?
+        bool
+        equal(size_t i, const KeyColumns &other, size_t k) const
+        {
+            for(size_t j = 0; j < keys.size(); j++)
+            {
+                if(keys[j].kind == KEY_STR)
+                {
+                    if(keys[j].str[i] != other.keys[j].str[k] &&
+                       !(missing(j, i) && other.missing(j, k)))
+                        return false;
+                } else
+                {
+                    double a = number(j, i), b = other.number(j, k);
+                    if(a != b && !(std::isnan(a) && std::isnan(b)))
+                        return false;
+                }
+            }
+
+            return true;
+        }
+
+        bool equal(size_t i, size_t k) const { return equal(i, *this, k); }
+
+        // Order row i of this key against row k of other: numbers ascending
+        // with missing values last, strings bytewise with missing ones
+        // first, as Stata sorts them. Comparing strings needs CHAR(), so
+        // unlike the rest of the class this is for the main thread only.
+        int
+        compare(size_t i, const KeyColumns &other, size_t k) const
+        {
+            for(size_t j = 0; j < keys.size(); j++)
+            {
+                if(keys[j].kind == KEY_STR)
+                {
+                    SEXP a = keys[j].str[i], b = other.keys[j].str[k];
+                    if(a == b)
+                        continue;
+
+                    bool ma = missing(j, i), mb = other.missing(j, k);
+                    if(ma && mb)
+                        continue;
+                    if(ma || mb)
+                        return ma ? -1 : 1;
+
+                    int c = strcmp(CHAR(a), CHAR(b));
+                    if(c != 0)
+                        return c < 0 ? -1 : 1;
+                } else
+                {
+                    double a = number(j, i), b = other.number(j, k);
+
+                    bool ma = std::isnan(a), mb = std::isnan(b);
+                    if(ma && mb)
+                        continue;
+                    if(ma || mb)
+                        return ma ? 1 : -1;
+
+                    if(a != b)
+                        return a < b ? -1 : 1;
+                }
+            }
+
+            return 0;
+        }
+
+    private:
+        size_t n;
+        std::vector<KeyColumn> keys;
+
+        SEXP blank;
+        SEXP na_string;
+};
+
+#endif /* ADO_COLUMNS_H */
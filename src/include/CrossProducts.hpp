@@ -0,0 +1,27 @@
+#ifndef ADO_CROSSPRODUCTS_H
+#define ADO_CROSSPRODUCTS_H
+
+#include <cstddef>
+
+/*
+ * Sums of products of columns, the inner loop of correlate and regress.
+ * The kernels gather a chunk of rows into column-major buffers, ld doubles
+ * to a column, small enough to stay in cache; the products of a pair of
+ * buffers are then added up a tile at a time, register-blocked 4 columns
+ * by 2, with SSE2 doing two rows at once where it's available, so each
+ * value loaded feeds several multiply-adds. Nothing here touches the R API.
+ */
+
+// out[j * pb + k] += the sum over r < nr of a[j * ld + r] * b[k * ld + r],
+// for j < pa and k < pb. With upper (when the result is symmetric), only
+// the blocks on or above the diagonal are done, and the rest of out is
+// left to be filled in by symmetrize().
+void
+cross_add(const double *a, size_t pa, const double *b, size_t pb, size_t ld,
+          size_t nr, double *out, bool upper);
+
+// Copy the upper triangle of the p x p matrix m to the lower
+void
+symmetrize(double *m, size_t p);
+
+#endif /* ADO_CROSSPRODUCTS_H */
@@ -0,0 +1,328 @@
+#ifndef ADO_DTA_H
+#define ADO_DTA_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+/*
+ * The parts of Stata's .dta format (releases 117, 118 and 119) shared by
+ * the native readers and writer. Nothing here touches the R API.
+ */
+
+namespace dta {
+
+// Variable type codes; 1 through 2045 are str# with that many bytes
+const int STRL = 32768;
+const int DOUBLE = 65526;
+const int FLOAT = 65527;
+const int LONG = 65528;
+const int INT = 65529;
+const int BYTE = 65530;
+
+const int MAX_STR = 2045;
+
+// Indices into the <map> section's table of offsets
+enum
+{
+    MAP_STATA_DATA = 0,
+    MAP_MAP,
+    MAP_VARIABLE_TYPES,
+    MAP_VARNAMES,
+    MAP_SORTLIST,
+    MAP_FORMATS,
+    MAP_VALUE_LABEL_NAMES,
+    MAP_VARIABLE_LABELS,
+    MAP_CHARACTERISTICS,
+    MAP_DATA,
+    MAP_STRLS,
+    MAP_VALUE_LABELS,
+    MAP_STATA_DATA_END,
+    MAP_EOF,
+    MAP_SIZE
+};
+
+// The largest non-missing values of the integer types; anything above
+// these is one of the missing values . and .a through .z
+const int8_t MAX_BYTE = 100;
+const int16_t MAX_INT = 32740;
+const int32_t MAX_LONG = 2147483620;
+
+// Bit patterns of the system missing value . for the float types; these
+// and everything above them are missing
+const uint32_t MISSING_FLOAT = 0x7f000000u;
+const uint64_t MISSING_DOUBLE = 0x7fe0000000000000ull;
+
+inline bool
+host_is_lsf()
+{
+    const uint16_t one = 1;
+    return *((const uint8_t *) &one) == 1;
+}
+
+inline uint8_t bswap(uint8_t x) { return x; }
+inline uint16_t bswap(uint16_t x) { return (uint16_t) ((x >> 8) | (x << 8)); }
+inline uint32_t bswap(uint32_t x) { return __builtin_bswap32(x); }
+inline uint64_t bswap(uint64_t x) { return __builtin_bswap64(x); }
+
+// Read an unsigned integer of type T from unaligned memory, swapping
+// its bytes if the file's byte order isn't the host's
+template<typename T>
+inline T
+load(const char *p, bool swap)
+{
+    T v;
+    memcpy(&v, p, sizeof(T));
+    return swap ? bswap(v) : v;
+}
+
+template<typename T>
+inline void
+store(char *p, T v, bool swap)
+{
+    if(swap)
+        v = bswap(v);
+    memcpy(p, &v, sizeof(T));
+}
+
+inline size_t
+type_width(int type)
+{
+    if(type >= 1 && type <= MAX_STR)
+        return (size_t) type;
+
+    switch(type)
+    {
+        case STRL:   return 8;
+        case DOUBLE: return 8;
+        case FLOAT:  return 4;
+        case LONG:   return 4;
+        case INT:    return 2;
+        case BYTE:   return 1;
+    }
+
+    return 0;
+}
+
+inline bool
+is_string_type(int type)
+{
+    return (type >= 1 && type <= MAX_STR) || type == STRL;
+}
+
+// Integer-valued types, which we read into R integer vectors
+inline bool
+is_integer_type(int type)
+{
+    return type == BYTE || type == INT || type == LONG;
+}
+
+// Decode a value of an integer type; returns false if it's missing
+inline bool
+decode_integer(const char *p, int type, bool swap, int32_t *out)
+{
+    if(type == BYTE)
+    {
+        int8_t v = (int8_t) p[0];
+        *out = v;
+        return v <= MAX_BYTE;
+    } else if(type == INT)
+    {
+        int16_t v = (int16_t) load<uint16_t>(p, swap);
+        *out = v;
+        return v <= MAX_INT;
+    } else
+    {
+        int32_t v = (int32_t) load<uint32_t>(p, swap);
+        *out = v;
+        return v <= MAX_LONG;
+    }
+}
+
+// Decode a value of any numeric type as a double; returns false if
+// it's missing
+inline bool
+decode_double(const char *p, int type, bool swap, double *out)
+{
+    if(type == DOUBLE)
+    {
+        uint64_t bits = load<uint64_t>(p, swap);
+        memcpy(out, &bits, sizeof(double));
+
+        return *out < 0 || bits < MISSING_DOUBLE;
+    } else if(type == FLOAT)
+    {
+        uint32_t bits = load<uint32_t>(p, swap);
+
+        float f;
+        memcpy(&f, &bits, sizeof(float));
+        *out = f;
+
+        return f < 0 || bits < MISSING_FLOAT;
+    } else
+    {
+        int32_t v;
+        bool ok = decode_integer(p, type, swap, &v);
+        *out = v;
+
+        return ok;
+    }
+}
+
+// The length of a str# value, which is NUL-padded unless it fills the field
+inline size_t
+str_length(const char *p, size_t width)
+{
+    const void *nul = memchr(p, '\0', width);
+    return nul == NULL ? width : (size_t) ((const char *) nul - p);
+}
+
+// A strL cell is a reference (v, o) to a GSO in the <strls> section;
+// pack it into one integer for use as a lookup key. v takes the low 16
+// bits (24 in 119, which allows more variables) and o the rest, which is
+// all of both in every release: 117's v is at most 32767 and its o 32
+// bits, 118's o is 48 bits and 119's 40.
+inline uint64_t
+strl_key(uint64_t v, uint64_t o, int release)
+{
+    int vbits = release == 119 ? 24 : 16;
+    return (o << vbits) | (v & ((UINT64_C(1) << vbits) - 1));
+}
+
+inline uint64_t
+decode_strl_ref(const char *p, int release, bool swap)
+{
+    if(release == 117)
+        return strl_key(load<uint32_t>(p, swap), load<uint32_t>(p + 4, swap), release);
+
+    // 118 packs v into 2 bytes and o into 6, and 119 v into 3 and o into
+    // 5, each in the file's byte order
+    int vlen = release == 119 ? 3 : 2;
+    bool lsf = host_is_lsf() != swap;
+    uint64_t v = 0, o = 0;
+
+    for(int i = 0; i < vlen; i++)
+        v = (v << 8) | (unsigned char) p[lsf ? vlen - 1 - i : i];
+    for(int i = 0; i < 8 - vlen; i++)
+        o = (o << 8) | (unsigned char) p[vlen + (lsf ? 7 - vlen - i : i)];
+
+    return strl_key(v, o, release);
+}
+
+// The inverse of decode_strl_ref: write a (v, o) reference into a cell
+inline void
+encode_strl_ref(char *p, int release, uint64_t v, uint64_t o, bool swap)
+{
+    if(release == 117)
+    {
+        store<uint32_t>(p, (uint32_t) v, swap);
+        store<uint32_t>(p + 4, (uint32_t) o, swap);
+        return;
+    }
+
+    int vlen = release == 119 ? 3 : 2;
+    bool lsf = host_is_lsf() != swap;
+
+    for(int i = 0; i < vlen; i++)
+        p[lsf ? i : vlen - 1 - i] = (char) ((v >> (8 * i)) & 0xff);
+    for(int i = 0; i < 8 - vlen; i++)
+        p[vlen + (lsf ? i : 7 - vlen - i)] = (char) ((o >> (8 * i)) & 0xff);
+}
+
+struct Meta
+{
+    int release;
+    bool swap;          // file byte order differs from the host's?
+
+    int64_t nvar;
+    int64_t nobs;
+    std::string label;
+    std::string timestamp;
+
+    uint64_t map[MAP_SIZE];
+
+    std::vector<int> types;
+    std::vector<std::string> varnames;
+    std::vector<std::string> formats;
+    std::vector<std::string> lblnames;
+    std::vector<std::string> varlabels;
+
+    std::vector<size_t> offsets;  // of each variable within a row
+    size_t rowwidth;
+    size_t data_start;            // of the first row in the file
+
+    int var_index(const std::string &name) const;
+};
+
+// A value label set: parallel vectors of values and their labels
+struct ValueLabels
+{
+    std::vector<int32_t> values;
+    std::vector<std::string> labels;
+};
+
+// A string from the <strls> section, pointing into the file's bytes
+struct Gso
+{
+    const char *p;
+    size_t len;
+    bool binary;
+};
+
+// Parse everything up to the <data> section; buf must hold at least that
+// much of the file. Throws std::runtime_error on anything malformed.
+void parse_meta(const char *buf, size_t len, Meta &m);
+
+// Parse the <value_labels> section
+std::map<std::string, ValueLabels> parse_value_labels(const char *buf, size_t len,
+                                                      const Meta &m);
+
+// Lengths of the fixed-width fields in the metadata sections
+inline size_t name_width(int release) { return release == 117 ? 33 : 129; }
+inline size_t format_width(int release) { return release == 117 ? 49 : 57; }
+inline size_t varlabel_width(int release) { return release == 117 ? 81 : 321; }
+
+// Walk the <strls> section, calling f(key, gso) for each GSO in it
+template<typename Func>
+void
+for_each_gso(const char *buf, size_t len, const Meta &m, Func f)
+{
+    size_t pos = m.map[MAP_STRLS] + strlen("<strls>");
+    size_t end = std::min((size_t) m.map[MAP_VALUE_LABELS], len);
+    size_t olen = m.release == 117 ? 4 : 8;
+
+    while(pos + 3 <= end && memcmp(buf + pos, "GSO", 3) == 0)
+    {
+        pos += 3;
+
+        uint64_t v = load<uint32_t>(buf + pos, m.swap);
+        uint64_t o = olen == 4 ? load<uint32_t>(buf + pos + 4, m.swap) :
+                                 load<uint64_t>(buf + pos + 4, m.swap);
+        pos += 4 + olen;
+
+        unsigned char t = (unsigned char) buf[pos];
+        uint32_t n = load<uint32_t>(buf + pos + 1, m.swap);
+        pos += 5;
+
+        if(pos + n > end)
+            break;
+
+        Gso g;
+        g.p = buf + pos;
+        g.binary = (t == 129);
+
+        // ASCII strLs are stored with their terminating NUL
+        g.len = (!g.binary && n > 0) ? n - 1 : n;
+
+        f(strl_key(v, o, m.release), g);
+        pos += n;
+    }
+}
+
+} // namespace dta
+
+#endif /* ADO_DTA_H */
@@ -0,0 +1,16 @@
+#ifndef ADO_DTAREADER_H
+#define ADO_DTAREADER_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <Rcpp.h>
+#include "Dta.hpp"
+
+// The attributes read.dta13 would set on a data.frame of the variables in
+// vars of a .dta file
+Rcpp::List dta_attributes(const dta::Meta &m, const std::vector<int> &vars,
+                          const std::map<std::string, dta::ValueLabels> &vls);
+
+#endif /* ADO_DTAREADER_H */
@@ -0,0 +1,69 @@
+#ifndef ADO_GROUPING_H
+#define ADO_GROUPING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Columns.hpp"
+
+/*
+ * Numbering the distinct values of a set of key columns, for the commands
+ * that work by group: collapse, egen, the by prefix. Rows are hashed once;
+ * big inputs are then split by hash into one partition per thread, so that
+ * each key's rows all land in the same partition and the partitions can
+ * be handled independently. None of these functions touch the R API, so
+ * the KeyColumns must be built beforehand on the main thread.
+ */
+
+// The hash of every row's key
+std::vector<uint64_t>
+hash_rows(const KeyColumns &keys, int nthreads);
+
+// Row numbers grouped by the high bits of their hashes: partition p holds
+// rows[starts[p]] through rows[starts[p + 1] - 1], in ascending order
+struct HashPartitions
+{
+    int shift;
+    std::vector<size_t> starts;
+    std::vector<uint32_t> rows;
+
+    int count() const { return (int) starts.size() - 1; }
+    size_t part_of(uint64_t h) const { return shift == 64 ? 0 : h >> shift; }
+};
+
+// Requires hashes.size() <= UINT32_MAX
+HashPartitions
+partition_by_hash(const std::vector<uint64_t> &hashes, int nthreads);
+
+// The group number of each row, counting from 0 in order of first
+// appearance, and the first row of each group
+struct Groups
+{
+    std::vector<int> id;
+    std::vector<size_t> first;
+
+    size_t count() const { return first.size(); }
+};
+
+Groups
+find_groups(const KeyColumns &keys, int nthreads);
+
+// Groups from numbers already assigned, counting from 1 (as group_index
+// returns them to R). Rows numbered 0 or less, which includes NA, go into
+// one more group at the end, for callers to ignore.
+Groups
+groups_from_ids(const int *ids, size_t n, size_t ngroups);
+
+// The rows of each group laid out together: group g's are
+// rows[starts[g]] through rows[starts[g + 1] - 1], in ascending order
+struct GroupRuns
+{
+    std::vector<size_t> starts;
+    std::vector<size_t> rows;
+};
+
+GroupRuns
+group_runs(const Groups &groups);
+
+#endif /* ADO_GROUPING_H */
@@ -0,0 +1,117 @@
+#ifndef ADO_HASHING_H
+#define ADO_HASHING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * Hashing of composite row keys and an open-addressing table of rows,
+ * shared by the kernels that group, deduplicate or join on key columns.
+ * Nothing here touches the R API.
+ */
+
+// The splitmix64 finalizer: a cheap bijective mix with good avalanche
+inline uint64_t
+hash_mix(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
+
+    return x;
+}
+
+// Fold the hash of one more key column into a row's running hash
+inline uint64_t
+hash_combine(uint64_t h, uint64_t v)
+{
+    return hash_mix(h ^ (v + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2)));
+}
+
+/*
+ * A table of row numbers keyed by the rows' hashes, with linear probing.
+ * It holds only row numbers; equality of the keys behind them is decided
+ * by a caller-supplied predicate, so the same table serves any set of key
+ * columns. Callers that need something per distinct key index their own
+ * arrays by the slot numbers insert() returns.
+ */
+class RowTable
+{
+    public:
+        static const int64_t EMPTY = -1;
+
+        // A table with room for n distinct keys at a load factor of at
+        // most one half
+        RowTable(size_t n)
+        {
+            size_t cap = 16;
+            while(cap < 2 * n)
+                cap <<= 1;
+
+            mask = cap - 1;
+            rows.assign(cap, (int64_t) EMPTY);
+            hashes.resize(cap);
+        }
+
+        size_t capacity() const { return rows.size(); }
+        int64_t row_at(size_t slot) const { return rows[slot]; }
+
+        // Find the slot of a row whose key equals row's, per eq(other, row),
+        // or put row in an empty slot. Returns the slot; *inserted says
+        // which happened.
+        template<typename Eq>
+        size_t
+        insert(int64_t row, uint64_t h, Eq eq, bool *inserted)
+        {
+            size_t i = h & mask;
+
+            while(true)
+            {
+                int64_t r = rows[i];
+                if(r == EMPTY)
+                {
+                    rows[i] = row;
+                    hashes[i] = h;
+                    *inserted = true;
+
+                    return i;
+                }
+
+                if(hashes[i] == h && eq(r, row))
+                {
+                    *inserted = false;
+                    return i;
+                }
+
+                i = (i + 1) & mask;
+            }
+        }
+
+        // The slot holding a row for which match(row) is true, or -1
+        template<typename Match>
+        int64_t
+        find(uint64_t h, Match match) const
+        {
+            size_t i = h & mask;
+
+            while(rows[i] != EMPTY)
+            {
+                if(hashes[i] == h && match(rows[i]))
+                    return (int64_t) i;
+
+                i = (i + 1) & mask;
+            }
+
+            return -1;
+        }
+
+    private:
+        size_t mask;
+        std::vector<int64_t> rows;
+        std::vector<uint64_t> hashes;
+};
+
+#endif /* ADO_HASHING_H */
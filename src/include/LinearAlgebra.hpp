@@ -0,0 +1,57 @@
+#ifndef ADO_LINEARALGEBRA_H
+#define ADO_LINEARALGEBRA_H
+
+#include <cstddef>
+#include <vector>
+
+/*
+ * Small dense solvers for the estimation commands, which reduce the data
+ * to a p x p matrix of cross products (or of second derivatives) before
+ * getting here, so none of this needs to be fast for large p. Matrices
+ * are row-major std::vectors. Nothing here touches the R API.
+ */
+
+// A Cholesky factorization of the leading k x k block of the symmetric
+// p x p matrix a, taking the variables in order and leaving out any that
+// are collinear with the ones before it: those for which what's left of
+// the diagonal, after taking out the ones already in, is no more than
+// tol times scale[j]. kept gets the variables left in and l their lower
+// factor, m x m for m = kept.size(). Returns the least ratio of what was
+// left on a kept diagonal to its scale, 1 if none was kept, as a measure
+// of how well conditioned the kept block is.
+double
+cholesky_in_order(const double *a, size_t p, size_t k, const double *scale,
+                  double tol, std::vector<size_t> &kept, std::vector<double> &l);
+
+// Solve l z = b, for the m x m lower triangular l
+std::vector<double>
+forward_solve(const std::vector<double> &l, size_t m, std::vector<double> b);
+
+// Solve l' x = z, for the m x m lower triangular l
+std::vector<double>
+back_solve(const std::vector<double> &l, size_t m, std::vector<double> z);
+
+// The inverse of the m x m matrix with lower Cholesky factor l
+std::vector<double>
+cholesky_inverse(const std::vector<double> &l, size_t m);
+
+// The inverse of the nonsingular m x m matrix a, by Householder QR, for
+// when a is too badly conditioned to trust its Cholesky factor
+std::vector<double>
+inverse_by_qr(std::vector<double> a, size_t m);
+
+// Solve a x = rhs for the symmetric positive semidefinite q x q matrix a
+// (rows lda apart), taking the variables in the order given and leaving
+// out the ones already omitted and any collinear with the ones before
+// them (by cholesky_in_order with tolerance tol, relative to the
+// diagonal), which are then marked omitted. x and inv, the inverse of the
+// part of a kept, have zeros for the omitted variables. rhs may be NULL
+// when only the inverse is wanted. A badly conditioned system is solved
+// by QR instead of with the Cholesky factor.
+void
+solve_in_order(const double *a, size_t lda, const double *rhs,
+               const std::vector<size_t> &order, double tol,
+               std::vector<bool> &omitted, std::vector<double> &x,
+               std::vector<double> &inv);
+
+#endif /* ADO_LINEARALGEBRA_H */
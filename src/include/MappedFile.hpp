@@ -0,0 +1,33 @@
+#ifndef ADO_MAPPEDFILE_H
+#define ADO_MAPPEDFILE_H
+
+#include <cstddef>
+#include <string>
+
+/*
+ * A read-only view of a whole file: mmap()ed where that's available,
+ * otherwise (on Windows) read into a heap buffer.
+ */
+
+class MappedFile
+{
+    public:
+        MappedFile(std::string path);
+        ~MappedFile();
+
+        const char *data() const { return buf; }
+        size_t size() const { return len; }
+
+        // hint that the pages in [offset, offset + n) will be needed soon
+        void willneed(size_t offset, size_t n) const;
+
+    private:
+        MappedFile(const MappedFile& that); // no copy ctor
+        MappedFile& operator=(MappedFile const &); // no assignment
+
+        const char *buf;
+        size_t len;
+        bool mapped;
+};
+
+#endif /* ADO_MAPPEDFILE_H */
@@ -0,0 +1,74 @@
+#ifndef ADO_NUMERIC_COLUMNS_H
+#define ADO_NUMERIC_COLUMNS_H
+
+#include <cmath>
+#include <string>
+
+#include <Rcpp.h>
+
+/*
+ * What the kernels that scan numeric columns row by row (summarize,
+ * correlate, regress, glm, ml) share: a view of a numeric vector with its
+ * data pointer taken on the main thread, so worker threads read only plain
+ * memory, and how a row's mask and weight are read. Unlike the other
+ * headers here, numeric_column() checks an R object and signals R errors,
+ * so it belongs on the main thread.
+ */
+
+// A numeric column's data: integers and logicals through ip, doubles
+// through dp
+struct NumericColumn
+{
+    const int *ip;
+    const double *dp;
+
+    double
+    value(R_xlen_t i) const
+    {
+        if(ip != NULL)
+            return ip[i] == NA_INTEGER ? NAN : (double) ip[i];
+        return dp[i];
+    }
+};
+
+// The column v, which should have n rows; what names it in errors
+inline NumericColumn
+numeric_column(SEXP v, R_xlen_t n, const char *what)
+{
+    if(TYPEOF(v) != INTSXP && TYPEOF(v) != LGLSXP && TYPEOF(v) != REALSXP)
+        Rcpp::stop(std::string(what) + " isn't numeric");
+    if(Rf_xlength(v) != n)
+        Rcpp::stop("Columns must all be the same length");
+
+    NumericColumn c;
+    c.ip = TYPEOF(v) == REALSXP ? NULL : INTEGER(v);
+    c.dp = TYPEOF(v) == REALSXP ? REAL(v) : NULL;
+
+    return c;
+}
+
+// Is row i selected? A NULL mask selects every row, and NA doesn't
+inline bool
+selected(const int *mask, R_xlen_t i)
+{
+    return mask == NULL || (mask[i] != NA_LOGICAL && mask[i]);
+}
+
+// The weight of row i, or 0 to leave it out
+inline double
+weight_of(const double *wp, R_xlen_t i)
+{
+    if(wp == NULL)
+        return 1;
+    return std::isnan(wp[i]) ? 0 : wp[i];
+}
+
+// Stata's reldif(): the difference relative to the size of b, plus 1,
+// which the iterative estimators judge convergence by
+inline double
+reldif(double a, double b)
+{
+    return std::fabs(a - b) / (std::fabs(b) + 1);
+}
+
+#endif /* ADO_NUMERIC_COLUMNS_H */
@@ -0,0 +1,47 @@
+#ifndef ADO_PARALLEL_H
+#define ADO_PARALLEL_H
+
+#include <algorithm>
+#include <cstddef>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/*
+ * A thin layer over OpenMP so the native kernels build (single-threaded)
+ * with toolchains that don't support it. Nothing called from inside a
+ * parallel region may touch the R API: kernels work on raw pointers into
+ * vectors allocated beforehand on the main thread.
+ */
+
+inline int
+ado_max_threads()
+{
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+inline int
+ado_thread_num()
+{
+#ifdef _OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+}
+
+// How many threads are worth starting for n units of work, given that
+// each thread should get at least min_per_thread of them
+inline int
+ado_threads_for(size_t n, size_t min_per_thread)
+{
+    size_t want = n / std::max(min_per_thread, (size_t) 1);
+    return (int) std::max((size_t) 1, std::min(want, (size_t) ado_max_threads()));
+}
+
+#endif /* ADO_PARALLEL_H */
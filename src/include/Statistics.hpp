@@ -0,0 +1,203 @@
+#ifndef ADO_STATISTICS_H
+#define ADO_STATISTICS_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+/*
+ * Building blocks shared by the kernels that compute descriptive
+ * statistics (summarize, the tabulation commands, pctile, collapse):
+ * weighted moments that can be accumulated a value at a time and combined
+ * across chunks of the data, and Stata's percentiles as order statistics
+ * found by selection (introselect, via std::nth_element), so even a
+ * handful of quantiles of a very long column take linear time.
+ * Nothing here touches the R API.
+ */
+
+// Weighted central moments, in the notation of Pebay: w is the total
+// weight, and m2 to m4 are the weighted sums of powers of deviations from
+// the mean. Values are added as they arrive, in the manner of Welford, and
+// two sets of moments combine with the pairwise formulas of Chan et al.
+// and Pebay, so chunks can be done separately and merged in order.
+struct Moments
+{
+    double w, mean, m2, m3, m4;
+
+    Moments() : w(0), mean(0), m2(0), m3(0), m4(0) { }
+
+    // Add the value x with weight wt
+    void
+    add(double x, double wt)
+    {
+        double nw = w + wt;
+        double delta = x - mean, d_n = delta * wt / nw;
+        double term = delta * d_n * w;
+
+        m4 += term * d_n * d_n * (w * w - w * wt + wt * wt) / (wt * wt)
+            + 6 * d_n * d_n * m2 - 4 * d_n * m3;
+        m3 += term * d_n * (w - wt) / wt - 3 * d_n * m2;
+        m2 += term;
+        mean += d_n;
+        w = nw;
+    }
+
+    // Combine with the moments of another set of values
+    void
+    merge(const Moments &b)
+    {
+        if(b.w == 0)
+            return;
+        if(w == 0)
+        {
+            *this = b;
+            return;
+        }
+
+        double nw = w + b.w;
+        double delta = b.mean - mean, d2 = delta * delta;
+
+        m4 += b.m4 + d2 * d2 * w * b.w * (w * w - w * b.w + b.w * b.w) / (nw * nw * nw)
+            + 6 * d2 * (w * w * b.m2 + b.w * b.w * m2) / (nw * nw)
+            + 4 * delta * (w * b.m3 - b.w * m3) / nw;
+        m3 += b.m3 + d2 * delta * w * b.w * (w - b.w) / (nw * nw)
+            + 3 * delta * (w * b.m2 - b.w * m2) / nw;
+        m2 += b.m2 + d2 * w * b.w / nw;
+        mean += delta * b.w / nw;
+        w = nw;
+    }
+};
+
+/*
+ * Stata's pth percentile of n values: with P = n * p / 100, the value of
+ * rank ceil(P) (from 1) if P isn't a whole number, or else the average of
+ * those of ranks P and P + 1. Computing several of them takes three steps:
+ * percentile_ranks() says which ranks (from 0) each needs, select_ranks()
+ * partitions the values so all those ranks hold what they would in sorted
+ * order, and selected_percentile() reads off the answer. The altdef_
+ * versions do the same for the alternative definition, which interpolates.
+ */
+
+inline void
+percentile_ranks(size_t n, double p, std::vector<size_t> &ranks)
+{
+    size_t i = (size_t) std::floor(n * p / 100);
+
+    if(i > 0)
+        ranks.push_back(i - 1);
+    ranks.push_back(i);
+}
+
+// With P = (n + 1) * p / 100, between the values of ranks floor(P) and
+// floor(P) + 1 (from 1), clamped to the smallest and largest values
+inline void
+altdef_ranks(size_t n, double p, std::vector<size_t> &ranks)
+{
+    double pos = (n + 1) * p / 100;
+    size_t i = pos < 1 ? 1 : std::min((size_t) std::floor(pos), n);
+
+    ranks.push_back(i - 1);
+    if(i < n)
+        ranks.push_back(i);
+}
+
+// Beyond this many ranks, selecting them one by one costs more than
+// sorting everything between the lowest and the highest
+const size_t MANY_RANKS = 64;
+
+// Partition v[lo, hi) so each of ranks[rlo, rhi), which all fall in that
+// range, holds the value it would in sorted order: select the middle rank,
+// which splits the range, and recurse on each side with the ranks there.
+// Each level of the recursion is linear, so k ranks take O(n log k).
+inline void
+select_between(std::vector<double> &v, const std::vector<size_t> &ranks,
+               size_t rlo, size_t rhi, size_t lo, size_t hi)
+{
+    if(rlo >= rhi)
+        return;
+
+    size_t mid = rlo + (rhi - rlo) / 2, r = ranks[mid];
+    std::nth_element(v.begin() + lo, v.begin() + r, v.begin() + hi);
+
+    select_between(v, ranks, rlo, mid, lo, r);
+    select_between(v, ranks, mid + 1, rhi, r + 1, hi);
+}
+
+inline void
+select_ranks(std::vector<double> &v, std::vector<size_t> ranks)
+{
+    std::sort(ranks.begin(), ranks.end());
+    ranks.erase(std::unique(ranks.begin(), ranks.end()), ranks.end());
+    while(!ranks.empty() && ranks.back() >= v.size())
+        ranks.pop_back();
+
+    if(ranks.empty())
+        return;
+
+    if(ranks.size() <= MANY_RANKS)
+    {
+        select_between(v, ranks, 0, ranks.size(), 0, v.size());
+        return;
+    }
+
+    // Select the lowest and highest ranks and sort what's between them
+    size_t first = ranks.front(), last = ranks.back();
+    std::nth_element(v.begin(), v.begin() + first, v.end());
+    std::nth_element(v.begin() + first + 1, v.begin() + last, v.end());
+    std::sort(v.begin() + first + 1, v.begin() + last);
+}
+
+inline double
+selected_percentile(const std::vector<double> &v, double p)
+{
+    size_t n = v.size();
+    double pos = n * p / 100;
+    size_t i = (size_t) std::floor(pos);
+
+    if(i >= n)
+        return v[n - 1];
+    if(pos > i || i == 0)
+        return v[i];
+    return (v[i - 1] + v[i]) / 2;
+}
+
+inline double
+altdef_percentile(const std::vector<double> &v, double p)
+{
+    size_t n = v.size();
+    double pos = (n + 1) * p / 100;
+
+    if(pos < 1)
+        return v[0];
+    if(pos >= n)
+        return v[n - 1];
+
+    size_t i = (size_t) std::floor(pos);
+    return v[i - 1] + (pos - i) * (v[i] - v[i - 1]);
+}
+
+// The weighted version, on (value, weight) pairs sorted by value: the first
+// value whose cumulative weight passes W * p / 100, or the average of it
+// and the next if it's reached exactly
+inline double
+weighted_percentile(const std::vector<std::pair<double, double> > &v, double W,
+                    double p)
+{
+    double target = W * p / 100, cum = 0;
+
+    for(size_t i = 0; i < v.size(); i++)
+    {
+        cum += v[i].second;
+
+        if(cum > target)
+            return v[i].first;
+        if(cum == target)
+            return i + 1 < v.size() ? (v[i].first + v[i + 1].first) / 2 : v[i].first;
+    }
+
+    return v.back().first;
+}
+
+#endif /* ADO_STATISTICS_H */
@@ -0,0 +1,344 @@
+#ifndef ADO_TEXTPARSE_H
+#define ADO_TEXTPARSE_H
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <string>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*
+ * Scanning and number-parsing helpers shared by the native text readers
+ * and the string-conversion commands. Everything here works on
+ * (pointer, length) spans that aren't NUL-terminated, and none of it
+ * touches the R API, so it's safe to call from worker threads.
+ */
+
+// Find the first byte in [p, end) equal to a or b; returns end if none is
+// found. Sixteen bytes at a time where SSE2 is available.
+inline const char *
+find_any2(const char *p, const char *end, char a, char b)
+{
+#ifdef __SSE2__
+    const __m128i va = _mm_set1_epi8(a);
+    const __m128i vb = _mm_set1_epi8(b);
+
+    while(end - p >= 16)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i *) p);
+        __m128i m = _mm_or_si128(_mm_cmpeq_epi8(x, va), _mm_cmpeq_epi8(x, vb));
+
+        int mask = _mm_movemask_epi8(m);
+        if(mask != 0)
+            return p + __builtin_ctz(mask);
+
+        p += 16;
+    }
+#endif
+
+    for(; p < end; p++)
+    {
+        if(*p == a || *p == b)
+            return p;
+    }
+
+    return end;
+}
+
+// Find the first byte in [p, end) equal to c
+inline const char *
+find_byte(const char *p, const char *end, char c)
+{
+    const void *q = memchr(p, c, (size_t) (end - p));
+    return q == NULL ? end : (const char *) q;
+}
+
+// Count the occurrences of c in [p, end)
+inline size_t
+count_byte(const char *p, const char *end, char c)
+{
+    size_t n = 0;
+
+#ifdef __SSE2__
+    const __m128i vc = _mm_set1_epi8(c);
+
+    while(end - p >= 16)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i *) p);
+        n += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(x, vc)));
+        p += 16;
+    }
+#endif
+
+    for(; p < end; p++)
+        n += (*p == c);
+
+    return n;
+}
+
+inline bool
+is_blank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f';
+}
+
+// Strip leading and trailing whitespace from a span in place
+inline void
+trim_span(const char *&p, size_t &len)
+{
+    while(len > 0 && is_blank(p[0]))
+    {
+        p++;
+        len--;
+    }
+
+    while(len > 0 && is_blank(p[len - 1]))
+        len--;
+}
+
+// Does the span spell one of the things we read as a numeric missing value:
+// nothing at all, "NA", or Stata's "." and ".a" through ".z"?
+inline bool
+is_missing_token(const char *p, size_t len)
+{
+    if(len == 0)
+        return true;
+
+    if(len == 2 && p[0] == 'N' && p[1] == 'A')
+        return true;
+
+    if(p[0] == '.' && (len == 1 || (len == 2 && p[1] >= 'a' && p[1] <= 'z')))
+        return true;
+
+    return false;
+}
+
+// Parse a whole span as a 32-bit integer that isn't R's NA_integer_
+inline bool
+parse_int(const char *p, size_t len, int *out)
+{
+    if(len == 0)
+        return false;
+
+    bool neg = false;
+    size_t i = 0;
+
+    if(p[0] == '-' || p[0] == '+')
+    {
+        neg = (p[0] == '-');
+        i++;
+    }
+
+    if(i == len || len - i > 10)
+        return false;
+
+    int64_t v = 0;
+    for(; i < len; i++)
+    {
+        unsigned d = (unsigned char) p[i] - '0';
+        if(d > 9)
+            return false;
+
+        v = v * 10 + d;
+    }
+
+    if(neg)
+        v = -v;
+
+    if(v > std::numeric_limits<int>::max() || v <= std::numeric_limits<int>::min())
+        return false;
+
+    *out = (int) v;
+    return true;
+}
+
+// Parse a whole span as a double. Plain decimal and scientific notation
+// with at most 19 significant digits and a small exponent is handled
+// exactly with Clinger's fast path; anything else goes through strtod.
+inline bool
+parse_double(const char *p, size_t len, double *out)
+{
+    static const double pow10[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    if(len == 0)
+        return false;
+
+    size_t i = 0;
+    bool neg = false;
+    if(p[0] == '-' || p[0] == '+')
+    {
+        neg = (p[0] == '-');
+        i++;
+    }
+
+    uint64_t mant = 0;
+    int ndigits = 0, nsig = 0, exp10 = 0;
+    bool seen_dot = false;
+
+    for(; i < len; i++)
+    {
+        char c = p[i];
+
+        if(c >= '0' && c <= '9')
+        {
+            ndigits++;
+
+            // leading zeros aren't significant
+            if(mant == 0 && c == '0')
+            {
+                if(seen_dot)
+                    exp10--;
+                continue;
+            }
+
+            if(nsig < 19)
+            {
+                mant = mant * 10 + (uint64_t) (c - '0');
+                nsig++;
+
+                if(seen_dot)
+                    exp10--;
+            } else if(!seen_dot)
+            {
+                exp10++; // digits beyond what fits only scale the value
+            }
+        } else if(c == '.' && !seen_dot)
+        {
+            seen_dot = true;
+        } else
+        {
+            break;
+        }
+    }
+
+    if(ndigits == 0)
+        return false;
+
+    if(i < len)
+    {
+        if(p[i] != 'e' && p[i] != 'E')
+            return false;
+        i++;
+
+        bool eneg = false;
+        if(i < len && (p[i] == '-' || p[i] == '+'))
+        {
+            eneg = (p[i] == '-');
+            i++;
+        }
+
+        if(i == len)
+            return false;
+
+        int e = 0;
+        for(; i < len; i++)
+        {
+            unsigned d = (unsigned char) p[i] - '0';
+            if(d > 9)
+                return false;
+
+            if(e < 100000)
+                e = e * 10 + (int) d;
+        }
+
+        exp10 += eneg ? -e : e;
+    }
+
+    double v;
+    if(nsig <= 15 && exp10 >= -22 && exp10 <= 22)
+    {
+        v = (double) mant;
+        v = exp10 < 0 ? v / pow10[-exp10] : v * pow10[exp10];
+    } else
+    {
+        // not exactly representable by the fast path: fall back to the
+        // C library on a NUL-terminated copy
+        char buf[128];
+        if(len >= sizeof(buf))
+            return false;
+
+        memcpy(buf, p, len);
+        buf[len] = '\0';
+
+        char *endp;
+        v = strtod(buf, &endp);
+        if(endp != buf + len)
+            return false;
+
+        *out = v;
+        return true;
+    }
+
+    *out = neg ? -v : v;
+    return true;
+}
+
+// How destring reads a cell: bytes to remove first, and whether "%" signs
+// are removed and the value divided by 100, and whether a comma is the
+// decimal point
+class NumberSyntax
+{
+    public:
+        NumberSyntax(const std::string &ignore, bool percent, bool dpcomma)
+            : percent(percent), dpcomma(dpcomma),
+              rewrite(!ignore.empty() || percent || dpcomma)
+        {
+            memset(drop, 0, sizeof(drop));
+            for(size_t k = 0; k < ignore.size(); k++)
+                drop[(unsigned char) ignore[k]] = true;
+            if(percent)
+                drop[(unsigned char) '%'] = true;
+        }
+
+        enum Cell
+        {
+            CELL_NUMBER,
+            CELL_MISSING,
+            CELL_BAD
+        };
+
+        // Read one cell, using scratch for the rewritten text if there's
+        // any rewriting to do. Surrounding whitespace is ignored, and an
+        // empty cell or a missing-value token is missing.
+        Cell
+        parse(const char *p, size_t len, std::string &scratch, double *out) const
+        {
+            if(rewrite)
+            {
+                scratch.clear();
+                for(size_t k = 0; k < len; k++)
+                {
+                    char c = p[k];
+                    if(!drop[(unsigned char) c])
+                        scratch += dpcomma && c == ',' ? '.' : c;
+                }
+
+                p = scratch.data();
+                len = scratch.size();
+            }
+
+            trim_span(p, len);
+            if(is_missing_token(p, len))
+                return CELL_MISSING;
+            if(!parse_double(p, len, out))
+                return CELL_BAD;
+
+            if(percent)
+                *out /= 100;
+            return CELL_NUMBER;
+        }
+
+    private:
+        bool drop[256];
+        bool percent, dpcomma, rewrite;
+};
+
+#endif /* ADO_TEXTPARSE_H */